@@ -81,6 +81,13 @@ memsize(const void *data)
 
 #define VAL(x, swap) (unlikely(((memory->flags & MEM_SWAP) != 0)) ? swap((x)) : (x))
 
+/*
+ * Arrays are converted in chunks on the stack: native values are copied and
+ * byte swapped in tight loops, which the compiler can vectorize, and the ruby
+ * values are appended at once.  The stack also keeps them visible to the GC.
+ */
+#define ARRAY_CHUNK 256
+
 #define NUM_OP(name, type, toNative, fromNative, swap) \
 static void memory_op_put_##name(AbstractMemory* memory, long off, VALUE value); \
 static void \
@@ -144,14 +151,24 @@ memory_put_array_of_##name(VALUE self, VALUE offset, VALUE ary) \
     long count; \
     long off = NUM2LONG(offset); \
     AbstractMemory* memory = MEMORY(self); \
-    long i; \
+    bool swapped = (memory->flags & MEM_SWAP) != 0; \
+    long i, j, n; \
     Check_Type(ary, T_ARRAY); \
     count = RARRAY_LEN(ary); \
     if (likely(count > 0)) checkWrite(memory); \
     checkBounds(memory, off, count * sizeof(type)); \
-    for (i = 0; i < count; i++) { \
-        type tmp = (type) VAL(toNative(RARRAY_AREF(ary, i)), swap); \
-        memcpy(memory->address + off + (i * sizeof(type)), &tmp, sizeof(tmp)); \
+    for (i = 0; i < count; i += n) { \
+        type tmp[ARRAY_CHUNK]; \
+        n = count - i < ARRAY_CHUNK ? count - i : ARRAY_CHUNK; \
+        for (j = 0; j < n; j++) { \
+            /* conversion methods may have shrunk the array */ \
+            VALUE v = likely(i + j < RARRAY_LEN(ary)) ? RARRAY_AREF(ary, i + j) : Qnil; \
+            tmp[j] = (type) toNative(v); \
+        } \
+        if (unlikely(swapped)) { \
+            for (j = 0; j < n; j++) tmp[j] = swap(tmp[j]); \
+        } \
+        memcpy(memory->address + off + (i * sizeof(type)), tmp, n * sizeof(type)); \
     } \
     return self; \
 } \
@@ -168,14 +185,22 @@ memory_get_array_of_##name(VALUE self, VALUE offset, VALUE length) \
     long count = NUM2LONG(length); \
     long off = NUM2LONG(offset); \
     AbstractMemory* memory = MEMORY(self); \
-    VALUE retVal = rb_ary_new2(count); \
-    long i; \
+    bool swapped = (memory->flags & MEM_SWAP) != 0; \
+    VALUE retVal; \
+    long i, j, n; \
     if (likely(count > 0)) checkRead(memory); \
     checkBounds(memory, off, count * sizeof(type)); \
-    for (i = 0; i < count; ++i) { \
-        type tmp; \
-        memcpy(&tmp, memory->address + off + (i * sizeof(type)), sizeof(tmp)); \
-        rb_ary_push(retVal, fromNative(VAL(tmp, swap))); \
+    retVal = rb_ary_new_capa(count); \
+    for (i = 0; i < count; i += n) { \
+        type tmp[ARRAY_CHUNK]; \
+        VALUE values[ARRAY_CHUNK]; \
+        n = count - i < ARRAY_CHUNK ? count - i : ARRAY_CHUNK; \
+        memcpy(tmp, memory->address + off + (i * sizeof(type)), n * sizeof(type)); \
+        if (unlikely(swapped)) { \
+            for (j = 0; j < n; j++) tmp[j] = swap(tmp[j]); \
+        } \
+        for (j = 0; j < n; j++) values[j] = fromNative(tmp[j]); \
+        rb_ary_cat(retVal, values, n); \
     } \
     return retVal; \
 } \
@@ -256,18 +281,59 @@ SWAPU64(uint64_t x)
 # define SWAPULONG SWAPU32
 #endif
 
-NUM_OP(int8, int8_t, NUM2INT, INT2NUM, NOSWAP);
-NUM_OP(uint8, uint8_t, NUM2UINT, UINT2NUM, NOSWAP);
-NUM_OP(int16, int16_t, NUM2INT, INT2NUM, SWAPS16);
-NUM_OP(uint16, uint16_t, NUM2UINT, UINT2NUM, SWAPU16);
-NUM_OP(int32, int32_t, NUM2INT, INT2NUM, SWAPS32);
-NUM_OP(uint32, uint32_t, NUM2UINT, UINT2NUM, SWAPU32);
+/*
+ * Conversions with the Fixnum and Flonum cases inlined, they behave like the
+ * NUM2XXX macros, which call into ruby for every value.
+ */
+static inline int
+num2int_value(VALUE value)
+{
+    if (likely(FIXNUM_P(value))) {
+        long v = FIX2LONG(value);
+        if (likely(v >= INT_MIN && v <= INT_MAX)) {
+            return (int) v;
+        }
+    }
+    return NUM2INT(value);
+}
+
+static inline unsigned int
+num2uint_value(VALUE value)
+{
+    if (likely(FIXNUM_P(value))) {
+        long v = FIX2LONG(value);
+        /* negative values are accepted down to INT_MIN, like NUM2UINT() */
+        if (likely(v < 0 ? v >= INT_MIN : (unsigned long) v <= UINT_MAX)) {
+            return (unsigned int) v;
+        }
+    }
+    return NUM2UINT(value);
+}
+
+static inline unsigned LONG_LONG
+num2ull_value(VALUE value)
+{
+    return likely(FIXNUM_P(value)) ? (unsigned LONG_LONG) FIX2LONG(value) : NUM2ULL(value);
+}
+
+static inline double
+num2dbl_value(VALUE value)
+{
+    return likely(RB_FLOAT_TYPE_P(value)) ? RFLOAT_VALUE(value) : NUM2DBL(value);
+}
+
+NUM_OP(int8, int8_t, num2int_value, INT2NUM, NOSWAP);
+NUM_OP(uint8, uint8_t, num2uint_value, UINT2NUM, NOSWAP);
+NUM_OP(int16, int16_t, num2int_value, INT2NUM, SWAPS16);
+NUM_OP(uint16, uint16_t, num2uint_value, UINT2NUM, SWAPU16);
+NUM_OP(int32, int32_t, num2int_value, INT2NUM, SWAPS32);
+NUM_OP(uint32, uint32_t, num2uint_value, UINT2NUM, SWAPU32);
 NUM_OP(int64, int64_t, NUM2LL, LL2NUM, SWAPS64);
-NUM_OP(uint64, uint64_t, NUM2ULL, ULL2NUM, SWAPU64);
+NUM_OP(uint64, uint64_t, num2ull_value, ULL2NUM, SWAPU64);
 NUM_OP(long, long, NUM2LONG, LONG2NUM, SWAPSLONG);
 NUM_OP(ulong, unsigned long, NUM2ULONG, ULONG2NUM, SWAPULONG);
-NUM_OP(float32, float, NUM2DBL, rb_float_new, NOSWAP);
-NUM_OP(float64, double, NUM2DBL, rb_float_new, NOSWAP);
+NUM_OP(float32, float, num2dbl_value, rb_float_new, NOSWAP);
+NUM_OP(float64, double, num2dbl_value, rb_float_new, NOSWAP);
 NUM_OP(longdouble, long double, rbffi_num2longdouble, rbffi_longdouble_new, NOSWAP);
 
 static inline void*
@@ -635,6 +701,178 @@ memory_write_bytes(int argc, VALUE* argv, VALUE self)
     return memory_put_bytes(argc + 1, wargv, self);
 }
 
+/*
+ * Element size of a packed type and whether it follows the byte order of the
+ * memory, like the scalar accessors do.  Raises for non numeric types.
+ */
+static size_t
+packed_type_size(VALUE type_name, bool* swappable)
+{
+    VALUE nType = rbffi_Type_Lookup(type_name);
+    Type* type;
+
+    if (!NIL_P(nType)) {
+        TypedData_Get_Struct(nType, Type, &rbffi_type_data_type, type);
+        switch (type->nativeType) {
+            case NATIVE_INT16:
+            case NATIVE_UINT16:
+            case NATIVE_INT32:
+            case NATIVE_UINT32:
+            case NATIVE_INT64:
+            case NATIVE_UINT64:
+            case NATIVE_LONG:
+            case NATIVE_ULONG:
+                *swappable = true;
+                return type->ffiType->size;
+            case NATIVE_INT8:
+            case NATIVE_UINT8:
+            case NATIVE_FLOAT32:
+            case NATIVE_FLOAT64:
+            case NATIVE_POINTER:
+                *swappable = false;
+                return type->ffiType->size;
+            default:
+                break;
+        }
+    }
+
+    rb_raise(rb_eArgError, "unsupported packed type '%" PRIsVALUE "'", RB_OBJ_STRING(rb_inspect(type_name)));
+    return 0;
+}
+
+static void
+swap_packed(char* data, long count, size_t size)
+{
+    long i;
+
+    switch (size) {
+        case 2:
+            for (i = 0; i < count; i++) {
+                uint16_t v;
+                memcpy(&v, data + i * 2, 2);
+                v = SWAPU16(v);
+                memcpy(data + i * 2, &v, 2);
+            }
+            break;
+        case 4:
+            for (i = 0; i < count; i++) {
+                uint32_t v;
+                memcpy(&v, data + i * 4, 4);
+                v = SWAPU32(v);
+                memcpy(data + i * 4, &v, 4);
+            }
+            break;
+        case 8:
+            for (i = 0; i < count; i++) {
+                uint64_t v;
+                memcpy(&v, data + i * 8, 8);
+                v = SWAPU64(v);
+                memcpy(data + i * 8, &v, 8);
+            }
+            break;
+    }
+}
+
+/*
+ * call-seq: memory.get_packed(offset, type, count)
+ * Copy +count+ values of +type+ into a binary String, without creating an object per value.
+ * The String holds the values in the byte order of the host, as String#unpack with
+ * native sizes expects them.  Integers of memory with a different {Pointer#order} are swapped.
+ * @param [Integer] offset point in buffer to start from
+ * @param [Symbol, Type] type a numeric or pointer type
+ * @param [Integer] count number of values
+ * @return [String]
+ * @raise {ArgumentError} if +type+ is not supported or +count+ is negative
+ * @raise {IndexError} if +count+ values exceed the memory
+ */
+static VALUE
+memory_get_packed(VALUE self, VALUE offset, VALUE type_name, VALUE count)
+{
+    AbstractMemory* ptr = MEMORY(self);
+    long off = NUM2LONG(offset), n = NUM2LONG(count);
+    bool swappable;
+    size_t size = packed_type_size(type_name, &swappable);
+    VALUE str;
+
+    if (n < 0 || (unsigned long) n > LONG_MAX / size) {
+        rb_raise(rb_eArgError, "invalid count %ld", n);
+    }
+
+    checkRead(ptr);
+    checkBounds(ptr, off, n * size);
+
+    str = rb_str_new((char *) ptr->address + off, n * size);
+    if (swappable && (ptr->flags & MEM_SWAP) != 0) {
+        swap_packed(RSTRING_PTR(str), n, size);
+    }
+
+    return str;
+}
+
+/*
+ * call-seq: memory.put_packed(offset, type, str)
+ * Copy the values of +type+ in the binary String +str+ into memory, as produced by
+ * String#pack with native sizes.  Integers are swapped for memory with a different {Pointer#order}.
+ * @param [Integer] offset point in buffer to start from
+ * @param [Symbol, Type] type a numeric or pointer type
+ * @param [String] str packed values
+ * @return [self]
+ * @raise {ArgumentError} if +type+ is not supported or the size of +str+ isn't a multiple of it
+ * @raise {IndexError} if +str+ exceeds the memory
+ */
+static VALUE
+memory_put_packed(VALUE self, VALUE offset, VALUE type_name, VALUE str)
+{
+    AbstractMemory* ptr = MEMORY(self);
+    long off = NUM2LONG(offset), len;
+    bool swappable;
+    size_t size = packed_type_size(type_name, &swappable);
+
+    StringValue(str);
+    len = RSTRING_LEN(str);
+    if (len % size != 0) {
+        rb_raise(rb_eArgError, "string size %ld is not a multiple of %ld", len, (long) size);
+    }
+
+    checkWrite(ptr);
+    checkBounds(ptr, off, len);
+
+    memcpy(ptr->address + off, RSTRING_PTR(str), len);
+    if (swappable && (ptr->flags & MEM_SWAP) != 0) {
+        swap_packed(ptr->address + off, len / size, size);
+    }
+
+    return self;
+}
+
+/*
+ * call-seq: memory.read_packed(type, count)
+ * @param [Symbol, Type] type a numeric or pointer type
+ * @param [Integer] count number of values
+ * @return [String]
+ * equivalent to :
+ *  memory.get_packed(0, type, count)
+ */
+static VALUE
+memory_read_packed(VALUE self, VALUE type_name, VALUE count)
+{
+    return memory_get_packed(self, INT2FIX(0), type_name, count);
+}
+
+/*
+ * call-seq: memory.write_packed(type, str)
+ * @param [Symbol, Type] type a numeric or pointer type
+ * @param [String] str packed values
+ * @return [self]
+ * equivalent to :
+ *  memory.put_packed(0, type, str)
+ */
+static VALUE
+memory_write_packed(VALUE self, VALUE type_name, VALUE str)
+{
+    return memory_put_packed(self, INT2FIX(0), type_name, str);
+}
+
 /*
  * call-seq: memory.type_size
  * @return [Integer] type size in bytes
@@ -1108,6 +1346,10 @@ rbffi_AbstractMemory_Init(VALUE moduleFFI)
     rb_define_method(classMemory, "put_bytes", memory_put_bytes, -1);
     rb_define_method(classMemory, "read_bytes", memory_read_bytes, 1);
     rb_define_method(classMemory, "write_bytes", memory_write_bytes, -1);
+    rb_define_method(classMemory, "get_packed", memory_get_packed, 3);
+    rb_define_method(classMemory, "put_packed", memory_put_packed, 3);
+    rb_define_method(classMemory, "read_packed", memory_read_packed, 2);
+    rb_define_method(classMemory, "write_packed", memory_write_packed, 2);
     rb_define_method(classMemory, "get_array_of_string", memory_get_array_of_string, -1);
     rb_define_method(classMemory, "read_array_of_string", memory_read_array_of_string, -1);
 
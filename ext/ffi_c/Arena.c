@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2008-2013, Ruby FFI project contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Ruby FFI project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MSC_VER
+#include <sys/param.h>
+#endif
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ruby.h>
+
+#include "rbffi.h"
+#include "compat.h"
+#include "AbstractMemory.h"
+#include "Pointer.h"
+#include "Arena.h"
+
+/*
+ * A region allocator: Pointers are bump allocated from chunks, which are all
+ * released at once.  Chunks of the default size are kept by reset and reused,
+ * larger allocations get a chunk of their own, which is freed by reset.
+ */
+
+typedef struct ArenaChunk_ {
+    struct ArenaChunk_* next;
+    size_t size;
+} ArenaChunk;
+
+#ifndef FFI_ALIGN
+# define FFI_ALIGN(v, a)  (((((size_t) (v))-1) | ((a)-1))+1)
+#endif
+
+/* chunk data follows the header, with the alignment of malloc */
+#define CHUNK_HEADER FFI_ALIGN(sizeof(ArenaChunk), 16)
+#define CHUNK_DATA(chunk) ((char *) (chunk) + CHUNK_HEADER)
+
+typedef struct Arena_ {
+    /* chunks of chunkSize, the first ones up to current are in use */
+    ArenaChunk* chunks;
+    ArenaChunk* current;
+    size_t offset;
+    /* chunks of single large allocations */
+    ArenaChunk* large;
+    size_t chunkSize;
+    size_t used;
+    size_t capacity;
+    /* Pointers handed out since the last reset, they are invalidated by reset */
+    VALUE rbPointers;
+} Arena;
+
+VALUE rbffi_ArenaClass = Qnil;
+
+static void arena_mark(void *data);
+static void arena_compact(void *data);
+static void arena_free(void *data);
+static size_t arena_memsize(const void *data);
+static VALUE arena_release(VALUE self);
+
+static const rb_data_type_t arena_data_type = {
+    .wrap_struct_name = "FFI::Arena",
+    .function = {
+        .dmark = arena_mark,
+        .dfree = arena_free,
+        .dsize = arena_memsize,
+        ffi_compact_callback( arena_compact )
+    },
+    // IMPORTANT: WB_PROTECTED objects must only use the RB_OBJ_WRITE()
+    // macro to update VALUE references, as to trigger write barriers.
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static VALUE
+arena_allocate(VALUE klass)
+{
+    Arena* arena;
+    VALUE obj = TypedData_Make_Struct(klass, Arena, &arena_data_type, arena);
+
+    RB_OBJ_WRITE(obj, &arena->rbPointers, rb_ary_new());
+
+    return obj;
+}
+
+static void
+arena_mark(void *data)
+{
+    Arena* arena = (Arena *) data;
+    rb_gc_mark_movable(arena->rbPointers);
+}
+
+static void
+arena_compact(void *data)
+{
+    Arena* arena = (Arena *) data;
+    ffi_gc_location(arena->rbPointers);
+}
+
+static void
+chunks_free(ArenaChunk* chunk)
+{
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        xfree(chunk);
+        chunk = next;
+    }
+}
+
+static void
+arena_free(void *data)
+{
+    Arena* arena = (Arena *) data;
+
+    chunks_free(arena->chunks);
+    chunks_free(arena->large);
+    xfree(arena);
+}
+
+static size_t
+arena_memsize(const void *data)
+{
+    const Arena* arena = (const Arena *) data;
+    return sizeof(Arena) + arena->capacity;
+}
+
+static ArenaChunk*
+chunk_new(Arena* arena, size_t size)
+{
+    ArenaChunk* chunk;
+
+    if (size > (size_t) LONG_MAX - CHUNK_HEADER) {
+        rb_raise(rb_eNoMemError, "Failed to allocate memory size=%lu bytes", (unsigned long) size);
+    }
+    chunk = (ArenaChunk *) xmalloc(CHUNK_HEADER + size);
+    chunk->next = NULL;
+    chunk->size = size;
+    arena->capacity += size;
+
+    return chunk;
+}
+
+/*
+ * call-seq: initialize(chunk_size = 65536)
+ * @param [Integer] chunk_size size of the chunks memory is allocated from
+ * @yieldparam [Arena] self
+ * @return [self]
+ * A new arena.  If a block is given, the arena is freed after it returns.
+ * Initializing an arena again with another chunk size frees it first.
+ */
+static VALUE
+arena_initialize(int argc, VALUE* argv, VALUE self)
+{
+    Arena* arena;
+    VALUE rbChunkSize = Qnil;
+    long chunkSize = 65536;
+
+    TypedData_Get_Struct(self, Arena, &arena_data_type, arena);
+
+    rb_scan_args(argc, argv, "01", &rbChunkSize);
+    if (rbChunkSize != Qnil) {
+        chunkSize = NUM2LONG(rbChunkSize);
+        if (chunkSize <= 0) {
+            rb_raise(rb_eArgError, "chunk size must be positive");
+        }
+    }
+    if (arena->chunkSize != (size_t) chunkSize) {
+        /* Kept chunks are reused with the assumption that they have the current size */
+        arena_release(self);
+        arena->chunkSize = (size_t) chunkSize;
+    }
+
+    if (rb_block_given_p()) {
+        return rb_ensure(rb_yield, self, arena_release, self);
+    }
+
+    return self;
+}
+
+static char*
+arena_bump(Arena* arena, size_t size, size_t align)
+{
+    ArenaChunk* chunk = arena->current;
+    uintptr_t address;
+
+    /* Allocations which would waste most of a chunk get their own */
+    if (size + align > arena->chunkSize / 2) {
+        chunk = chunk_new(arena, size + align);
+        chunk->next = arena->large;
+        arena->large = chunk;
+        return (char *) FFI_ALIGN(CHUNK_DATA(chunk), align);
+    }
+
+    if (chunk != NULL) {
+        address = FFI_ALIGN(CHUNK_DATA(chunk) + arena->offset, align);
+        if (address + size <= (uintptr_t) CHUNK_DATA(chunk) + chunk->size) {
+            arena->offset = address + size - (uintptr_t) CHUNK_DATA(chunk);
+            return (char *) address;
+        }
+    }
+
+    /* Continue with the next chunk, reusing the ones kept by reset */
+    if (chunk != NULL && chunk->next != NULL) {
+        chunk = chunk->next;
+    } else {
+        ArenaChunk* fresh = chunk_new(arena, arena->chunkSize);
+        if (chunk != NULL) {
+            chunk->next = fresh;
+        } else {
+            arena->chunks = fresh;
+        }
+        chunk = fresh;
+    }
+    arena->current = chunk;
+
+    address = FFI_ALIGN(CHUNK_DATA(chunk), align);
+    arena->offset = address + size - (uintptr_t) CHUNK_DATA(chunk);
+
+    return (char *) address;
+}
+
+/*
+ * call-seq: alloc(size, count = 1, align = 8)
+ * @param [Integer, Symbol, Type] size size of a memory cell (in bytes) or type of it
+ * @param [Integer] count number of cells
+ * @param [Integer] align alignment of the memory, a power of two
+ * @return [Pointer] zeroed memory, valid until {#reset} or {#free}
+ * Allocate memory from the arena.
+ */
+static VALUE
+arena_alloc(int argc, VALUE* argv, VALUE self)
+{
+    Arena* arena;
+    VALUE rbSize = Qnil, rbCount = Qnil, rbAlign = Qnil, rbPointer;
+    long size, count = 1, align = 8;
+    Pointer* p;
+    char* address;
+
+    TypedData_Get_Struct(self, Arena, &arena_data_type, arena);
+    if (arena->chunkSize == 0) {
+        rb_raise(rb_eRuntimeError, "arena not initialized");
+    }
+
+    rb_scan_args(argc, argv, "12", &rbSize, &rbCount, &rbAlign);
+    size = rbffi_type_size(rbSize);
+    if (rbCount != Qnil) {
+        count = NUM2LONG(rbCount);
+    }
+    if (rbAlign != Qnil) {
+        align = NUM2LONG(rbAlign);
+    }
+    if (size < 0 || count < 0 || (size > 0 && count > LONG_MAX / 2 / size)) {
+        rb_raise(rb_eArgError, "invalid size %ld * %ld", size, count);
+    }
+    if (align <= 0 || (align & (align - 1)) != 0) {
+        rb_raise(rb_eArgError, "alignment must be a power of two");
+    }
+
+    /* Allocate the Pointer first, the memory would be lost if that raises */
+    rbPointer = rb_obj_alloc(rbffi_PointerClass);
+    address = arena_bump(arena, (size_t) (size * count), (size_t) align);
+    memset(address, 0, size * count);
+    arena->used += size * count;
+
+    TypedData_Get_Struct(rbPointer, Pointer, &rbffi_pointer_data_type, p);
+    p->memory.address = address;
+    p->memory.size = size * count;
+    p->memory.typeSize = (int) (size > 0 ? size : 1);
+    p->memory.flags = MEM_RD | MEM_WR;
+    RB_OBJ_WRITE(rbPointer, &p->rbParent, self);
+    rb_ary_push(arena->rbPointers, rbPointer);
+
+    return rbPointer;
+}
+
+/*
+ * call-seq: reset
+ * @return [self]
+ * Release all memory allocated so far, the chunks are kept for further allocations.
+ * Pointers returned by {#alloc} are invalidated and raise on access.  Pointers derived
+ * from them aren't, they must not outlive the reset.
+ */
+static VALUE
+arena_reset(VALUE self)
+{
+    Arena* arena;
+    long i;
+
+    TypedData_Get_Struct(self, Arena, &arena_data_type, arena);
+
+    for (i = 0; i < RARRAY_LEN(arena->rbPointers); i++) {
+        Pointer* p;
+        TypedData_Get_Struct(RARRAY_AREF(arena->rbPointers, i), Pointer, &rbffi_pointer_data_type, p);
+        p->memory.address = NULL;
+        p->memory.size = 0;
+        p->memory.flags = 0;
+    }
+    rb_ary_clear(arena->rbPointers);
+
+    while (arena->large != NULL) {
+        ArenaChunk* next = arena->large->next;
+        arena->capacity -= arena->large->size;
+        xfree(arena->large);
+        arena->large = next;
+    }
+    arena->current = arena->chunks;
+    arena->offset = 0;
+    arena->used = 0;
+
+    return self;
+}
+
+/*
+ * call-seq: free
+ * @return [self]
+ * Like {#reset}, but also release the chunks.
+ */
+static VALUE
+arena_release(VALUE self)
+{
+    Arena* arena;
+
+    arena_reset(self);
+    TypedData_Get_Struct(self, Arena, &arena_data_type, arena);
+    chunks_free(arena->chunks);
+    arena->chunks = arena->current = NULL;
+    arena->capacity = 0;
+
+    return self;
+}
+
+/*
+ * call-seq: scope { |arena| ... }
+ * @yieldparam [Arena] self
+ * @return [Object] the result of the block
+ * Run the block and {#reset} the arena afterwards, e.g. once per request.
+ */
+static VALUE
+arena_scope(VALUE self)
+{
+    return rb_ensure(rb_yield, self, arena_reset, self);
+}
+
+/*
+ * call-seq: used
+ * @return [Integer] number of bytes allocated since the last {#reset}, without alignment padding
+ */
+static VALUE
+arena_used(VALUE self)
+{
+    Arena* arena;
+
+    TypedData_Get_Struct(self, Arena, &arena_data_type, arena);
+
+    return SIZET2NUM(arena->used);
+}
+
+/*
+ * call-seq: capacity
+ * @return [Integer] number of bytes of all chunks
+ */
+static VALUE
+arena_capacity(VALUE self)
+{
+    Arena* arena;
+
+    TypedData_Get_Struct(self, Arena, &arena_data_type, arena);
+
+    return SIZET2NUM(arena->capacity);
+}
+
+/*
+ * call-seq: chunk_size
+ * @return [Integer] size of the chunks memory is allocated from
+ */
+static VALUE
+arena_chunk_size(VALUE self)
+{
+    Arena* arena;
+
+    TypedData_Get_Struct(self, Arena, &arena_data_type, arena);
+
+    return SIZET2NUM(arena->chunkSize);
+}
+
+void
+rbffi_Arena_Init(VALUE moduleFFI)
+{
+    /*
+     * Document-class: FFI::Arena
+     * Allocates short-lived native memory from large chunks and releases all of it at once.
+     * This is much cheaper than a {MemoryPointer} per buffer, when many of them share a
+     * lifetime, like the buffers of a request.
+     *
+     * Only the Pointers returned by {#alloc} are invalidated by {#reset} and {#free}.
+     * Pointers and Structs derived from them, e.g. with {Pointer#+} or {Pointer#slice},
+     * don't notice and must not be used after the arena was reset.
+     *
+     * @example
+     *   arena = FFI::Arena.new
+     *   arena.scope do
+     *     name = arena.alloc(:char, 64)
+     *     values = arena.alloc(:int32, 16)
+     *     LibFoo.get_values(name, values)
+     *   end
+     */
+    rbffi_ArenaClass = rb_define_class_under(moduleFFI, "Arena", rb_cObject);
+    rb_global_variable(&rbffi_ArenaClass);
+    rb_define_alloc_func(rbffi_ArenaClass, arena_allocate);
+
+    rb_define_method(rbffi_ArenaClass, "initialize", arena_initialize, -1);
+    rb_define_method(rbffi_ArenaClass, "alloc", arena_alloc, -1);
+    rb_define_method(rbffi_ArenaClass, "reset", arena_reset, 0);
+    rb_define_method(rbffi_ArenaClass, "free", arena_release, 0);
+    rb_define_method(rbffi_ArenaClass, "scope", arena_scope, 0);
+    rb_define_method(rbffi_ArenaClass, "used", arena_used, 0);
+    rb_define_method(rbffi_ArenaClass, "capacity", arena_capacity, 0);
+    rb_define_method(rbffi_ArenaClass, "chunk_size", arena_chunk_size, 0);
+}
@@ -35,6 +35,7 @@
 #include "rbffi.h"
 #include "rbffi_endian.h"
 #include "AbstractMemory.h"
+#include "MemoryCache.h"
 
 #define BUFFER_EMBED_MAXLEN (8)
 typedef struct Buffer {
@@ -103,7 +104,7 @@ allocated_buffer_release(void *data)
 {
     Buffer *ptr = (Buffer *)data;
     if ((ptr->memory.flags & MEM_EMBED) == 0 && ptr->data.storage != NULL) {
-        xfree(ptr->data.storage);
+        rbffi_MemoryCache_Free(ptr->data.storage);
         ptr->data.storage = NULL;
     }
 
@@ -133,14 +134,14 @@ buffer_initialize(int argc, VALUE* argv, VALUE self)
     p->memory.size = p->memory.typeSize * (nargs > 1 ? NUM2LONG(rbCount) : 1);
 
     if (p->memory.size > BUFFER_EMBED_MAXLEN) {
-        p->data.storage = xmalloc(p->memory.size + 7);
+        p->data.storage = rbffi_MemoryCache_Alloc(p->memory.size);
         if (p->data.storage == NULL) {
             rb_raise(rb_eNoMemError, "Failed to allocate memory size=%lu bytes", p->memory.size);
             return Qnil;
         }
 
-        /* ensure the memory is aligned on at least a 8 byte boundary */
-        p->memory.address = (void *) (((uintptr_t) p->data.storage + 0x7) & (uintptr_t) ~0x7ULL);
+        /* the memory cache aligns on at least a 8 byte boundary */
+        p->memory.address = p->data.storage;
 
         if (p->memory.size > 0 && (nargs < 3 || RTEST(rbClear))) {
             memset(p->memory.address, 0, p->memory.size);
@@ -172,15 +173,15 @@ buffer_initialize_copy(VALUE self, VALUE other)
     TypedData_Get_Struct(self, Buffer, &allocated_buffer_data_type, dst);
     src = rbffi_AbstractMemory_Cast(other, &allocated_buffer_data_type);
     if ((dst->memory.flags & MEM_EMBED) == 0 && dst->data.storage != NULL) {
-        xfree(dst->data.storage);
+        rbffi_MemoryCache_Free(dst->data.storage);
     }
-    dst->data.storage = xmalloc(src->size + 7);
+    dst->data.storage = rbffi_MemoryCache_Alloc(src->size);
     if (dst->data.storage == NULL) {
         rb_raise(rb_eNoMemError, "failed to allocate memory size=%lu bytes", src->size);
         return Qnil;
     }
 
-    dst->memory.address = (void *) (((uintptr_t) dst->data.storage + 0x7) & (uintptr_t) ~0x7ULL);
+    dst->memory.address = dst->data.storage;
     dst->memory.size = src->size;
     dst->memory.typeSize = src->typeSize;
 
@@ -327,7 +328,7 @@ allocated_buffer_free(VALUE self)
 
     TypedData_Get_Struct(self, Buffer, &allocated_buffer_data_type, ptr);
     if ((ptr->memory.flags & MEM_EMBED) == 0 && ptr->data.storage != NULL) {
-        xfree(ptr->data.storage);
+        rbffi_MemoryCache_Free(ptr->data.storage);
         ptr->data.storage = NULL;
     }
 
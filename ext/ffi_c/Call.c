@@ -50,6 +50,7 @@
 #include "AbstractMemory.h"
 #include "Pointer.h"
 #include "Struct.h"
+#include "StructByValue.h"
 #include "Function.h"
 #include "Type.h"
 #include "LastError.h"
@@ -81,16 +82,17 @@
 #  define ADJ(p, a) (++(p))
 #endif
 
-static void* callback_param(VALUE proc, VALUE cbinfo);
+static void* callback_param(VALUE proc, VALUE cbinfo, bool scoped);
 static inline void* getPointer(VALUE value, int type);
+static void struct_param_fill(StructByValue* sbv, VALUE value, void* address);
 
-static ID id_to_ptr, id_map_symbol, id_to_native;
+static ID id_to_ptr, id_map_symbol, id_to_native, id_put;
 
-VALUE
-rbffi_SetupCallParams(int argc, VALUE* argv, int paramCount, Type** paramTypes,
-        FFIStorage* paramStorage, void** ffiValues,
+static VALUE
+setup_call_params(int argc, VALUE* argv, int paramCount, Type** paramTypes,
+        FFIStorage* paramStorage, void** ffiValues, FFIStorage* structStorage,
         VALUE* callbackParameters, int callbackCount,
-        VALUE enums)
+        VALUE enums, bool scopedCallbacks)
 {
     VALUE callbackProc = Qnil;
     FFIStorage* param = &paramStorage[0];
@@ -312,16 +314,23 @@ rbffi_SetupCallParams(int argc, VALUE* argv, int paramCount, Type** paramTypes,
 
             case NATIVE_FUNCTION:
                 if (callbackProc != Qnil) {
-                    param->ptr = callback_param(callbackProc, callbackParameters[cbidx++]);
+                    param->ptr = callback_param(callbackProc, callbackParameters[cbidx++], scopedCallbacks);
                 } else {
-                    param->ptr = callback_param(argv[argidx], callbackParameters[cbidx++]);
+                    param->ptr = callback_param(argv[argidx], callbackParameters[cbidx++], scopedCallbacks);
                     ++argidx;
                 }
                 ADJ(param, ADDRESS);
                 break;
 
             case NATIVE_STRUCT:
-                ffiValues[i] = getPointer(argv[argidx++], type);
+                if (unlikely(type == T_HASH || type == T_ARRAY)) {
+                    /* Fill the fields straight into call-scoped storage, no Struct instance required */
+                    ffiValues[i] = structStorage;
+                    struct_param_fill((StructByValue *) paramType, argv[argidx++], structStorage);
+                    structStorage += rbffi_StructParamStorageCount(paramType);
+                } else {
+                    ffiValues[i] = getPointer(argv[argidx++], type);
+                }
                 break;
 
             default:
@@ -331,6 +340,17 @@ rbffi_SetupCallParams(int argc, VALUE* argv, int paramCount, Type** paramTypes,
     return callbackProc;
 }
 
+VALUE
+rbffi_SetupCallParams(int argc, VALUE* argv, int paramCount, Type** paramTypes,
+        FFIStorage* paramStorage, void** ffiValues, FFIStorage* structStorage,
+        VALUE* callbackParameters, int callbackCount,
+        VALUE enums)
+{
+    /* Bindings of call scoped callbacks are only released by rbffi_CallFunction() */
+    return setup_call_params(argc, argv, paramCount, paramTypes, paramStorage, ffiValues, structStorage,
+            callbackParameters, callbackCount, enums, false);
+}
+
 static void *
 call_blocking_function(void* data)
 {
@@ -356,24 +376,23 @@ rbffi_save_frame_exception(VALUE data, VALUE exc)
     return Qnil;
 }
 
-VALUE
-rbffi_CallFunction(int argc, VALUE* argv, void* function, FunctionType* fnInfo)
+static inline VALUE
+call_function(int argc, VALUE* argv, void* function, FunctionType* fnInfo,
+        void** ffiValues, FFIStorage* params)
 {
     void* retval;
-    void** ffiValues;
-    FFIStorage* params;
+    FFIStorage* structs;
     VALUE rbReturnValue;
     rbffi_frame_t frame = { 0 };
     VALUE callbackProc;
 
     retval = alloca(MAX(fnInfo->ffi_cif.rtype->size, FFI_SIZEOF_ARG));
+    structs = fnInfo->structStorageCount > 0 ? ALLOCA_N(FFIStorage, fnInfo->structStorageCount) : NULL;
 
     if (unlikely(fnInfo->blocking)) {
         rbffi_blocking_call_t* bc;
 
         /* allocate information passed to the blocking function on the stack */
-        ffiValues = ALLOCA_N(void *, fnInfo->parameterCount);
-        params = ALLOCA_N(FFIStorage, fnInfo->parameterCount);
         bc = ALLOCA_N(rbffi_blocking_call_t, 1);
         bc->retval = retval;
         bc->cif = fnInfo->ffi_cif;
@@ -382,10 +401,10 @@ rbffi_CallFunction(int argc, VALUE* argv, void* function, FunctionType* fnInfo)
         bc->params = params;
         bc->frame = &frame;
 
-        callbackProc = rbffi_SetupCallParams(argc, argv,
-            fnInfo->parameterCount, fnInfo->parameterTypes, params, ffiValues,
+        callbackProc = setup_call_params(argc, argv,
+            fnInfo->parameterCount, fnInfo->parameterTypes, params, ffiValues, structs,
             fnInfo->callbackParameters, fnInfo->callbackCount,
-            fnInfo->rbEnums);
+            fnInfo->rbEnums, fnInfo->hasScopedCallback);
 
         rbffi_frame_push(&frame);
         rb_rescue2(rbffi_do_blocking_call, (VALUE) bc, rbffi_save_frame_exception, (VALUE) &frame, rb_eException, (VALUE) 0);
@@ -393,13 +412,10 @@ rbffi_CallFunction(int argc, VALUE* argv, void* function, FunctionType* fnInfo)
 
     } else {
 
-        ffiValues = ALLOCA_N(void *, fnInfo->parameterCount);
-        params = ALLOCA_N(FFIStorage, fnInfo->parameterCount);
-
-        callbackProc = rbffi_SetupCallParams(argc, argv,
-            fnInfo->parameterCount, fnInfo->parameterTypes, params, ffiValues,
+        callbackProc = setup_call_params(argc, argv,
+            fnInfo->parameterCount, fnInfo->parameterTypes, params, ffiValues, structs,
             fnInfo->callbackParameters, fnInfo->callbackCount,
-            fnInfo->rbEnums);
+            fnInfo->rbEnums, fnInfo->hasScopedCallback);
 
         rbffi_frame_push(&frame);
         ffi_call(&fnInfo->ffi_cif, FFI_FN(function), retval, ffiValues);
@@ -421,6 +437,65 @@ rbffi_CallFunction(int argc, VALUE* argv, void* function, FunctionType* fnInfo)
     return rbReturnValue;
 }
 
+struct scoped_call {
+    int argc;
+    VALUE* argv;
+    void* function;
+    FunctionType* fnInfo;
+    void** ffiValues;
+    FFIStorage* params;
+};
+
+static VALUE
+scoped_call_invoke(VALUE data)
+{
+    struct scoped_call* sc = (struct scoped_call *) data;
+
+    return call_function(sc->argc, sc->argv, sc->function, sc->fnInfo, sc->ffiValues, sc->params);
+}
+
+static VALUE
+scoped_call_release(VALUE data)
+{
+    struct scoped_call* sc = (struct scoped_call *) data;
+    int i;
+
+    for (i = 0; i < sc->fnInfo->parameterCount; i++) {
+        Type* paramType = sc->fnInfo->parameterTypes[i];
+
+        if (paramType->nativeType == NATIVE_MAPPED) {
+            paramType = ((MappedType *) paramType)->type;
+        }
+
+        /* Parameters that weren't converted yet are still zeroed */
+        if (paramType->nativeType == NATIVE_FUNCTION && sc->ffiValues[i] != NULL
+                && ((FunctionType *) paramType)->callScoped) {
+            rbffi_Function_ReleaseScoped((FunctionType *) paramType, *(void **) sc->ffiValues[i]);
+        }
+    }
+
+    return Qnil;
+}
+
+VALUE
+rbffi_CallFunction(int argc, VALUE* argv, void* function, FunctionType* fnInfo)
+{
+    void** ffiValues = ALLOCA_N(void *, fnInfo->parameterCount);
+    FFIStorage* params = ALLOCA_N(FFIStorage, fnInfo->parameterCount);
+
+    if (unlikely(fnInfo->hasScopedCallback)) {
+        /* Return the trampolines bound to procs, even if the call or a conversion raises */
+        struct scoped_call sc = { argc, argv, function, fnInfo, ffiValues, params };
+
+        memset(ffiValues, 0, sizeof(*ffiValues) * fnInfo->parameterCount);
+        memset(params, 0, sizeof(*params) * fnInfo->parameterCount);
+
+        return rb_ensure(scoped_call_invoke, (VALUE) &sc, scoped_call_release, (VALUE) &sc);
+    }
+
+    return call_function(argc, argv, function, fnInfo, ffiValues, params);
+}
+
 static inline void*
 getPointer(VALUE value, int type)
 {
@@ -462,6 +537,89 @@ getPointer(VALUE value, int type)
     return NULL;
 }
 
+long
+rbffi_StructParamStorageCount(Type* type)
+{
+    if (type->nativeType != NATIVE_STRUCT) {
+        return 0;
+    }
+
+    return (long) ((type->ffiType->size + sizeof(FFIStorage) - 1) / sizeof(FFIStorage));
+}
+
+struct struct_param_hash_arg {
+    StructLayout* layout;
+    AbstractMemory* memory;
+};
+
+static void
+struct_param_put(VALUE rbField, AbstractMemory* memory, VALUE value)
+{
+    StructField* f;
+
+    TypedData_Get_Struct(rbField, StructField, &rbffi_struct_field_data_type, f);
+
+    if (f->type->nativeType == NATIVE_STRUCT && (TYPE(value) == T_HASH || TYPE(value) == T_ARRAY)) {
+        /* Nested struct given as a literal as well */
+        struct_param_fill((StructByValue *) f->type, value, memory->address + f->offset);
+
+    } else if (f->memoryOp != NULL) {
+        (*f->memoryOp->put)(memory, f->offset, value);
+
+    } else {
+        /* Arrays, functions and mapped fields are handled by the ruby side of the field */
+        VALUE argv[2];
+        argv[0] = rbffi_Pointer_NewInstance(memory->address);
+        argv[1] = value;
+        rb_funcall2(rbField, id_put, 2, argv);
+    }
+}
+
+static int
+struct_param_hash_put(VALUE key, VALUE value, VALUE data)
+{
+    struct struct_param_hash_arg* arg = (struct struct_param_hash_arg *) data;
+    VALUE rbField = rb_hash_aref(arg->layout->rbFieldMap, TYPE(key) == T_STRING ? rb_str_intern(key) : key);
+
+    if (NIL_P(rbField)) {
+        VALUE str = rb_inspect(key);
+        rb_raise(rb_eArgError, "No such field %s", StringValueCStr(str));
+    }
+    struct_param_put(rbField, arg->memory, value);
+
+    return ST_CONTINUE;
+}
+
+static void
+struct_param_fill(StructByValue* sbv, VALUE value, void* address)
+{
+    StructLayout* layout;
+    AbstractMemory memory;
+
+    TypedData_Get_Struct(sbv->rbStructLayout, StructLayout, &rbffi_struct_layout_data_type, layout);
+
+    memory.address = address;
+    memory.size = sbv->base.ffiType->size;
+    memory.flags = MEM_RD | MEM_WR;
+    memory.typeSize = 1;
+    memset(address, 0, memory.size);
+
+    if (TYPE(value) == T_HASH) {
+        struct struct_param_hash_arg arg = { layout, &memory };
+        rb_hash_foreach(value, struct_param_hash_put, (VALUE) &arg);
+
+    } else {
+        long i, count = RARRAY_LEN(value);
+
+        if (count > layout->fieldCount) {
+            rb_raise(rb_eArgError, "too many values for struct (%ld for %d)", count, layout->fieldCount);
+        }
+        for (i = 0; i < count; ++i) {
+            struct_param_put(RARRAY_AREF(layout->rbFields, i), &memory, RARRAY_AREF(value, i));
+        }
+    }
+}
+
 Invoker
 rbffi_GetInvoker(FunctionType *fnInfo)
 {
@@ -470,22 +628,31 @@ rbffi_GetInvoker(FunctionType *fnInfo)
 
 
 static void*
-callback_param(VALUE proc, VALUE cbInfo)
+callback_param(VALUE proc, VALUE cbInfo, bool scoped)
 {
     VALUE callback;
     AbstractMemory *mem;
+    void* code;
 
     if (unlikely(proc == Qnil)) {
         return NULL ;
     }
 
-    /* Handle Function pointers here */
-    if (rb_obj_is_kind_of(proc, rbffi_FunctionClass)) {
+    /* Handle Function and NativeCallback pointers here */
+    if (rb_obj_is_kind_of(proc, rbffi_PointerClass)) {
         AbstractMemory* ptr;
         TypedData_Get_Struct(proc, AbstractMemory, &rbffi_abstract_memory_data_type, ptr);
         return ptr->address;
     }
 
+    if (unlikely(scoped)) {
+        FunctionType* fnInfo;
+        TypedData_Get_Struct(cbInfo, FunctionType, &rbffi_fntype_data_type, fnInfo);
+        if (fnInfo->callScoped && (code = rbffi_Function_BindScoped(cbInfo, fnInfo, proc)) != NULL) {
+            return code;
+        }
+    }
+
     callback = rbffi_Function_ForProc(cbInfo, proc);
     RB_GC_GUARD(callback);
 
@@ -500,5 +667,6 @@ rbffi_Call_Init(VALUE moduleFFI)
     id_to_ptr = rb_intern("to_ptr");
     id_to_native = rb_intern("to_native");
     id_map_symbol = rb_intern("__map_symbol");
+    id_put = rb_intern("put");
 }
 
@@ -74,10 +74,12 @@ typedef union {
 extern void rbffi_Call_Init(VALUE moduleFFI);
 
 extern VALUE rbffi_SetupCallParams(int argc, VALUE* argv, int paramCount, Type** paramTypes,
-        FFIStorage* paramStorage, void** ffiValues,
+        FFIStorage* paramStorage, void** ffiValues, FFIStorage* structStorage,
         VALUE* callbackParameters, int callbackCount,
         VALUE enums);
 
+extern long rbffi_StructParamStorageCount(Type* type);
+
 struct FunctionType_;
 extern VALUE rbffi_CallFunction(int argc, VALUE* argv, void* function, struct FunctionType_* fnInfo);
 
@@ -0,0 +1,826 @@
+/*
+ * Copyright (c) 2008-2013, Ruby FFI project contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Ruby FFI project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MSC_VER
+#include <sys/param.h>
+#endif
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ruby.h>
+#include <ruby/thread.h>
+
+#include <ffi.h>
+#include "rbffi.h"
+#include "compat.h"
+#include "AbstractMemory.h"
+#include "Pointer.h"
+#include "Type.h"
+#include "Types.h"
+#include "Function.h"
+#include "LastError.h"
+#include "Call.h"
+#include "Thread.h"
+#include "CallChain.h"
+
+typedef enum {
+    CHAIN_CONST,
+    CHAIN_INPUT,
+    CHAIN_RESULT,
+    CHAIN_OUT,
+    CHAIN_OUT_VALUE
+} ChainArgKind;
+
+typedef struct ChainArg_ {
+    ChainArgKind kind;
+    /* input, step or out-param index */
+    int index;
+    /* index of the first callback parameter of the function at or after this argument */
+    int callbackIndex;
+    /* the integral result is larger than the parameter and has to be narrowed */
+    bool narrow;
+    VALUE rbValue;
+} ChainArg;
+
+typedef struct ChainStep_ {
+    VALUE rbFunction;
+    VALUE rbFunctionInfo;
+    FunctionType* fnInfo;
+    void* function;
+    ChainArg* args;
+    long paramOffset;
+    long resultOffset;
+} ChainStep;
+
+typedef struct ChainSlot_ {
+    VALUE rbType;
+    Type* type;
+    MemoryOp* memoryOp;
+    long offset;
+} ChainSlot;
+
+typedef struct CallChain_ {
+    ChainStep* steps;
+    int stepCount;
+    ChainSlot* slots;
+    int slotCount;
+    int inputCount;
+    /* sizes of the per-run storage, in FFIStorage units */
+    long paramCount;
+    long resultSize;
+    long slotSize;
+    long structSize;
+    VALUE rbResults;
+    bool blocking;
+    bool saveErrno;
+} CallChain;
+
+typedef struct ChainRef_ {
+    VALUE rbChain;
+    ChainArgKind kind;
+    int index;
+} ChainRef;
+
+typedef struct ChainRun_ {
+    CallChain* chain;
+    FFIStorage* params;
+    void** ffiValues;
+    FFIStorage* results;
+} ChainRun;
+
+static VALUE chain_allocate(VALUE klass);
+static void chain_mark(void *data);
+static void chain_compact(void *data);
+static void chain_free(void *data);
+static size_t chain_memsize(const void *data);
+static VALUE ref_allocate(VALUE klass);
+static void ref_mark(void *data);
+static void ref_compact(void *data);
+
+static const rb_data_type_t chain_data_type = {
+    .wrap_struct_name = "FFI::CallChain",
+    .function = {
+        .dmark = chain_mark,
+        .dfree = chain_free,
+        .dsize = chain_memsize,
+        ffi_compact_callback( chain_compact )
+    },
+    // IMPORTANT: WB_PROTECTED objects must only use the RB_OBJ_WRITE()
+    // macro to update VALUE references, as to trigger write barriers.
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static const rb_data_type_t ref_data_type = {
+    .wrap_struct_name = "FFI::CallChain::Ref",
+    .function = {
+        .dmark = ref_mark,
+        .dfree = RUBY_TYPED_DEFAULT_FREE,
+        .dsize = NULL,
+        ffi_compact_callback( ref_compact )
+    },
+    // IMPORTANT: WB_PROTECTED objects must only use the RB_OBJ_WRITE()
+    // macro to update VALUE references, as to trigger write barriers.
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+VALUE rbffi_CallChainClass = Qnil;
+static VALUE ChainRefClass = Qnil;
+static ID id_type = 0;
+
+static VALUE
+chain_allocate(VALUE klass)
+{
+    CallChain* chain;
+    VALUE obj = TypedData_Make_Struct(klass, CallChain, &chain_data_type, chain);
+
+    RB_OBJ_WRITE(obj, &chain->rbResults, Qnil);
+
+    return obj;
+}
+
+static void
+chain_mark(void *data)
+{
+    CallChain* chain = (CallChain *) data;
+    int i, j;
+
+    for (i = 0; i < chain->stepCount; ++i) {
+        ChainStep* step = &chain->steps[i];
+        rb_gc_mark_movable(step->rbFunction);
+        rb_gc_mark_movable(step->rbFunctionInfo);
+        for (j = 0; j < step->fnInfo->parameterCount; ++j) {
+            rb_gc_mark_movable(step->args[j].rbValue);
+        }
+    }
+    for (i = 0; i < chain->slotCount; ++i) {
+        rb_gc_mark_movable(chain->slots[i].rbType);
+    }
+    rb_gc_mark_movable(chain->rbResults);
+}
+
+static void
+chain_compact(void *data)
+{
+    CallChain* chain = (CallChain *) data;
+    int i, j;
+
+    for (i = 0; i < chain->stepCount; ++i) {
+        ChainStep* step = &chain->steps[i];
+        ffi_gc_location(step->rbFunction);
+        ffi_gc_location(step->rbFunctionInfo);
+        for (j = 0; j < step->fnInfo->parameterCount; ++j) {
+            ffi_gc_location(step->args[j].rbValue);
+        }
+    }
+    for (i = 0; i < chain->slotCount; ++i) {
+        ffi_gc_location(chain->slots[i].rbType);
+    }
+    ffi_gc_location(chain->rbResults);
+}
+
+static void
+chain_free(void *data)
+{
+    CallChain* chain = (CallChain *) data;
+    int i;
+
+    for (i = 0; i < chain->stepCount; ++i) {
+        xfree(chain->steps[i].args);
+    }
+    xfree(chain->steps);
+    xfree(chain->slots);
+    xfree(chain);
+}
+
+static size_t
+chain_memsize(const void *data)
+{
+    const CallChain* chain = (const CallChain *) data;
+
+    return sizeof(CallChain) + chain->stepCount * sizeof(ChainStep)
+        + chain->paramCount * sizeof(ChainArg)
+        + chain->slotCount * sizeof(ChainSlot);
+}
+
+static VALUE
+ref_allocate(VALUE klass)
+{
+    ChainRef* ref;
+    VALUE obj = TypedData_Make_Struct(klass, ChainRef, &ref_data_type, ref);
+
+    RB_OBJ_WRITE(obj, &ref->rbChain, Qnil);
+
+    return obj;
+}
+
+static void
+ref_mark(void *data)
+{
+    ChainRef* ref = (ChainRef *) data;
+    rb_gc_mark_movable(ref->rbChain);
+}
+
+static void
+ref_compact(void *data)
+{
+    ChainRef* ref = (ChainRef *) data;
+    ffi_gc_location(ref->rbChain);
+}
+
+static VALUE
+ref_new(VALUE rbChain, ChainArgKind kind, int index)
+{
+    ChainRef* ref;
+    VALUE obj = ref_allocate(ChainRefClass);
+
+    TypedData_Get_Struct(obj, ChainRef, &ref_data_type, ref);
+    RB_OBJ_WRITE(obj, &ref->rbChain, rbChain);
+    ref->kind = kind;
+    ref->index = index;
+
+    return obj;
+}
+
+static ChainRef*
+ref_get(VALUE self, VALUE rbRef)
+{
+    ChainRef* ref;
+
+    TypedData_Get_Struct(rbRef, ChainRef, &ref_data_type, ref);
+    if (ref->rbChain != self) {
+        rb_raise(rb_eArgError, "reference belongs to a different call chain");
+    }
+
+    return ref;
+}
+
+static long
+storage_count(size_t size)
+{
+    return (long) ((size + sizeof(FFIStorage) - 1) / sizeof(FFIStorage));
+}
+
+static bool
+is_integral(ffi_type* type)
+{
+    switch (type->type) {
+        case FFI_TYPE_SINT8:
+        case FFI_TYPE_UINT8:
+        case FFI_TYPE_SINT16:
+        case FFI_TYPE_UINT16:
+        case FFI_TYPE_SINT32:
+        case FFI_TYPE_UINT32:
+        case FFI_TYPE_SINT64:
+        case FFI_TYPE_UINT64:
+        case FFI_TYPE_INT:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * Results and out-params are passed on bit for bit, so only integers of any size
+ * or values of the same floating point, pointer or struct type fit each other
+ */
+static bool
+same_kind(ffi_type* a, ffi_type* b)
+{
+    if (is_integral(a) || is_integral(b)) {
+        return is_integral(a) && is_integral(b);
+    }
+
+    return a->type == b->type;
+}
+
+/*
+ * Size of a result as stored by libffi, which widens integral values smaller than a register to ffi_arg
+ */
+static size_t
+result_size(ffi_type* type)
+{
+    return is_integral(type) && type->size < sizeof(ffi_arg) ? sizeof(ffi_arg) : type->size;
+}
+
+/*
+ * call-seq: initialize
+ * @return [self]
+ * A new, empty call chain.
+ *
+ * A CallChain records a sequence of calls to {Function}s (e.g. taken from
+ * {Library#attached_functions}) and runs them in one go, without returning to
+ * ruby in between.  Arguments of each call may be constants, inputs given to
+ * {#run}, results of earlier calls and out-params.
+ *
+ * @example
+ *   chain = FFI::CallChain.new
+ *   fd    = chain.input
+ *   len   = chain.out(:size_t)
+ *   h     = chain.call(LibX.attached_functions[:lock], fd)
+ *   n     = chain.call(LibX.attached_functions[:read], h, len)
+ *   chain.call(LibX.attached_functions[:unlock], h)
+ *   chain.returns(n, len)
+ *   n, len = chain.run(3)
+ */
+static VALUE
+chain_initialize(VALUE self)
+{
+    return self;
+}
+
+/*
+ * call-seq: input
+ * @return [CallChain::Ref]
+ * Declare the next positional argument of {#run}.
+ */
+static VALUE
+chain_input(VALUE self)
+{
+    CallChain* chain;
+
+    TypedData_Get_Struct(self, CallChain, &chain_data_type, chain);
+
+    return ref_new(self, CHAIN_INPUT, chain->inputCount++);
+}
+
+/*
+ * call-seq: out(type)
+ * @param [Type, Symbol] type type of the value the callee stores
+ * @return [CallChain::Ref]
+ * Declare an out-param.  Passing the reference to {#call} passes a pointer to
+ * zero initialized storage of +type+; {Ref#value} passes the stored value itself.
+ */
+static VALUE
+chain_out(VALUE self, VALUE rbType)
+{
+    CallChain* chain;
+    ChainSlot* slot;
+    VALUE type = rbffi_Type_Lookup(rbType);
+
+    TypedData_Get_Struct(self, CallChain, &chain_data_type, chain);
+
+    if (!RTEST(type)) {
+        VALUE typeName = rb_funcall2(rbType, rb_intern("inspect"), 0, NULL);
+        rb_raise(rb_eTypeError, "Invalid out-param type (%s)", RSTRING_PTR(typeName));
+    }
+
+    REALLOC_N(chain->slots, ChainSlot, chain->slotCount + 1);
+    slot = &chain->slots[chain->slotCount];
+    slot->rbType = Qnil;
+    TypedData_Get_Struct(type, Type, &rbffi_type_data_type, slot->type);
+    slot->memoryOp = get_memory_op(slot->type);
+    if (slot->memoryOp == NULL) {
+        VALUE typeName = rb_funcall2(rbType, rb_intern("inspect"), 0, NULL);
+        rb_raise(rb_eTypeError, "unsupported out-param type (%s)", RSTRING_PTR(typeName));
+    }
+    slot->offset = chain->slotSize;
+    RB_OBJ_WRITE(self, &slot->rbType, type);
+
+    chain->slotSize += storage_count(slot->type->ffiType->size);
+
+    return ref_new(self, CHAIN_OUT, chain->slotCount++);
+}
+
+static void
+chain_set_ref_arg(VALUE self, CallChain* chain, ChainArg* arg, Type* paramType, VALUE rbRef, int argIndex)
+{
+    ChainRef* ref = ref_get(self, rbRef);
+    size_t paramSize = paramType->ffiType->size;
+
+    arg->kind = ref->kind;
+    arg->index = ref->index;
+
+    switch (ref->kind) {
+        case CHAIN_INPUT:
+            break;
+
+        case CHAIN_RESULT: {
+            ffi_type* resultType = chain->steps[ref->index].fnInfo->ffi_cif.rtype;
+
+            if (resultType->type == FFI_TYPE_VOID) {
+                rb_raise(rb_eArgError, "argument %d refers to the result of a void function", argIndex);
+            }
+            if (!same_kind(paramType->ffiType, resultType)) {
+                rb_raise(rb_eTypeError, "argument %d has another type than the result it refers to", argIndex);
+            }
+            if (paramSize > result_size(resultType)) {
+                rb_raise(rb_eArgError, "argument %d is larger than the result it refers to", argIndex);
+            }
+            arg->narrow = is_integral(resultType) && paramSize < result_size(resultType);
+            break;
+        }
+
+        case CHAIN_OUT:
+            if (paramType->ffiType != &ffi_type_pointer) {
+                rb_raise(rb_eTypeError, "argument %d: out-params can only be passed as pointers", argIndex);
+            }
+            break;
+
+        case CHAIN_OUT_VALUE:
+            if (!same_kind(paramType->ffiType, chain->slots[ref->index].type->ffiType)) {
+                rb_raise(rb_eTypeError, "argument %d has another type than the out-param it refers to", argIndex);
+            }
+            if (paramSize > chain->slots[ref->index].type->ffiType->size) {
+                rb_raise(rb_eArgError, "argument %d is larger than the out-param it refers to", argIndex);
+            }
+            break;
+
+        default:
+            rb_raise(rb_eArgError, "invalid reference");
+    }
+}
+
+/*
+ * call-seq: call(function, *args)
+ * @param [Function] function function to call
+ * @param [Array] args constants or {Ref}s for each parameter of +function+
+ * @return [CallChain::Ref] reference to the return value of the call
+ * @raise [TypeError] if a result or out-param value is passed as another kind of value
+ * Append a call to the chain.  Results and out-param values are passed as they are, so
+ * integers may only be passed as integers, and floats, pointers and structs as the same type.
+ */
+static VALUE
+chain_call(int argc, VALUE* argv, VALUE self)
+{
+    CallChain* chain;
+    ChainStep* step;
+    ChainArg* args;
+    FunctionType* fnInfo;
+    AbstractMemory* mem;
+    VALUE rbFunction, rbFunctionInfo;
+    int i, callbackIndex = 0;
+
+    TypedData_Get_Struct(self, CallChain, &chain_data_type, chain);
+
+    rb_check_arity(argc, 1, UNLIMITED_ARGUMENTS);
+    rbFunction = argv[0];
+    if (!rb_obj_is_kind_of(rbFunction, rbffi_FunctionClass)) {
+        rb_raise(rb_eTypeError, "wrong argument type %s (expected FFI::Function)", rb_obj_classname(rbFunction));
+    }
+
+    rbFunctionInfo = rb_funcall2(rbFunction, id_type, 0, NULL);
+    TypedData_Get_Struct(rbFunctionInfo, FunctionType, &rbffi_fntype_data_type, fnInfo);
+    TypedData_Get_Struct(rbFunction, AbstractMemory, &rbffi_abstract_memory_data_type, mem);
+
+    if (argc - 1 != fnInfo->parameterCount) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for %d)", argc - 1, fnInfo->parameterCount);
+    }
+
+    /* Validate all arguments before the chain is touched */
+    args = ALLOCA_N(ChainArg, MAX(fnInfo->parameterCount, 1));
+    memset(args, 0, MAX(fnInfo->parameterCount, 1) * sizeof(ChainArg));
+    for (i = 0; i < fnInfo->parameterCount; ++i) {
+        ChainArg* arg = &args[i];
+        VALUE value = argv[i + 1];
+
+        arg->callbackIndex = callbackIndex;
+        arg->rbValue = Qnil;
+        if (rb_obj_is_kind_of(value, ChainRefClass)) {
+            chain_set_ref_arg(self, chain, arg, fnInfo->parameterTypes[i], value, i);
+        } else {
+            arg->kind = CHAIN_CONST;
+            arg->rbValue = value;
+        }
+
+        if (fnInfo->parameterTypes[i]->nativeType == NATIVE_FUNCTION) {
+            callbackIndex++;
+        }
+    }
+
+    REALLOC_N(chain->steps, ChainStep, chain->stepCount + 1);
+    step = &chain->steps[chain->stepCount];
+    step->args = ALLOC_N(ChainArg, fnInfo->parameterCount);
+    memcpy(step->args, args, fnInfo->parameterCount * sizeof(ChainArg));
+    step->fnInfo = fnInfo;
+    step->function = mem->address;
+    step->rbFunction = step->rbFunctionInfo = Qnil;
+    chain->stepCount++;
+
+    /* The step keeps raw pointers into both, so they have to stay alive with the chain */
+    RB_OBJ_WRITE(self, &step->rbFunction, rbFunction);
+    RB_OBJ_WRITE(self, &step->rbFunctionInfo, rbFunctionInfo);
+
+    for (i = 0; i < fnInfo->parameterCount; ++i) {
+        step->args[i].rbValue = Qnil;
+        RB_OBJ_WRITE(self, &step->args[i].rbValue, args[i].rbValue);
+    }
+    step->paramOffset = chain->paramCount;
+    step->resultOffset = chain->resultSize;
+
+    chain->paramCount += fnInfo->parameterCount;
+    chain->resultSize += storage_count(MAX(fnInfo->ffi_cif.rtype->size, FFI_SIZEOF_ARG));
+    chain->structSize += fnInfo->structStorageCount;
+    chain->blocking |= fnInfo->blocking;
+    chain->saveErrno |= !fnInfo->ignoreErrno;
+
+    return ref_new(self, CHAIN_RESULT, chain->stepCount - 1);
+}
+
+/*
+ * call-seq: returns(*refs)
+ * @param [Array<Ref>] refs values {#run} should return
+ * @return [self]
+ * Select what {#run} returns: a single value for one reference, an Array otherwise.
+ * By default {#run} returns the result of the last call.
+ */
+static VALUE
+chain_returns(int argc, VALUE* argv, VALUE self)
+{
+    CallChain* chain;
+    int i;
+
+    TypedData_Get_Struct(self, CallChain, &chain_data_type, chain);
+
+    for (i = 0; i < argc; ++i) {
+        ChainRef* ref;
+        TypedData_Get_Struct(argv[i], ChainRef, &ref_data_type, ref);
+        ref_get(self, argv[i]);
+        if (ref->kind == CHAIN_RESULT && chain->steps[ref->index].fnInfo->ffi_cif.rtype->type == FFI_TYPE_VOID) {
+            rb_raise(rb_eArgError, "cannot return the result of a void function");
+        }
+    }
+    RB_OBJ_WRITE(self, &chain->rbResults, rb_ary_new_from_values(argc, argv));
+
+    return self;
+}
+
+static void
+narrow_result(void* dst, size_t dstSize, const void* src, size_t srcSize)
+{
+    uint64_t value = srcSize == sizeof(uint64_t) ? *(const uint64_t *) src : *(const uint32_t *) src;
+
+    switch (dstSize) {
+        case 1: {
+            uint8_t v = (uint8_t) value;
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case 2: {
+            uint16_t v = (uint16_t) value;
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        default: {
+            uint32_t v = (uint32_t) value;
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+    }
+}
+
+static void*
+chain_execute(void* data)
+{
+    ChainRun* run = (ChainRun *) data;
+    CallChain* chain = run->chain;
+    int i, j;
+
+    for (i = 0; i < chain->stepCount; ++i) {
+        ChainStep* step = &chain->steps[i];
+        FunctionType* fnInfo = step->fnInfo;
+
+        for (j = 0; j < fnInfo->parameterCount; ++j) {
+            ChainArg* arg = &step->args[j];
+            if (arg->kind == CHAIN_RESULT && arg->narrow) {
+                ChainStep* source = &chain->steps[arg->index];
+                narrow_result(&run->params[step->paramOffset + j], fnInfo->parameterTypes[j]->ffiType->size,
+                    &run->results[source->resultOffset], result_size(source->fnInfo->ffi_cif.rtype));
+            }
+        }
+
+        ffi_call(&fnInfo->ffi_cif, FFI_FN(step->function), &run->results[step->resultOffset],
+            &run->ffiValues[step->paramOffset]);
+    }
+
+    return NULL;
+}
+
+static VALUE
+chain_do_blocking_run(VALUE data)
+{
+    rb_thread_call_without_gvl(chain_execute, (void *) data, (rb_unblock_function_t *) -1, NULL);
+
+    return Qnil;
+}
+
+static VALUE
+chain_result(CallChain* chain, VALUE rbRef, VALUE* argv, FFIStorage* results, FFIStorage* slots)
+{
+    ChainRef* ref;
+
+    TypedData_Get_Struct(rbRef, ChainRef, &ref_data_type, ref);
+    switch (ref->kind) {
+        case CHAIN_INPUT:
+            return argv[ref->index];
+
+        case CHAIN_RESULT: {
+            ChainStep* step = &chain->steps[ref->index];
+            return rbffi_NativeValue_ToRuby(step->fnInfo->returnType, step->fnInfo->rbReturnType,
+                &results[step->resultOffset]);
+        }
+
+        default: {
+            ChainSlot* slot = &chain->slots[ref->index];
+            AbstractMemory memory;
+
+            memory.address = (char *) &slots[slot->offset];
+            memory.size = slot->type->ffiType->size;
+            memory.flags = MEM_RD | MEM_WR;
+            memory.typeSize = 1;
+
+            return (*slot->memoryOp->get)(&memory, 0);
+        }
+    }
+}
+
+/*
+ * call-seq: run(*inputs)
+ * @param [Array] inputs values for the references returned by {#input}
+ * @return [Object] the values selected by {#returns}
+ * Run all calls of the chain.
+ *
+ * All arguments are converted before the first call.  The calls then run in one
+ * C loop, with the GVL released once around the whole sequence if any of the
+ * functions is +blocking+.  errno is saved once after the last call.
+ */
+static VALUE
+chain_run(int argc, VALUE* argv, VALUE self)
+{
+    CallChain* chain;
+    ChainRun run;
+    FFIStorage* slots;
+    FFIStorage* structs;
+    VALUE* values;
+    VALUE rbReturnValue;
+    rbffi_frame_t frame = { 0 };
+    int i, j;
+
+    TypedData_Get_Struct(self, CallChain, &chain_data_type, chain);
+
+    if (argc != chain->inputCount) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for %d)", argc, chain->inputCount);
+    }
+    if (chain->stepCount == 0) {
+        return Qnil;
+    }
+
+    run.chain = chain;
+    run.params = ALLOCA_N(FFIStorage, MAX(chain->paramCount, 1));
+    run.ffiValues = ALLOCA_N(void *, MAX(chain->paramCount, 1));
+    run.results = ALLOCA_N(FFIStorage, chain->resultSize);
+    slots = ALLOCA_N(FFIStorage, MAX(chain->slotSize, 1));
+    structs = ALLOCA_N(FFIStorage, MAX(chain->structSize, 1));
+    /* keeps converted argument values alive until the calls are done */
+    values = ALLOCA_N(VALUE, MAX(chain->paramCount, 1));
+    memset(slots, 0, MAX(chain->slotSize, 1) * sizeof(FFIStorage));
+
+    for (i = 0; i < chain->stepCount; ++i) {
+        ChainStep* step = &chain->steps[i];
+        FunctionType* fnInfo = step->fnInfo;
+
+        for (j = 0; j < fnInfo->parameterCount; ++j) {
+            ChainArg* arg = &step->args[j];
+            long p = step->paramOffset + j;
+
+            switch (arg->kind) {
+                case CHAIN_CONST:
+                case CHAIN_INPUT:
+                    values[p] = arg->kind == CHAIN_CONST ? arg->rbValue : argv[arg->index];
+                    rbffi_SetupCallParams(1, &values[p], 1, &fnInfo->parameterTypes[j],
+                        &run.params[p], &run.ffiValues[p], structs,
+                        fnInfo->callbackParameters + arg->callbackIndex, fnInfo->callbackCount - arg->callbackIndex,
+                        fnInfo->rbEnums);
+                    structs += rbffi_StructParamStorageCount(fnInfo->parameterTypes[j]);
+                    break;
+
+                case CHAIN_RESULT:
+                    values[p] = Qnil;
+                    run.ffiValues[p] = arg->narrow ? (void *) &run.params[p]
+                        : (void *) &run.results[chain->steps[arg->index].resultOffset];
+                    break;
+
+                case CHAIN_OUT:
+                    values[p] = Qnil;
+                    run.params[p].ptr = &slots[chain->slots[arg->index].offset];
+                    run.ffiValues[p] = &run.params[p];
+                    break;
+
+                case CHAIN_OUT_VALUE:
+                    values[p] = Qnil;
+                    run.ffiValues[p] = &slots[chain->slots[arg->index].offset];
+                    break;
+            }
+        }
+    }
+
+    rbffi_frame_push(&frame);
+    if (unlikely(chain->blocking)) {
+        rb_rescue2(chain_do_blocking_run, (VALUE) &run, rbffi_save_frame_exception, (VALUE) &frame, rb_eException, (VALUE) 0);
+    } else {
+        chain_execute(&run);
+    }
+    rbffi_frame_pop(&frame);
+
+    if (chain->saveErrno) {
+        rbffi_save_errno();
+    }
+
+    if (RTEST(frame.exc) && frame.exc != Qnil) {
+        rb_exc_raise(frame.exc);
+    }
+
+    if (NIL_P(chain->rbResults)) {
+        ChainStep* step = &chain->steps[chain->stepCount - 1];
+        rbReturnValue = rbffi_NativeValue_ToRuby(step->fnInfo->returnType, step->fnInfo->rbReturnType,
+            &run.results[step->resultOffset]);
+
+    } else if (RARRAY_LEN(chain->rbResults) == 1) {
+        rbReturnValue = chain_result(chain, RARRAY_AREF(chain->rbResults, 0), argv, run.results, slots);
+
+    } else {
+        long count = RARRAY_LEN(chain->rbResults);
+        rbReturnValue = rb_ary_new_capa(count);
+        for (i = 0; i < count; ++i) {
+            rb_ary_push(rbReturnValue, chain_result(chain, RARRAY_AREF(chain->rbResults, i), argv, run.results, slots));
+        }
+    }
+    RB_GC_GUARD(self);
+
+    return rbReturnValue;
+}
+
+/*
+ * call-seq: value
+ * @return [CallChain::Ref]
+ * For an out-param reference, a reference to the value the callee stored
+ * rather than to its storage.
+ */
+static VALUE
+ref_value(VALUE self)
+{
+    ChainRef* ref;
+
+    TypedData_Get_Struct(self, ChainRef, &ref_data_type, ref);
+    if (ref->kind != CHAIN_OUT) {
+        rb_raise(rb_eArgError, "only out-param references have a value");
+    }
+
+    return ref_new(ref->rbChain, CHAIN_OUT_VALUE, ref->index);
+}
+
+void
+rbffi_CallChain_Init(VALUE moduleFFI)
+{
+    /*
+     * Document-class: FFI::CallChain
+     * A prepared sequence of native calls, run with a single ruby to C transition.
+     */
+    rbffi_CallChainClass = rb_define_class_under(moduleFFI, "CallChain", rb_cObject);
+    rb_global_variable(&rbffi_CallChainClass);
+    rb_define_alloc_func(rbffi_CallChainClass, chain_allocate);
+
+    /*
+     * Document-class: FFI::CallChain::Ref
+     * A placeholder for a value only known when the chain runs.
+     */
+    ChainRefClass = rb_define_class_under(rbffi_CallChainClass, "Ref", rb_cObject);
+    rb_global_variable(&ChainRefClass);
+    rb_undef_alloc_func(ChainRefClass);
+    rb_define_method(ChainRefClass, "value", ref_value, 0);
+
+    rb_define_method(rbffi_CallChainClass, "initialize", chain_initialize, 0);
+    rb_define_method(rbffi_CallChainClass, "input", chain_input, 0);
+    rb_define_method(rbffi_CallChainClass, "out", chain_out, 1);
+    rb_define_method(rbffi_CallChainClass, "call", chain_call, -1);
+    rb_define_method(rbffi_CallChainClass, "returns", chain_returns, -1);
+    rb_define_method(rbffi_CallChainClass, "run", chain_run, -1);
+
+    id_type = rb_intern("type");
+}
@@ -0,0 +1,640 @@
+/*
+ * Copyright (c) 2008-2013, Ruby FFI project contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Ruby FFI project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MSC_VER
+#include <sys/param.h>
+#endif
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#if defined(__CYGWIN__) || !defined(_WIN32)
+# include <unistd.h>
+# include <fcntl.h>
+# define QUEUE_FD 1
+#endif
+#include <ruby.h>
+#include <ruby/io.h>
+#include <ruby/thread_native.h>
+
+#include <ffi.h>
+#include "rbffi.h"
+#include "compat.h"
+#include "AbstractMemory.h"
+#include "Pointer.h"
+#include "Type.h"
+#include "Types.h"
+#include "MappedType.h"
+#include "ClosurePool.h"
+#include "Function.h"
+#include "CallbackQueue.h"
+
+/*
+ * A void callback which doesn't call ruby but records its arguments into a ring buffer.
+ * Native threads never wait for the GVL, ruby code drains the records whenever it likes.
+ * Every argument takes one slot, which holds it the way libffi passed it to the closure.
+ */
+
+typedef union QueueSlot_ {
+    int64_t i64;
+    double f64;
+    void* ptr;
+} QueueSlot;
+
+typedef struct CallbackQueue_ {
+    Pointer base;
+    VALUE rbFunctionInfo;
+    FunctionType* info;
+    Closure* closure;
+
+    /* Serializes the native threads recording and ruby draining */
+    rb_nativethread_lock_t lock;
+    bool lockInitialized;
+    QueueSlot* records;
+    int recordSlots;
+    long capacity;
+    long head;
+    long count;
+    long dropped;
+    /* the read end of the pipe is readable while records are queued */
+    int fds[2];
+    bool signaled;
+    /* drain consumes records only once the block has seen them */
+    bool draining;
+} CallbackQueue;
+
+#ifndef MIN
+#  define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#  define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+/* Number of records copied out of the queue at once while draining */
+#define DRAIN_CHUNK 256
+
+VALUE rbffi_CallbackQueueClass = Qnil;
+
+static ID id_from_native = 0;
+
+static void cbq_mark(void *data);
+static void cbq_compact(void *data);
+static void cbq_free(void *data);
+static size_t cbq_memsize(const void *data);
+
+static const rb_data_type_t callback_queue_data_type = {
+    .wrap_struct_name = "FFI::CallbackQueue",
+    .function = {
+        .dmark = cbq_mark,
+        .dfree = cbq_free,
+        .dsize = cbq_memsize,
+        ffi_compact_callback( cbq_compact )
+    },
+    .parent = &rbffi_pointer_data_type,
+    // IMPORTANT: WB_PROTECTED objects must only use the RB_OBJ_WRITE()
+    // macro to update VALUE references, as to trigger write barriers.
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static VALUE
+cbq_allocate(VALUE klass)
+{
+    CallbackQueue* queue;
+    VALUE obj = TypedData_Make_Struct(klass, CallbackQueue, &callback_queue_data_type, queue);
+
+    queue->base.memory.flags = MEM_RD;
+    RB_OBJ_WRITE(obj, &queue->base.rbParent, Qnil);
+    RB_OBJ_WRITE(obj, &queue->rbFunctionInfo, Qnil);
+    queue->fds[0] = queue->fds[1] = -1;
+
+    return obj;
+}
+
+static void
+cbq_mark(void *data)
+{
+    CallbackQueue* queue = (CallbackQueue *) data;
+    rb_gc_mark_movable(queue->base.rbParent);
+    rb_gc_mark_movable(queue->rbFunctionInfo);
+}
+
+static void
+cbq_compact(void *data)
+{
+    CallbackQueue* queue = (CallbackQueue *) data;
+    ffi_gc_location(queue->base.rbParent);
+    ffi_gc_location(queue->rbFunctionInfo);
+}
+
+static void
+cbq_free(void *data)
+{
+    CallbackQueue* queue = (CallbackQueue *) data;
+
+    if (queue->closure != NULL) {
+        rbffi_Closure_Free(queue->closure);
+    }
+    if (queue->lockInitialized) {
+        rb_nativethread_lock_destroy(&queue->lock);
+    }
+#ifdef QUEUE_FD
+    if (queue->fds[0] >= 0) {
+        close(queue->fds[0]);
+        close(queue->fds[1]);
+    }
+#endif
+    xfree(queue->records);
+    xfree(queue);
+}
+
+static size_t
+cbq_memsize(const void *data)
+{
+    const CallbackQueue* queue = (const CallbackQueue *) data;
+
+    return sizeof(*queue) + queue->capacity * queue->recordSlots * sizeof(QueueSlot)
+        + (queue->closure != NULL ? sizeof(Closure) : 0);
+}
+
+static CallbackQueue*
+cbq_get(VALUE self)
+{
+    CallbackQueue* queue;
+
+    TypedData_Get_Struct(self, CallbackQueue, &callback_queue_data_type, queue);
+    if (queue->closure == NULL) {
+        rb_raise(rb_eRuntimeError, "callback queue not initialized");
+    }
+
+    return queue;
+}
+
+/* The closure handler, called on any thread */
+static void
+queue_record(ffi_cif* cif, void* retval, void** parameters, void* user_data)
+{
+    CallbackQueue* queue = (CallbackQueue *) ((Closure *) user_data)->info;
+    FunctionType* fnInfo = queue->info;
+    int i;
+
+    rb_nativethread_lock_lock(&queue->lock);
+    if (queue->count < queue->capacity) {
+        QueueSlot* record = &queue->records[((queue->head + queue->count) % queue->capacity) * queue->recordSlots];
+
+        for (i = 0; i < fnInfo->parameterCount; i++) {
+            memcpy(&record[i], parameters[i], fnInfo->callbackParams[i].type->ffiType->size);
+        }
+        queue->count++;
+#ifdef QUEUE_FD
+        if (!queue->signaled) {
+            char c = 0;
+            queue->signaled = write(queue->fds[1], &c, 1) == 1;
+        }
+#endif
+    } else {
+        queue->dropped++;
+    }
+    rb_nativethread_lock_unlock(&queue->lock);
+}
+
+static bool
+cbq_prep(void* ctx, void* code, Closure* closure, char* errmsg, size_t errmsgsize)
+{
+    FunctionType* fnInfo = (FunctionType *) ctx;
+    ffi_status ffiStatus;
+
+    ffiStatus = ffi_prep_closure_loc(closure->pcl, &fnInfo->ffi_cif, queue_record, closure, code);
+    if (ffiStatus != FFI_OK) {
+        snprintf(errmsg, errmsgsize, "ffi_prep_closure_loc failed.  status=%#x", ffiStatus);
+        return false;
+    }
+
+    return true;
+}
+
+static void
+check_parameter_type(const CallbackParam* param)
+{
+    VALUE rbType;
+
+    switch (param->type->nativeType) {
+        case NATIVE_INT8:
+        case NATIVE_UINT8:
+        case NATIVE_INT16:
+        case NATIVE_UINT16:
+        case NATIVE_INT32:
+        case NATIVE_UINT32:
+        case NATIVE_INT64:
+        case NATIVE_UINT64:
+        case NATIVE_LONG:
+        case NATIVE_ULONG:
+        case NATIVE_FLOAT32:
+        case NATIVE_FLOAT64:
+        case NATIVE_POINTER:
+        case NATIVE_FUNCTION:
+        case NATIVE_BOOL:
+            return;
+
+        default:
+            /* Strings, buffers and structs passed by value don't outlive the call */
+            rbType = RARRAY_AREF(param->info->rbParameterTypes, param->index);
+            rbType = rb_funcall2(rbType, rb_intern("inspect"), 0, NULL);
+            rb_raise(rb_eTypeError, "Invalid callback queue parameter type (%s)", RSTRING_PTR(rbType));
+    }
+}
+
+/*
+ * call-seq: initialize(function_type, capacity = 1024)
+ * @param [FunctionType] function_type signature of the callback, returning +:void+
+ * @param [Integer] capacity maximum number of queued calls
+ * @return [self]
+ * A callback which records its arguments instead of calling ruby.  It can be passed
+ * wherever a callback of +function_type+ is expected.  Calls made while the queue is full
+ * are dropped and counted by {#dropped}.
+ *
+ * Arguments are converted to ruby objects when the queue is drained, so only
+ * numbers, booleans and pointers, possibly wrapped by data converters, are supported.
+ */
+static VALUE
+cbq_initialize(int argc, VALUE* argv, VALUE self)
+{
+    CallbackQueue* queue;
+    FunctionType* fnInfo;
+    VALUE rbFunctionInfo, rbCapacity;
+    char name[96];
+    long capacity;
+    int i;
+
+    TypedData_Get_Struct(self, CallbackQueue, &callback_queue_data_type, queue);
+    if (queue->closure != NULL) {
+        rb_raise(rb_eRuntimeError, "callback queue already initialized");
+    }
+
+    rb_scan_args(argc, argv, "11", &rbFunctionInfo, &rbCapacity);
+    if (!rb_obj_is_kind_of(rbFunctionInfo, rbffi_FunctionTypeClass)) {
+        rb_raise(rb_eTypeError, "wrong argument type %s (expected FFI::FunctionType)",
+                rb_obj_classname(rbFunctionInfo));
+    }
+    TypedData_Get_Struct(rbFunctionInfo, FunctionType, &rbffi_fntype_data_type, fnInfo);
+
+    capacity = NIL_P(rbCapacity) ? 1024 : NUM2LONG(rbCapacity);
+    if (capacity < 1) {
+        rb_raise(rb_eArgError, "callback queue capacity must be positive (%ld)", capacity);
+    }
+    if (fnInfo->returnType->nativeType != NATIVE_VOID) {
+        rb_raise(rb_eTypeError, "callback queues need a :void return type");
+    }
+    for (i = 0; i < fnInfo->parameterCount; i++) {
+        check_parameter_type(&fnInfo->callbackParams[i]);
+    }
+
+    RB_OBJ_WRITE(self, &queue->rbFunctionInfo, rbFunctionInfo);
+    queue->info = fnInfo;
+    queue->capacity = capacity;
+    queue->recordSlots = fnInfo->parameterCount > 0 ? fnInfo->parameterCount : 1;
+    queue->records = xcalloc(capacity * queue->recordSlots, sizeof(QueueSlot));
+
+#ifdef QUEUE_FD
+    if (rb_cloexec_pipe(queue->fds) < 0) {
+        rb_sys_fail("pipe");
+    }
+    rb_update_max_fd(queue->fds[0]);
+    rb_update_max_fd(queue->fds[1]);
+    fcntl(queue->fds[0], F_SETFL, fcntl(queue->fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(queue->fds[1], F_SETFL, fcntl(queue->fds[1], F_GETFL) | O_NONBLOCK);
+#endif
+
+    rb_nativethread_lock_initialize(&queue->lock);
+    queue->lockInitialized = true;
+
+    /* The closures are prepared with the cif of the FunctionType */
+    snprintf(name, sizeof(name), "queue ");
+    rbffi_FunctionType_Signature(fnInfo, name + strlen(name), sizeof(name) - strlen(name));
+    if (rbffi_ClosurePool_Get(&fnInfo->queuePool, sizeof(ffi_closure), cbq_prep, fnInfo, name) == NULL) {
+        rb_raise(rb_eNoMemError, "failed to create closure pool");
+    }
+
+    queue->closure = rbffi_Closure_Alloc(fnInfo->queuePool);
+    queue->closure->info = queue;
+    queue->base.memory.address = queue->closure->code;
+    queue->base.memory.size = sizeof(*queue->closure);
+
+    return self;
+}
+
+/* Copy up to max records from the head of the queue, without consuming them */
+static long
+queue_peek(CallbackQueue* queue, QueueSlot* records, long max)
+{
+    long i, count;
+
+    rb_nativethread_lock_lock(&queue->lock);
+    count = MIN(queue->count, max);
+    for (i = 0; i < count; i++) {
+        memcpy(&records[i * queue->recordSlots],
+                &queue->records[((queue->head + i) % queue->capacity) * queue->recordSlots],
+                queue->recordSlots * sizeof(QueueSlot));
+    }
+    rb_nativethread_lock_unlock(&queue->lock);
+
+    return count;
+}
+
+static void
+queue_consume(CallbackQueue* queue, long count)
+{
+    rb_nativethread_lock_lock(&queue->lock);
+    queue->head = (queue->head + count) % queue->capacity;
+    queue->count -= count;
+#ifdef QUEUE_FD
+    if (queue->count == 0 && queue->signaled) {
+        char buf[64];
+        while (read(queue->fds[0], buf, sizeof(buf)) > 0);
+        queue->signaled = false;
+    }
+#endif
+    rb_nativethread_lock_unlock(&queue->lock);
+}
+
+static VALUE
+record_to_ruby(CallbackQueue* queue, const QueueSlot* record)
+{
+    FunctionType* fnInfo = queue->info;
+    VALUE args = rb_ary_new_capa(fnInfo->parameterCount);
+    int i;
+
+    for (i = 0; i < fnInfo->parameterCount; i++) {
+        const CallbackParam* param = &fnInfo->callbackParams[i];
+        VALUE value = (*param->toRuby)(param, &record[i]);
+
+        /* Convert the native value into a custom ruby value */
+        if (param->mapped != NULL) {
+            VALUE values[] = { value, Qnil };
+            value = rb_funcall2(param->mapped->rbConverter, id_from_native, 2, values);
+        }
+        rb_ary_push(args, value);
+    }
+
+    return args;
+}
+
+struct drain_args {
+    CallbackQueue* queue;
+    QueueSlot* records;
+    long max;
+    long batch;
+    long consumed;
+    long total;
+    VALUE result;
+};
+
+static VALUE
+drain_records(VALUE data)
+{
+    struct drain_args* d = (struct drain_args *) data;
+    CallbackQueue* queue = d->queue;
+    long chunk = d->batch > 0 ? d->batch : DRAIN_CHUNK;
+
+    while (d->max < 0 || d->total < d->max) {
+        long i, count;
+        VALUE batch = Qnil;
+
+        count = queue_peek(queue, d->records, d->max < 0 ? chunk : MIN(chunk, d->max - d->total));
+        if (count == 0) {
+            break;
+        }
+
+        /* Records are consumed before their conversion, a raising data converter must not stall the queue */
+        if (d->batch > 0) {
+            d->consumed = count;
+            d->total += count;
+            batch = rb_ary_new_capa(count);
+            for (i = 0; i < count; i++) {
+                rb_ary_push(batch, record_to_ruby(queue, &d->records[i * queue->recordSlots]));
+            }
+            rb_yield(batch);
+
+        } else {
+            for (i = 0; i < count; i++) {
+                VALUE args;
+
+                d->consumed++;
+                d->total++;
+                args = record_to_ruby(queue, &d->records[i * queue->recordSlots]);
+                if (d->result != Qnil) {
+                    rb_ary_push(d->result, args);
+                } else {
+                    rb_yield_values2((int) RARRAY_LEN(args), RARRAY_CONST_PTR(args));
+                }
+            }
+        }
+
+        queue_consume(queue, d->consumed);
+        d->consumed = 0;
+    }
+
+    return Qnil;
+}
+
+static VALUE
+drain_done(VALUE data)
+{
+    struct drain_args* d = (struct drain_args *) data;
+
+    /* Records the block has seen are consumed, even if it raised */
+    if (d->consumed > 0) {
+        queue_consume(d->queue, d->consumed);
+    }
+    d->queue->draining = false;
+    xfree(d->records);
+
+    return Qnil;
+}
+
+static long
+queue_drain(CallbackQueue* queue, long max, long batch, VALUE result)
+{
+    struct drain_args d;
+
+    if (queue->draining) {
+        rb_raise(rb_eRuntimeError, "callback queue is already being drained");
+    }
+
+    d.queue = queue;
+    d.max = max;
+    d.batch = batch;
+    d.consumed = 0;
+    d.total = 0;
+    d.result = result;
+    d.records = xmalloc2(batch > 0 ? batch : DRAIN_CHUNK, queue->recordSlots * sizeof(QueueSlot));
+    queue->draining = true;
+    rb_ensure(drain_records, (VALUE) &d, drain_done, (VALUE) &d);
+
+    return d.total;
+}
+
+/*
+ * call-seq: drain(max = nil) { |*args| ... }
+ * @param [Integer, nil] max maximum number of calls to process, all queued calls by default
+ * @return [Integer, Array<Array>] number of calls processed, or their arguments without a block
+ * Yield the arguments of the queued calls, oldest first.
+ */
+static VALUE
+cbq_drain(int argc, VALUE* argv, VALUE self)
+{
+    CallbackQueue* queue = cbq_get(self);
+    VALUE rbMax, result = Qnil;
+    long count;
+
+    rb_scan_args(argc, argv, "01", &rbMax);
+    if (!rb_block_given_p()) {
+        result = rb_ary_new();
+    }
+    count = queue_drain(queue, NIL_P(rbMax) ? -1 : MAX(NUM2LONG(rbMax), 0), 0, result);
+
+    return result != Qnil ? result : LONG2NUM(count);
+}
+
+/*
+ * call-seq: each_batch(size = 256) { |batch| ... }
+ * @param [Integer] size maximum number of calls per batch
+ * @yieldparam [Array<Array>] batch arguments of the queued calls, oldest first
+ * @return [Integer] number of calls processed
+ * Yield the queued calls in batches, until the queue is empty.
+ */
+static VALUE
+cbq_each_batch(int argc, VALUE* argv, VALUE self)
+{
+    CallbackQueue* queue = cbq_get(self);
+    VALUE rbSize;
+    long size;
+
+    rb_scan_args(argc, argv, "01", &rbSize);
+    size = NIL_P(rbSize) ? DRAIN_CHUNK : NUM2LONG(rbSize);
+    if (size < 1) {
+        rb_raise(rb_eArgError, "batch size must be positive (%ld)", size);
+    }
+    rb_need_block();
+
+    return LONG2NUM(queue_drain(queue, -1, size, Qnil));
+}
+
+/*
+ * call-seq: size
+ * @return [Integer] number of queued calls
+ */
+static VALUE
+cbq_size(VALUE self)
+{
+    CallbackQueue* queue = cbq_get(self);
+    long count;
+
+    rb_nativethread_lock_lock(&queue->lock);
+    count = queue->count;
+    rb_nativethread_lock_unlock(&queue->lock);
+
+    return LONG2NUM(count);
+}
+
+/*
+ * call-seq: capacity
+ * @return [Integer] maximum number of queued calls
+ */
+static VALUE
+cbq_capacity(VALUE self)
+{
+    return LONG2NUM(cbq_get(self)->capacity);
+}
+
+/*
+ * call-seq: dropped
+ * @return [Integer] number of calls dropped because the queue was full
+ */
+static VALUE
+cbq_dropped(VALUE self)
+{
+    CallbackQueue* queue = cbq_get(self);
+    long dropped;
+
+    rb_nativethread_lock_lock(&queue->lock);
+    dropped = queue->dropped;
+    rb_nativethread_lock_unlock(&queue->lock);
+
+    return LONG2NUM(dropped);
+}
+
+/*
+ * call-seq: function_type
+ * @return [FunctionType] signature of the callback
+ */
+static VALUE
+cbq_function_type(VALUE self)
+{
+    return cbq_get(self)->rbFunctionInfo;
+}
+
+/*
+ * call-seq: fileno
+ * @return [Integer] file descriptor which is readable while calls are queued
+ * Use {#to_io} to wait for calls with +IO.select+ or a fiber scheduler.
+ * The descriptor must not be read from or closed.
+ */
+static VALUE
+cbq_fileno(VALUE self)
+{
+#ifdef QUEUE_FD
+    return INT2FIX(cbq_get(self)->fds[0]);
+#else
+    rb_raise(rb_eNotImpError, "callback queues don't provide a file descriptor on this platform");
+#endif
+}
+
+void
+rbffi_CallbackQueue_Init(VALUE moduleFFI)
+{
+    /*
+     * Document-class: FFI::CallbackQueue < FFI::Pointer
+     * A void callback which queues its calls, to be processed by ruby in batches.
+     * It never waits for the GVL, so native threads can call it at any rate.
+     */
+    rbffi_CallbackQueueClass = rb_define_class_under(moduleFFI, "CallbackQueue", rbffi_PointerClass);
+    rb_global_variable(&rbffi_CallbackQueueClass);
+    rb_define_alloc_func(rbffi_CallbackQueueClass, cbq_allocate);
+
+    rb_define_method(rbffi_CallbackQueueClass, "initialize", cbq_initialize, -1);
+    rb_define_method(rbffi_CallbackQueueClass, "drain", cbq_drain, -1);
+    rb_define_method(rbffi_CallbackQueueClass, "each_batch", cbq_each_batch, -1);
+    rb_define_method(rbffi_CallbackQueueClass, "size", cbq_size, 0);
+    rb_define_method(rbffi_CallbackQueueClass, "capacity", cbq_capacity, 0);
+    rb_define_method(rbffi_CallbackQueueClass, "dropped", cbq_dropped, 0);
+    rb_define_method(rbffi_CallbackQueueClass, "function_type", cbq_function_type, 0);
+    rb_define_method(rbffi_CallbackQueueClass, "fileno", cbq_fileno, 0);
+
+    id_from_native = rb_intern("from_native");
+}
@@ -44,7 +44,12 @@
 #  include <windows.h>
 #endif
 #include <errno.h>
+#include <string.h>
+#if defined(__CYGWIN__) || !defined(_WIN32)
+#  include <pthread.h>
+#endif
 #include <ruby.h>
+#include <ruby/thread_native.h>
 
 #include <ffi.h>
 #include "rbffi.h"
@@ -61,13 +66,27 @@
 #ifndef roundup
 #  define roundup(x, y)   ((((x)+((y)-1))/(y))*(y))
 #endif
+#ifndef MAX
+#  define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
 
 typedef struct Memory {
     void* code;
     void* data;
+    /* closures of the batch in data, with ffi_closure_alloc each one has its own code */
+    int count;
+    /* closures of the batch found free while reclaiming */
+    int freeCount;
     struct Memory* next;
 } Memory;
 
+/*
+ * Pools hang off FunctionTypes, which are shared between Ractors, so closures are
+ * allocated and released in parallel.  Freed closures are pushed onto the global
+ * free list of the pool with a CAS, and taken off all at once, so there is no ABA
+ * problem.  Each native thread keeps the closures it took in a cache in front of
+ * the global list, which makes the common alloc/free cycle free of atomics.
+ */
 struct ClosurePool_ {
     void* ctx;
     int closureSize;
@@ -75,120 +94,380 @@ struct ClosurePool_ {
     struct Memory* blocks; /* Keeps track of all the allocated memory for this pool */
     Closure* list;
     long refcnt;
+    /* Serializes growing and reclaiming, which modify blocks */
+    rb_nativethread_lock_t lock;
+    long pages;
+    long closures;
+    long live;
+    /* free closures kept when reclaiming pages, see rbffi_ClosurePool_Reserve() */
+    long reserved;
+    /* number of free closures to try the next reclaim at */
+    long reclaimAt;
+    /* signature of the closures, see FFI.closure_pool_stats */
+    char name[96];
+    struct ClosurePool_* prevPool;
+    struct ClosurePool_* nextPool;
 };
 
+/* Free closures of the pool the thread last allocated from */
+typedef struct ClosureCache_ {
+    ClosurePool* pool;
+    Closure* list;
+    int count;
+} ClosureCache;
+
+#define CLOSURE_CACHE_MAX 64
+
 static long pageSize;
+/* maximum number of closures per pool, 0 for no limit */
+static long closureLimit = 0;
+/* all pools, for the stats */
+static ClosurePool* pools = NULL;
+static rb_nativethread_lock_t poolsLock;
+#if !defined(__CYGWIN__) && defined(_WIN32)
+static DWORD cacheSlot = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t cacheKey;
+static bool cacheKeyValid = false;
+#endif
 
 static void* allocatePage(void);
 static bool freePage(void *);
 static bool protectPage(void *);
+static void closure_cache_flush(ClosureCache* cache);
+
+/* Atomically prepend the chain first..last to *head */
+static void
+list_push(void** head, void* first, void** lastNext)
+{
+    void* old;
+#ifdef _MSC_VER
+    do {
+        old = *(void* volatile *) head;
+        *lastNext = old;
+    } while (InterlockedCompareExchangePointer((PVOID volatile *) head, first, old) != old);
+#else
+    old = __atomic_load_n(head, __ATOMIC_RELAXED);
+    do {
+        *lastNext = old;
+    } while (!__atomic_compare_exchange_n(head, &old, first, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#endif
+}
+
+static void*
+list_take(void** head)
+{
+#ifdef _MSC_VER
+    return InterlockedExchangePointer((PVOID volatile *) head, NULL);
+#else
+    return __atomic_exchange_n(head, NULL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void
+closure_list_push(ClosurePool* pool, Closure* first)
+{
+    Closure* last = first;
+
+    while (last->next != NULL) {
+        last = last->next;
+    }
+    list_push((void **) &pool->list, first, (void **) &last->next);
+}
+
+static long
+atomic_add(long* value, long delta)
+{
+#ifdef _MSC_VER
+    return InterlockedExchangeAdd((LONG volatile *) value, delta) + delta;
+#else
+    return __atomic_add_fetch(value, delta, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static long
+atomic_get(long* value)
+{
+#ifdef _MSC_VER
+    return *(long volatile *) value;
+#else
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static long
+pool_ref(ClosurePool* pool, long delta)
+{
+    return atomic_add(&pool->refcnt, delta);
+}
 
 ClosurePool*
 rbffi_ClosurePool_New(int closureSize,
         bool (*prep)(void* ctx, void *code, Closure* closure, char* errbuf, size_t errbufsize),
-        void* ctx)
+        void* ctx, const char* name)
 {
     ClosurePool* pool;
 
-    pool = xcalloc(1, sizeof(*pool));
+    /* Not xcalloc, as the last reference might be dropped by a thread exiting without the GVL */
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
     pool->closureSize = closureSize;
     pool->ctx = ctx;
     pool->prep = prep;
     pool->refcnt = 1;
+    pool->reclaimAt = 0;
+    snprintf(pool->name, sizeof(pool->name), "%s", name);
+    rb_nativethread_lock_initialize(&pool->lock);
+
+    rb_nativethread_lock_lock(&poolsLock);
+    pool->nextPool = pools;
+    if (pools != NULL) {
+        pools->prevPool = pool;
+    }
+    pools = pool;
+    rb_nativethread_lock_unlock(&poolsLock);
 
     return pool;
 }
 
+/*
+ * Return the pool in *slot, creating it if there is none yet.
+ * Ractors racing to create it agree on the pool that got stored first.
+ */
+ClosurePool*
+rbffi_ClosurePool_Get(ClosurePool** slot, int closureSize,
+        bool (*prep)(void* ctx, void *code, Closure* closure, char* errbuf, size_t errbufsize),
+        void* ctx, const char* name)
+{
+    ClosurePool* pool;
+    ClosurePool* expected = NULL;
+
+#ifdef _MSC_VER
+    pool = *(ClosurePool* volatile *) slot;
+#else
+    pool = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#endif
+    if (pool != NULL) {
+        return pool;
+    }
+
+    pool = rbffi_ClosurePool_New(closureSize, prep, ctx, name);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+#ifdef _MSC_VER
+    expected = InterlockedCompareExchangePointer((PVOID volatile *) slot, pool, NULL);
+    if (expected == NULL) {
+        return pool;
+    }
+#else
+    if (__atomic_compare_exchange_n(slot, &expected, pool, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return pool;
+    }
+#endif
+    rbffi_ClosurePool_Free(pool);
+
+    return expected;
+}
+
+static void
+free_block(Memory* memory)
+{
+#if !USE_FFI_ALLOC
+    freePage(memory->code);
+#else
+    int i;
+    for (i = 0; i < memory->count; i++) {
+        ffi_closure_free(((Closure *) memory->data)[i].pcl);
+    }
+#endif
+    free(memory->data);
+    free(memory);
+}
+
 void
 cleanup_closure_pool(ClosurePool* pool)
 {
     Memory* memory;
 
+    rb_nativethread_lock_lock(&poolsLock);
+    if (pool->prevPool != NULL) {
+        pool->prevPool->nextPool = pool->nextPool;
+    } else {
+        pools = pool->nextPool;
+    }
+    if (pool->nextPool != NULL) {
+        pool->nextPool->prevPool = pool->prevPool;
+    }
+    rb_nativethread_lock_unlock(&poolsLock);
+
     for (memory = pool->blocks; memory != NULL; ) {
         Memory* next = memory->next;
-#if !USE_FFI_ALLOC
-        freePage(memory->code);
-#else
-        ffi_closure_free(memory->code);
-#endif
-        free(memory->data);
-        free(memory);
+        free_block(memory);
         memory = next;
     }
-    xfree(pool);
+    rb_nativethread_lock_destroy(&pool->lock);
+    free(pool);
+}
+
+static void
+pool_release(ClosurePool* pool)
+{
+    if (pool_ref(pool, -1) == 0) {
+        cleanup_closure_pool(pool);
+    }
 }
 
 void
 rbffi_ClosurePool_Free(ClosurePool* pool)
 {
     if (pool != NULL) {
-        long refcnt = --(pool->refcnt);
-        if (refcnt == 0) {
-            cleanup_closure_pool(pool);
+        pool_release(pool);
+    }
+}
+
+static ClosureCache*
+closure_cache(void)
+{
+    ClosureCache* cache;
+
+#if !defined(__CYGWIN__) && defined(_WIN32)
+    if (cacheSlot == FLS_OUT_OF_INDEXES) {
+        return NULL;
+    }
+    cache = (ClosureCache *) FlsGetValue(cacheSlot);
+#else
+    if (!cacheKeyValid) {
+        return NULL;
+    }
+    cache = (ClosureCache *) pthread_getspecific(cacheKey);
+#endif
+    if (cache == NULL && (cache = calloc(1, sizeof(*cache))) != NULL) {
+#if !defined(__CYGWIN__) && defined(_WIN32)
+        if (!FlsSetValue(cacheSlot, cache)) {
+#else
+        if (pthread_setspecific(cacheKey, cache) != 0) {
+#endif
+            free(cache);
+            cache = NULL;
+        }
+    }
+
+    return cache;
+}
+
+/* Give the cached closures back to the pool and drop the reference of the cache */
+static void
+closure_cache_flush(ClosureCache* cache)
+{
+    ClosurePool* pool = cache->pool;
+
+    if (pool != NULL) {
+        if (cache->list != NULL) {
+            closure_list_push(pool, cache->list);
         }
+        cache->pool = NULL;
+        cache->list = NULL;
+        cache->count = 0;
+        pool_release(pool);
+    }
+}
+
+#if !defined(__CYGWIN__) && defined(_WIN32)
+static VOID WINAPI
+#else
+static void
+#endif
+closure_cache_free(void* data)
+{
+    ClosureCache* cache = (ClosureCache *) data;
+
+    closure_cache_flush(cache);
+    free(cache);
+}
+
+/* Keep the free closures of list in the cache of this thread, the rest goes back to the pool */
+static void
+closure_cache_fill(ClosureCache* cache, ClosurePool* pool, Closure* list)
+{
+    if (cache != NULL && cache->pool != pool) {
+        closure_cache_flush(cache);
+        /* The cache keeps the pool alive, so that it can't be reused at the same address */
+        pool_ref(pool, 1);
+        cache->pool = pool;
+    }
+
+    while (cache != NULL && list != NULL && cache->count < CLOSURE_CACHE_MAX) {
+        Closure* next = list->next;
+        list->next = cache->list;
+        cache->list = list;
+        cache->count++;
+        list = next;
+    }
+
+    if (list != NULL) {
+        closure_list_push(pool, list);
     }
 }
 
 #if !USE_FFI_ALLOC
 
-Closure*
-rbffi_Closure_Alloc(ClosurePool* pool)
+/* Allocate a new page of closures and return them as a list, called with pool->lock held */
+static Closure*
+pool_grow(ClosurePool* pool, char* errmsg, size_t errmsgsize)
 {
     Closure *list = NULL;
     Memory* block = NULL;
     void *code = NULL;
-    char errmsg[256];
     int nclosures;
     long trampolineSize;
     int i;
 
-    if (pool->list != NULL) {
-        Closure* closure = pool->list;
-        pool->list = pool->list->next;
-        pool->refcnt++;
-
-        return closure;
-    }
-
     trampolineSize = roundup(pool->closureSize, 8);
     nclosures = (int) (pageSize / trampolineSize);
+    if (closureLimit > 0 && pool->closures >= closureLimit) {
+        snprintf(errmsg, errmsgsize, "closure pool limit (%ld) reached", closureLimit);
+        goto error;
+    }
     block = calloc(1, sizeof(*block));
     list = calloc(nclosures, sizeof(*list));
     code = allocatePage();
 
     if (block == NULL || list == NULL || code == NULL) {
-        snprintf(errmsg, sizeof(errmsg), "failed to allocate a page. errno=%d (%s)", errno, strerror(errno));
+        snprintf(errmsg, errmsgsize, "failed to allocate a page. errno=%d (%s)", errno, strerror(errno));
         goto error;
     }
 
     for (i = 0; i < nclosures; ++i) {
         Closure* closure = &list[i];
-        closure->next = &list[i + 1];
+        closure->next = i + 1 < nclosures ? &list[i + 1] : NULL;
         closure->pool = pool;
+        closure->block = block;
         closure->code = ((char *)code + (i * trampolineSize));
         closure->pcl  = closure->code;
 
-        if (!(*pool->prep)(pool->ctx, closure->code, closure, errmsg, sizeof(errmsg))) {
+        if (!(*pool->prep)(pool->ctx, closure->code, closure, errmsg, errmsgsize)) {
             goto error;
         }
     }
 
     if (!protectPage(code)) {
+        snprintf(errmsg, errmsgsize, "failed to protect a page. errno=%d (%s)", errno, strerror(errno));
         goto error;
     }
 
     /* Track the allocated page + Closure memory area */
     block->data = list;
     block->code = code;
+    block->count = nclosures;
     block->next = pool->blocks;
     pool->blocks = block;
+    atomic_add(&pool->pages, 1);
+    atomic_add(&pool->closures, nclosures);
 
-    /* Thread the new block onto the free list, apart from the first one. */
-    list[nclosures - 1].next = pool->list;
-    pool->list = list->next;
-    pool->refcnt++;
-
-    /* Use the first one as the new handle */
     return list;
 
 error:
@@ -198,75 +477,251 @@ error:
         freePage(code);
     }
 
-
-    rb_raise(rb_eRuntimeError, "%s", errmsg);
     return NULL;
 }
 
 #else
 
-Closure*
-rbffi_Closure_Alloc(ClosurePool* pool)
+/*
+ * Allocate closures in batches of a page worth of trampolines, like the mmap based pool.
+ * Each trampoline comes from ffi_closure_alloc, but the Closure structs and the
+ * bookkeeping are shared by the whole batch.  Called with pool->lock held.
+ */
+static Closure*
+pool_grow(ClosurePool* pool, char* errmsg, size_t errmsgsize)
 {
-    Closure *closure = NULL;
+    Closure *list = NULL;
     Memory* block = NULL;
-    void *code = NULL;
-    void *pcl = NULL;
-    char errmsg[256];
+    int nclosures;
+    int i, count = 0;
 
+    nclosures = (int) (pageSize / roundup(sizeof(ffi_closure), 8));
+    if (closureLimit > 0 && pool->closures >= closureLimit) {
+        snprintf(errmsg, errmsgsize, "closure pool limit (%ld) reached", closureLimit);
+        goto error;
+    }
     block = calloc(1, sizeof(*block));
-    closure = calloc(1, sizeof(*closure));
-    pcl = ffi_closure_alloc(sizeof(ffi_closure), &code);
+    list = calloc(nclosures, sizeof(*list));
 
-    if (block == NULL || closure == NULL || pcl == NULL) {
-        snprintf(errmsg, sizeof(errmsg), "failed to allocate a page. errno=%d (%s)", errno, strerror(errno));
+    if (block == NULL || list == NULL) {
+        snprintf(errmsg, errmsgsize, "failed to allocate closures. errno=%d (%s)", errno, strerror(errno));
         goto error;
     }
 
-    closure->pool = pool;
-    closure->code = code;
-    closure->pcl = pcl;
+    for (i = 0; i < nclosures; ++i) {
+        Closure* closure = &list[i];
+        void* code = NULL;
+
+        closure->pcl = ffi_closure_alloc(sizeof(ffi_closure), &code);
+        if (closure->pcl == NULL) {
+            if (count > 0) {
+                /* Go on with a short batch */
+                break;
+            }
+            snprintf(errmsg, errmsgsize, "failed to allocate a closure. errno=%d (%s)", errno, strerror(errno));
+            goto error;
+        }
+        count++;
+        closure->pool = pool;
+        closure->block = block;
+        closure->code = code;
 
-    if (!(*pool->prep)(pool->ctx, closure->code, closure, errmsg, sizeof(errmsg))) {
-        goto error;
+        if (!(*pool->prep)(pool->ctx, closure->code, closure, errmsg, errmsgsize)) {
+            goto error;
+        }
     }
 
-    /* Track the allocated page + Closure memory area */
-    block->data = closure;
-    block->code = pcl;
-    pool->blocks = block;
+    for (i = 0; i < count; ++i) {
+        list[i].next = i + 1 < count ? &list[i + 1] : NULL;
+    }
 
-    /* Thread the new block onto the free list, apart from the first one. */
-    pool->refcnt++;
+    /* Track the Closure memory area and its trampolines */
+    block->data = list;
+    block->count = count;
+    block->next = pool->blocks;
+    pool->blocks = block;
+    atomic_add(&pool->pages, 1);
+    atomic_add(&pool->closures, count);
 
-    return closure;
+    return list;
 
 error:
-    free(block);
-    free(closure);
-    if (pcl != NULL) {
-        ffi_closure_free(pcl);
+    for (i = 0; list != NULL && i < count; i++) {
+        ffi_closure_free(list[i].pcl);
     }
+    free(block);
+    free(list);
 
-    rb_raise(rb_eRuntimeError, "%s", errmsg);
     return NULL;
 }
 
 #endif /* !USE_FFI_ALLOC */
 
+/* Take the free closures of the pool, growing it if there are none */
+static Closure*
+pool_expand(ClosurePool* pool)
+{
+    Closure* list;
+    char errmsg[256];
+
+    rb_nativethread_lock_lock(&pool->lock);
+    /* Another thread might have grown the pool meanwhile */
+    list = (Closure *) list_take((void **) &pool->list);
+    if (list == NULL) {
+        list = pool_grow(pool, errmsg, sizeof(errmsg));
+    }
+    rb_nativethread_lock_unlock(&pool->lock);
+
+    if (list == NULL) {
+        rb_raise(rb_eRuntimeError, "%s", errmsg);
+    }
+
+    return list;
+}
+
+Closure*
+rbffi_Closure_Alloc(ClosurePool* pool)
+{
+    ClosureCache* cache = closure_cache();
+    Closure* closure;
+
+    if (cache != NULL && cache->pool == pool && cache->list != NULL) {
+        closure = cache->list;
+        cache->list = closure->next;
+        cache->count--;
+
+    } else {
+        closure = (Closure *) list_take((void **) &pool->list);
+        if (closure == NULL) {
+            closure = pool_expand(pool);
+        }
+        if (closure->next != NULL) {
+            closure_cache_fill(cache, pool, closure->next);
+        }
+    }
+
+    closure->next = NULL;
+    pool_ref(pool, 1);
+    atomic_add(&pool->live, 1);
+
+    return closure;
+}
+
+/*
+ * Release the batches of closures which are all free, apart from the reserved ones.
+ * Closures held in the caches of threads keep their batch alive.
+ * Called with pool->lock held, returns the number of released batches.
+ */
+static long
+pool_reclaim(ClosurePool* pool)
+{
+    Closure* list = (Closure *) list_take((void **) &pool->list);
+    Closure *closure, *next, *keep = NULL;
+    Memory *block, **link, *released = NULL;
+    long available = 0, count = 0;
+
+    for (closure = list; closure != NULL; closure = closure->next) {
+        ((Memory *) closure->block)->freeCount++;
+        available++;
+    }
+
+    for (link = &pool->blocks; (block = *link) != NULL; ) {
+        if (block->freeCount == block->count && available - block->count >= pool->reserved) {
+            available -= block->count;
+            *link = block->next;
+            block->next = released;
+            block->freeCount = -1;
+            released = block;
+        } else {
+            block->freeCount = 0;
+            link = &block->next;
+        }
+    }
+
+    for (closure = list; closure != NULL; closure = next) {
+        next = closure->next;
+        if (((Memory *) closure->block)->freeCount >= 0) {
+            closure->next = keep;
+            keep = closure;
+        }
+    }
+    if (keep != NULL) {
+        closure_list_push(pool, keep);
+    }
+
+    while ((block = released) != NULL) {
+        released = block->next;
+        atomic_add(&pool->pages, -1);
+        atomic_add(&pool->closures, -block->count);
+        free_block(block);
+        count++;
+    }
+
+    return count;
+}
+
 void
 rbffi_Closure_Free(Closure* closure)
 {
     if (closure != NULL) {
         ClosurePool* pool = closure->pool;
-        long refcnt;
-        /* Just push it on the front of the free list */
-        closure->next = pool->list;
-        pool->list = closure;
-        refcnt = --(pool->refcnt);
-        if (refcnt == 0) {
-            cleanup_closure_pool(pool);
+        ClosureCache* cache = closure_cache();
+        long available;
+
+        atomic_add(&pool->live, -1);
+        if (cache != NULL && cache->pool == pool && cache->count < CLOSURE_CACHE_MAX) {
+            closure->next = cache->list;
+            cache->list = closure;
+            cache->count++;
+
+        } else {
+            closure->next = NULL;
+            list_push((void **) &pool->list, closure, (void **) &closure->next);
+
+            /*
+             * Give pages back once more than half of the closures and at least two batches
+             * beyond the reserve are free.  A failed attempt raises the bar by another batch.
+             */
+            available = atomic_get(&pool->closures) - atomic_get(&pool->live);
+            if (available >= pool->reclaimAt && available * 2 > atomic_get(&pool->closures)) {
+                long batch = atomic_get(&pool->closures) / MAX(atomic_get(&pool->pages), 1);
+
+                rb_nativethread_lock_lock(&pool->lock);
+                if (available >= pool->reclaimAt) {
+                    pool_reclaim(pool);
+                    pool->reclaimAt = atomic_get(&pool->closures) - atomic_get(&pool->live) + 2 * batch;
+                }
+                rb_nativethread_lock_unlock(&pool->lock);
+            }
         }
+        pool_release(pool);
+    }
+}
+
+/*
+ * Make sure count closures are available without growing the pool, and keep that many
+ * when pages are reclaimed.
+ */
+void
+rbffi_ClosurePool_Reserve(ClosurePool* pool, long count)
+{
+    char errmsg[256];
+    bool failed = false;
+
+    rb_nativethread_lock_lock(&pool->lock);
+    pool->reserved = MAX(pool->reserved, count);
+    while (!failed && atomic_get(&pool->closures) - atomic_get(&pool->live) < count) {
+        Closure* list = pool_grow(pool, errmsg, sizeof(errmsg));
+        if (list != NULL) {
+            closure_list_push(pool, list);
+        } else {
+            failed = true;
+        }
+    }
+    rb_nativethread_lock_unlock(&pool->lock);
+
+    if (failed) {
+        rb_raise(rb_eRuntimeError, "%s", errmsg);
     }
 }
 
@@ -325,9 +780,119 @@ protectPage(void* page)
 
 #endif /* !USE_FFI_ALLOC */
 
+static VALUE
+pool_stats_entry(VALUE stats, const char* name)
+{
+    VALUE key = rb_str_new_cstr(name);
+    VALUE entry = rb_hash_aref(stats, key);
+
+    if (NIL_P(entry)) {
+        entry = rb_hash_new();
+        rb_hash_aset(entry, ID2SYM(rb_intern("pages")), INT2FIX(0));
+        rb_hash_aset(entry, ID2SYM(rb_intern("live")), INT2FIX(0));
+        rb_hash_aset(entry, ID2SYM(rb_intern("free")), INT2FIX(0));
+        rb_hash_aset(stats, rb_str_freeze(key), entry);
+    }
+
+    return entry;
+}
+
+static void
+pool_stats_add(VALUE entry, const char* field, long value)
+{
+    VALUE key = ID2SYM(rb_intern(field));
+    rb_hash_aset(entry, key, LONG2NUM(NUM2LONG(rb_hash_aref(entry, key)) + value));
+}
+
+/*
+ * call-seq: closure_pool_stats
+ * @return [Hash<String, Hash>] usage of the closure pools
+ * Returns the pages, live closures and free closures of the closure pools, keyed
+ * by the signature of the closures.  Pools of equal signatures are summed up.
+ *
+ * Free closures include those cached by threads, so they are not always
+ * reclaimable.
+ */
+static VALUE
+closure_pool_stats(VALUE self)
+{
+    struct { char name[96]; long pages, live, closures; } *counts;
+    ClosurePool* pool;
+    long i, count = 0;
+    VALUE stats = rb_hash_new();
+
+    /* Copy the counts first, no ruby objects may be allocated under poolsLock */
+    rb_nativethread_lock_lock(&poolsLock);
+    for (pool = pools; pool != NULL; pool = pool->nextPool) {
+        count++;
+    }
+    counts = calloc(MAX(count, 1), sizeof(*counts));
+    for (pool = pools, i = 0; counts != NULL && pool != NULL; pool = pool->nextPool, i++) {
+        memcpy(counts[i].name, pool->name, sizeof(pool->name));
+        counts[i].pages = atomic_get(&pool->pages);
+        counts[i].live = atomic_get(&pool->live);
+        counts[i].closures = atomic_get(&pool->closures);
+    }
+    rb_nativethread_lock_unlock(&poolsLock);
+
+    if (counts == NULL) {
+        rb_raise(rb_eNoMemError, "failed to allocate closure pool stats");
+    }
+
+    for (i = 0; i < count; i++) {
+        VALUE entry = pool_stats_entry(stats, counts[i].name);
+        pool_stats_add(entry, "pages", counts[i].pages);
+        pool_stats_add(entry, "live", counts[i].live);
+        pool_stats_add(entry, "free", MAX(counts[i].closures - counts[i].live, 0));
+    }
+    free(counts);
+
+    return stats;
+}
+
+/*
+ * call-seq: closure_pool_limit
+ * @return [Integer] maximum number of closures per pool, 0 for no limit
+ */
+static VALUE
+closure_pool_get_limit(VALUE self)
+{
+    return LONG2NUM(closureLimit);
+}
+
+/*
+ * call-seq: closure_pool_limit = limit
+ * @param [Integer] limit maximum number of closures per pool, 0 for no limit
+ * @return [Integer] limit
+ * Limit the number of closures of each pool.  A pool holding +limit+ closures
+ * doesn't grow anymore and creating further callbacks of its signature raises
+ * a RuntimeError.  Pools already larger than the limit are not shrunk.
+ */
+static VALUE
+closure_pool_set_limit(VALUE self, VALUE limit)
+{
+    long value = NUM2LONG(limit);
+
+    if (value < 0) {
+        rb_raise(rb_eArgError, "closure pool limit must not be negative (%ld)", value);
+    }
+    closureLimit = value;
+
+    return limit;
+}
+
 void
 rbffi_ClosurePool_Init(VALUE module)
 {
     pageSize = getPageSize();
-}
+    rb_nativethread_lock_initialize(&poolsLock);
+#if !defined(__CYGWIN__) && defined(_WIN32)
+    cacheSlot = FlsAlloc(closure_cache_free);
+#else
+    cacheKeyValid = pthread_key_create(&cacheKey, closure_cache_free) == 0;
+#endif
 
+    rb_define_module_function(module, "closure_pool_stats", closure_pool_stats, 0);
+    rb_define_module_function(module, "closure_pool_limit", closure_pool_get_limit, 0);
+    rb_define_module_function(module, "closure_pool_limit=", closure_pool_set_limit, 1);
+}
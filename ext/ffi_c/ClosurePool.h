@@ -39,6 +39,7 @@ struct Closure_ {
     void* pcl;       /* Writeable address for the native trampoline code location */
 
     struct ClosurePool_* pool;
+    void* block;     /* batch of closures this one was allocated with */
     Closure* next;
 };
 
@@ -46,9 +47,14 @@ void rbffi_ClosurePool_Init(VALUE module);
 
 ClosurePool* rbffi_ClosurePool_New(int closureSize, 
         bool (*prep)(void* ctx, void *code, Closure* closure, char* errbuf, size_t errbufsize),
-        void* ctx);
+        void* ctx, const char* name);
+
+ClosurePool* rbffi_ClosurePool_Get(ClosurePool** slot, int closureSize,
+        bool (*prep)(void* ctx, void *code, Closure* closure, char* errbuf, size_t errbufsize),
+        void* ctx, const char* name);
 
 void rbffi_ClosurePool_Free(ClosurePool *);
+void rbffi_ClosurePool_Reserve(ClosurePool *, long count);
 
 Closure* rbffi_Closure_Alloc(ClosurePool *);
 void rbffi_Closure_Free(Closure *);
@@ -39,8 +39,10 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 #include <ruby.h>
 #include <ruby/thread.h>
+#include <ruby/thread_native.h>
 
 #if HAVE_RB_EXT_RACTOR_SAFE
 #include <ruby/ractor.h>
@@ -71,17 +73,33 @@
 
 #define DEFER_ASYNC_CALLBACK 1
 
+#ifndef FFI_ALIGN
+# define FFI_ALIGN(v, a)  (((((size_t) (v))-1) | ((a)-1))+1)
+#endif
+
 struct async_cb_dispatcher;
+struct async_cb_retired;
+struct gvl_callback;
+struct callback_metrics;
 typedef struct Function_ {
     Pointer base;
+    /* the Function object, nil for bindings of scoped callbacks */
+    VALUE rbSelf;
     FunctionType* info;
     MethodHandle* methodHandle;
     bool autorelease;
     Closure* closure;
     VALUE rbProc;
     VALUE rbFunctionInfo;
+    /* Pointer objects reused for the :pointer arguments of the callback */
+    VALUE rbPointerArgs;
+    bool pointerArgsBusy;
+    /* allocated by the first call with FFI.callback_metrics enabled */
+    struct callback_metrics* metrics;
 #if defined(DEFER_ASYNC_CALLBACK)
     struct async_cb_dispatcher *dispatcher;
+    /* dispatchers the Function was bound to before, see function_bind_dispatcher() */
+    struct async_cb_retired *retired;
 #endif
 } Function;
 
@@ -95,10 +113,13 @@ static bool callback_prep(void* ctx, void* code, Closure* closure, char* errmsg,
 static void* callback_with_gvl(void* data);
 static VALUE invoke_callback(VALUE data);
 static VALUE save_callback_exception(VALUE data, VALUE exc);
+static void callback_release_pointer_args(Function* fn);
 
 #if defined(DEFER_ASYNC_CALLBACK)
+static void function_release_dispatchers(Function* fn);
 static VALUE async_cb_event(void *);
-static VALUE async_cb_call(void *);
+static void async_cb_done(struct gvl_callback *);
+static VALUE async_cb_runner_loop(void *);
 #endif
 
 extern int ruby_thread_has_gvl_p(void);
@@ -121,37 +142,82 @@ static const rb_data_type_t function_data_type = {
 VALUE rbffi_FunctionClass = Qnil;
 
 static ID id_call = 0, id_to_native = 0, id_from_native = 0, id_cbtable = 0, id_cb_ref = 0;
+static ID id_aref = 0, id_aset = 0;
+static VALUE rbWeakMapClass = Qnil;
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+/* Ractor local WeakMap of Functions for native addresses, see rbffi_Function_ForAddress() */
+static rb_ractor_local_key_t function_cache_key;
+#elif defined(HAVE_RB_GC_MARK_MOVABLE)
+static VALUE function_cache = Qnil;
+#endif
 
 struct gvl_callback {
     Closure* closure;
     void*    retval;
     void**   parameters;
     bool done;
+    /* the Function's reused Pointer arguments are in use by this call */
+    bool pointerArgs;
     rbffi_frame_t *frame;
+    /* metrics are recorded for this call, with the times it was queued and started to wait for the GVL */
+    bool timed;
+    uint64_t queued;
+    uint64_t waiting;
 #if defined(DEFER_ASYNC_CALLBACK)
     struct async_cb_dispatcher *dispatcher;
     struct gvl_callback* next;
+    /* hash of the native thread that invoked the callback, for runner affinity */
+    unsigned int origin;
+    /* malloc'ed copy of a callback which nobody waits for, see async_cb_detach() */
+    bool detached;
+    /* links in the dispatcher's list of detached callbacks that haven't run yet */
+    struct gvl_callback* detached_prev;
+    struct gvl_callback* detached_next;
 
     /* Signal when the callback has finished and retval is set */
 # ifndef _WIN32
-    pthread_cond_t async_cond;
-    pthread_mutex_t async_mutex;
+    struct async_cb_waiter* waiter;
 # else
     HANDLE async_event;
 # endif
 #endif
 };
 
+#if defined(DEFER_ASYNC_CALLBACK) && !defined(_WIN32)
+/* Per native thread mutex/cond, reused for every callback the thread issues */
+struct async_cb_waiter {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static pthread_key_t async_cb_waiter_key;
+#elif defined(DEFER_ASYNC_CALLBACK)
+/* Fiber local storage slot holding the per native thread completion event */
+static DWORD async_cb_event_slot = FLS_OUT_OF_INDEXES;
+#endif
+
 
 #if defined(DEFER_ASYNC_CALLBACK)
 struct async_cb_dispatcher {
     /* the Ractor-local dispatcher thread */
     VALUE thread;
+    /* the Ractor running the callbacks, nil without Ractor support */
+    VALUE ractor;
 
-    /* single linked list of pending callbacks */
+    /* held by the Ractor and by each Function bound to it, see async_cb_dispatcher_ref() */
+    long refcnt;
+    /* the Ractor terminated, callbacks can't run anymore */
+    bool dead;
+
+    /* lock-free stack of pending callbacks, pushed by native threads */
     struct gvl_callback* async_cb_list;
 
-    /* Signal new entries in async_cb_list */
+    /* Detached callbacks keep their Function alive until they ran, see async_cb_detach().
+     * This lock is never held while allocating, so the GC can take it when marking. */
+    struct gvl_callback* detached_list;
+    rb_nativethread_lock_t detached_lock;
+
+    /* Signal the first entry of a batch in async_cb_list */
 # ifndef _WIN32
     pthread_mutex_t async_cb_mutex;
     pthread_cond_t async_cb_cond;
@@ -159,24 +225,185 @@ struct async_cb_dispatcher {
     HANDLE async_cb_cond;
     CRITICAL_SECTION async_cb_lock;
 # endif
+
+    /* runner threads executing the ruby callbacks, owned by the dispatcher thread */
+    struct async_cb_runner** runners;
+    long runner_count;
+    long runner_capacity;
 };
 
-#if HAVE_RB_EXT_RACTOR_SAFE
+/*
+ * A ruby thread which runs the callbacks handed over by the dispatcher.
+ * Pooled runners have a slot in 0...callback_runner_pool_size and wait for
+ * further callbacks, transient runners (slot -1) exit as soon as their queue
+ * is empty.  The queue and flags are protected by the dispatcher lock.
+ */
+struct async_cb_runner {
+    struct async_cb_dispatcher *dispatcher;
+    VALUE thread;
+    long slot;
+
+    /* FIFO of callbacks assigned to this runner */
+    struct gvl_callback* head;
+    struct gvl_callback* tail;
+    /* callback taken from the queue, but not yet started */
+    struct gvl_callback* cb;
+
+    bool busy;
+    bool stop;
+    bool dead;
+
+    /* Signal new entries in the queue */
+# ifndef _WIN32
+    pthread_cond_t cond;
+# else
+    HANDLE event;
+# endif
+};
+
+static int async_cb_runner_pool_size = 4;
+static bool async_cb_runner_affinity = false;
+
+static void
+async_cb_lock(struct async_cb_dispatcher *ctx)
+{
+# ifndef _WIN32
+    pthread_mutex_lock(&ctx->async_cb_mutex);
+# else
+    EnterCriticalSection(&ctx->async_cb_lock);
+# endif
+}
+
+static void
+async_cb_unlock(struct async_cb_dispatcher *ctx)
+{
+# ifndef _WIN32
+    pthread_mutex_unlock(&ctx->async_cb_mutex);
+# else
+    LeaveCriticalSection(&ctx->async_cb_lock);
+# endif
+}
+
+static void
+async_cb_runner_release(struct async_cb_runner *runner)
+{
+# ifndef _WIN32
+    pthread_cond_destroy(&runner->cond);
+# else
+    CloseHandle(runner->event);
+# endif
+    xfree(runner);
+}
+
+static struct async_cb_dispatcher *
+async_cb_dispatcher_ref(struct async_cb_dispatcher *ctx)
+{
+# ifdef _MSC_VER
+    InterlockedIncrement((LONG volatile *) &ctx->refcnt);
+# else
+    __atomic_add_fetch(&ctx->refcnt, 1, __ATOMIC_RELAXED);
+# endif
+    return ctx;
+}
+
+static void
+async_cb_dispatcher_unref(struct async_cb_dispatcher *ctx)
+{
+# ifdef _MSC_VER
+    long refcnt = InterlockedDecrement((LONG volatile *) &ctx->refcnt);
+# else
+    long refcnt = __atomic_sub_fetch(&ctx->refcnt, 1, __ATOMIC_ACQ_REL);
+# endif
+    if (refcnt == 0) {
+        xfree(ctx);
+    }
+}
+
+static bool
+async_cb_dispatcher_dead(struct async_cb_dispatcher *ctx)
+{
+# ifdef _MSC_VER
+    MemoryBarrier();
+    return *(volatile bool *) &ctx->dead;
+# else
+    return __atomic_load_n(&ctx->dead, __ATOMIC_SEQ_CST);
+# endif
+}
+
+static bool async_cb_list_push(struct async_cb_dispatcher *ctx, struct gvl_callback *cb);
+static struct gvl_callback *async_cb_list_take(struct async_cb_dispatcher *ctx);
+static void async_cb_done(struct gvl_callback *);
+
+/* Return from callbacks which will never run, with a zeroed result */
+static void
+async_cb_abandon(struct async_cb_dispatcher *ctx)
+{
+    struct gvl_callback *cb = async_cb_list_take(ctx);
+
+    while (cb != NULL) {
+        struct gvl_callback *next = cb->next;
+        ffi_type* returnType = ((Function *) cb->closure->info)->info->ffiReturnType;
+
+        memset(cb->retval, 0, returnType->size > sizeof(ffi_arg) ? returnType->size : sizeof(ffi_arg));
+        async_cb_done(cb);
+        cb = next;
+    }
+}
+
+/* Called when the dispatcher thread exits, which happens when the Ractor terminates */
+static void
+async_cb_dispatcher_kill(struct async_cb_dispatcher *ctx)
+{
+# ifdef _MSC_VER
+    ctx->dead = true;
+    MemoryBarrier();
+# else
+    __atomic_store_n(&ctx->dead, true, __ATOMIC_SEQ_CST);
+# endif
+    async_cb_abandon(ctx);
+}
+
 static void
 async_cb_dispatcher_mark(void *ptr)
 {
     struct async_cb_dispatcher *ctx = (struct async_cb_dispatcher *)ptr;
     if (ctx) {
+        struct gvl_callback *cb;
+        long i;
         rb_gc_mark(ctx->thread);
+        rb_gc_mark(ctx->ractor);
+        for (i = 0; i < ctx->runner_count; i++) {
+            rb_gc_mark(ctx->runners[i]->thread);
+        }
+
+        /* Pinned, since the Functions are referenced by native memory */
+        rb_nativethread_lock_lock(&ctx->detached_lock);
+        for (cb = ctx->detached_list; cb != NULL; cb = cb->detached_next) {
+            rb_gc_mark(((Function *) cb->closure->info)->rbSelf);
+        }
+        rb_nativethread_lock_unlock(&ctx->detached_lock);
     }
 }
 
+#if HAVE_RB_EXT_RACTOR_SAFE
+
 static void
 async_cb_dispatcher_free(void *ptr)
 {
     struct async_cb_dispatcher *ctx = (struct async_cb_dispatcher *)ptr;
     if (ctx) {
-        xfree(ctx);
+        long i;
+        for (i = 0; i < ctx->runner_count; i++) {
+            async_cb_runner_release(ctx->runners[i]);
+        }
+        xfree(ctx->runners);
+        ctx->runners = NULL;
+        ctx->runner_count = 0;
+        ctx->ractor = Qnil;
+
+        /* Functions bound to the Ractor might still be called from native threads */
+        async_cb_dispatcher_kill(ctx);
+        async_cb_dispatcher_unref(ctx);
     }
 }
 
@@ -213,6 +440,8 @@ static void
 async_cb_dispatcher_set(struct async_cb_dispatcher *ctx)
 {
     async_cb_dispatcher = ctx;
+    /* The dispatcher lives until the process exits, mark it through a hidden object */
+    rb_gc_register_mark_object(Data_Wrap_Struct(0, async_cb_dispatcher_mark, NULL, ctx));
 }
 #endif
 
@@ -220,6 +449,9 @@ static void
 async_cb_dispatcher_initialize(struct async_cb_dispatcher *ctx)
 {
         ctx->async_cb_list = NULL;
+        ctx->detached_list = NULL;
+        ctx->dead = false;
+        rb_nativethread_lock_initialize(&ctx->detached_lock);
 
 #if !defined(_WIN32)
         /* n.b. we _used_ to try and destroy the mutex/cond before initializing here,
@@ -247,6 +479,15 @@ async_cb_dispatcher_ensure_created(void)
     struct async_cb_dispatcher *ctx = async_cb_dispatcher_get();
     if (ctx == NULL) {
         ctx = (struct async_cb_dispatcher*)ALLOC(struct async_cb_dispatcher);
+        ctx->runners = NULL;
+        ctx->runner_count = 0;
+        ctx->runner_capacity = 0;
+        ctx->refcnt = 1;
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+        ctx->ractor = rb_funcall(rb_const_get(rb_cObject, rb_intern("Ractor")), rb_intern("current"), 0);
+#else
+        ctx->ractor = Qnil;
+#endif
         async_cb_dispatcher_initialize(ctx);
         async_cb_dispatcher_set(ctx);
     }
@@ -259,11 +500,220 @@ async_cb_dispatcher_atfork_child(VALUE self)
 {
     struct async_cb_dispatcher *ctx = async_cb_dispatcher_get();
     if (ctx) {
+        long i;
+        /* The runner threads did not survive the fork.  Their conds may still have
+         * waiters from before the fork, so just drop the memory, see below. */
+        for (i = 0; i < ctx->runner_count; i++) {
+            xfree(ctx->runners[i]);
+        }
+        ctx->runner_count = 0;
         async_cb_dispatcher_initialize(ctx);
     }
     return Qnil;
 }
+
+/*
+ * call-seq: callback_runner_pool_size
+ * @return [Integer] number of ruby threads kept for running callbacks from native threads
+ * Callbacks beyond the pool size run on additional short-lived threads.
+ */
+static VALUE
+async_cb_get_pool_size(VALUE self)
+{
+    return INT2NUM(async_cb_runner_pool_size);
+}
+
+/*
+ * call-seq: callback_runner_pool_size=(size)
+ * @param [Integer] size number of pooled runner threads per Ractor, +0+ starts a new thread for every callback
+ * @return [Integer] +size+
+ */
+static VALUE
+async_cb_set_pool_size(VALUE self, VALUE size)
+{
+    int n = NUM2INT(size);
+
+    if (n < 0) {
+        rb_raise(rb_eArgError, "pool size must not be negative");
+    }
+    async_cb_runner_pool_size = n;
+
+    return size;
+}
+
+/*
+ * call-seq: callback_runner_affinity?
+ * @return [Boolean] whether callbacks of a native thread always run on the same runner thread
+ */
+static VALUE
+async_cb_get_affinity(VALUE self)
+{
+    return async_cb_runner_affinity ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq: callback_runner_affinity=(enable)
+ * @param [Boolean] enable
+ * @return [Boolean] +enable+
+ * Pin the callbacks of each native thread to one pooled runner thread, so they run
+ * in order and see the same thread-local variables.
+ */
+static VALUE
+async_cb_set_affinity(VALUE self, VALUE enable)
+{
+    async_cb_runner_affinity = RTEST(enable);
+
+    return enable;
+}
+#endif
+
+/*
+ * Latency metrics of callbacks.  Each call runs through up to three phases:
+ * waiting in the async callback list for the dispatcher (native threads only),
+ * waiting for the GVL and running the ruby proc.  Durations are counted in
+ * buckets of powers of two nanoseconds.
+ */
+#define CALLBACK_METRICS_BUCKETS 40
+
+enum {
+    CALLBACK_PHASE_QUEUE,
+    CALLBACK_PHASE_GVL,
+    CALLBACK_PHASE_RUBY,
+    CALLBACK_PHASE_COUNT
+};
+
+struct callback_phase {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t histogram[CALLBACK_METRICS_BUCKETS];
+};
+
+struct callback_metrics {
+    struct callback_phase phases[CALLBACK_PHASE_COUNT];
+};
+
+static bool callback_metrics_enabled = false;
+/* Shareable Functions may be called by several Ractors in parallel */
+static rb_nativethread_lock_t callback_metrics_lock;
+
+static uint64_t
+callback_metrics_now(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+
+    return (uint64_t) (counter.QuadPart / frequency.QuadPart) * 1000000000 +
+        (uint64_t) (counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
 #endif
+}
+
+static void
+callback_phase_add(struct callback_phase* phase, uint64_t duration)
+{
+    uint64_t v = duration;
+    int bucket = 0;
+
+    while (v != 0 && bucket < CALLBACK_METRICS_BUCKETS - 1) {
+        v >>= 1;
+        bucket++;
+    }
+
+    phase->count++;
+    phase->total += duration;
+    phase->max = duration > phase->max ? duration : phase->max;
+    phase->histogram[bucket]++;
+}
+
+/* Called with the GVL held, after the ruby proc returned */
+static void
+callback_metrics_record(Function* fn, const struct gvl_callback* cb, uint64_t started, uint64_t finished)
+{
+    struct callback_metrics* metrics;
+
+    rb_nativethread_lock_lock(&callback_metrics_lock);
+    if (fn->metrics == NULL) {
+        /* Exceptions can't be raised here, so ruby's allocator isn't used */
+        fn->metrics = (struct callback_metrics *) calloc(1, sizeof(*fn->metrics));
+    }
+    if ((metrics = fn->metrics) == NULL) {
+        rb_nativethread_lock_unlock(&callback_metrics_lock);
+        return;
+    }
+
+    if (cb->queued != 0 && cb->waiting != 0) {
+        callback_phase_add(&metrics->phases[CALLBACK_PHASE_QUEUE], cb->waiting - cb->queued);
+    }
+    if (cb->waiting != 0) {
+        callback_phase_add(&metrics->phases[CALLBACK_PHASE_GVL], started - cb->waiting);
+    }
+    callback_phase_add(&metrics->phases[CALLBACK_PHASE_RUBY], finished - started);
+
+    rb_nativethread_lock_unlock(&callback_metrics_lock);
+}
+
+/*
+ * call-seq: callback_metrics?
+ * @return [Boolean] whether latency metrics of callbacks are recorded
+ */
+static VALUE
+callback_metrics_get_enabled(VALUE self)
+{
+    return callback_metrics_enabled ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq: callback_metrics=(enable)
+ * @param [Boolean] enable
+ * @return [Boolean] +enable+
+ * Record how long callbacks wait to be dispatched, wait for the GVL and run
+ * the ruby proc, see {Function#metrics}.  Disabled by default.
+ */
+static VALUE
+callback_metrics_set_enabled(VALUE self, VALUE enable)
+{
+    callback_metrics_enabled = RTEST(enable);
+
+    return enable;
+}
+
+static void
+callback_pointer_invalidate(VALUE rbPointer)
+{
+    Pointer* p;
+
+    TypedData_Get_Struct(rbPointer, Pointer, &rbffi_pointer_data_type, p);
+    p->memory.address = NULL;
+    p->memory.size = 0;
+    p->memory.flags = 0;
+}
+
+static VALUE
+callback_pointer_args_new(long count)
+{
+    VALUE rbPointerArgs = rb_ary_new_capa(count);
+    long i;
+
+    for (i = 0; i < count; i++) {
+        VALUE rbPointer = rb_obj_alloc(rbffi_PointerClass);
+        callback_pointer_invalidate(rbPointer);
+        rb_ary_push(rbPointerArgs, rbPointer);
+    }
+
+    return rbPointerArgs;
+}
 
 static VALUE
 function_allocate(VALUE klass)
@@ -274,9 +724,11 @@ function_allocate(VALUE klass)
     obj = TypedData_Make_Struct(klass, Function, &function_data_type, fn);
 
     fn->base.memory.flags = MEM_RD;
+    fn->rbSelf = obj;
     RB_OBJ_WRITE(obj, &fn->base.rbParent, Qnil);
     RB_OBJ_WRITE(obj, &fn->rbProc, Qnil);
     RB_OBJ_WRITE(obj, &fn->rbFunctionInfo, Qnil);
+    RB_OBJ_WRITE(obj, &fn->rbPointerArgs, Qnil);
     fn->autorelease = true;
 
     return obj;
@@ -289,15 +741,18 @@ function_mark(void *data)
     rb_gc_mark_movable(fn->base.rbParent);
     rb_gc_mark_movable(fn->rbProc);
     rb_gc_mark_movable(fn->rbFunctionInfo);
+    rb_gc_mark_movable(fn->rbPointerArgs);
 }
 
 static void
 function_compact(void *data)
 {
     Function *fn = (Function *)data;
+    ffi_gc_location(fn->rbSelf);
     ffi_gc_location(fn->base.rbParent);
     ffi_gc_location(fn->rbProc);
     ffi_gc_location(fn->rbFunctionInfo);
+    ffi_gc_location(fn->rbPointerArgs);
 }
 
 static void
@@ -311,6 +766,10 @@ function_free(void *data)
     if (fn->closure != NULL && fn->autorelease) {
         rbffi_Closure_Free(fn->closure);
     }
+#if defined(DEFER_ASYNC_CALLBACK)
+    function_release_dispatchers(fn);
+#endif
+    free(fn->metrics);
 
     xfree(fn);
 }
@@ -325,6 +784,9 @@ function_memsize(const void *data)
     if (fn->closure) {
         memsize += sizeof(Closure);
     }
+    if (fn->metrics) {
+        memsize += sizeof(*fn->metrics);
+    }
 
     return memsize;
 }
@@ -377,7 +839,7 @@ function_initialize(int argc, VALUE* argv, VALUE self)
     infoArgv[0] = rbReturnType;
     infoArgv[1] = rbParamTypes;
     infoArgv[2] = rbOptions;
-    rbFunctionInfo = rb_class_new_instance(rbOptions != Qnil ? 3 : 2, infoArgv, rbffi_FunctionTypeClass);
+    rbFunctionInfo = rbffi_FunctionType_New(rbOptions != Qnil ? 3 : 2, infoArgv);
 
     function_init(self, rbFunctionInfo, rbProc);
 
@@ -439,72 +901,480 @@ rbffi_Function_ForProc(VALUE rbFunctionInfo, VALUE proc)
     return callback;
 }
 
-static VALUE
-function_init(VALUE self, VALUE rbFunctionInfo, VALUE rbProc)
+/*
+ * Returns a FFI::Function for a native function pointer, e.g. one returned from a C function.
+ *
+ * Libraries tend to hand out the same few function pointers over and over (vtables,
+ * plugin entry points, dlsym style lookups), so the Function instances are kept in a
+ * weak cache keyed by address and FunctionType.  Repeated returns of the same pointer
+ * then give the same callable back, including its already compiled MethodHandle.
+ *
+ * FunctionTypes are frozen and shared between Ractors, so the cache is not kept in the
+ * FunctionType, but in a WeakMap per Ractor.
+ */
+VALUE
+rbffi_Function_ForAddress(VALUE rbFunctionInfo, void* address)
 {
-    Function* fn = NULL;
+    /* WeakMap accepts Integer keys since ruby-2.7, the same release that brought rb_gc_mark_movable */
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    FunctionType* fnInfo;
+    Function* fp;
+    VALUE cache, key, fn;
+
+    TypedData_Get_Struct(rbFunctionInfo, FunctionType, &rbffi_fntype_data_type, fnInfo);
+
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    cache = rb_ractor_local_storage_value(function_cache_key);
+    if (cache == Qnil) {
+        cache = rb_class_new_instance(0, NULL, rbWeakMapClass);
+        rb_ractor_local_storage_value_set(function_cache_key, cache);
+    }
+#else
+    cache = function_cache;
+#endif
 
-    TypedData_Get_Struct(self, Function, &function_data_type, fn);
+    /* The FunctionType struct doesn't move, mix it in to tell signatures for one address apart */
+    key = ULL2NUM((uintptr_t) address ^ ((uintptr_t) fnInfo >> 3));
+    fn = rb_funcall2(cache, id_aref, 1, &key);
+    if (fn != Qnil) {
+        TypedData_Get_Struct(fn, Function, &function_data_type, fp);
+        if (fp->rbFunctionInfo == rbFunctionInfo && fp->base.memory.address == address) {
+            return fn;
+        }
+    }
 
-    RB_OBJ_WRITE(self, &fn->rbFunctionInfo, rbFunctionInfo);
+    fn = rbffi_Function_NewInstance(rbFunctionInfo, rbffi_Pointer_NewInstance(address));
+    rb_funcall(cache, id_aset, 2, key, fn);
 
-    TypedData_Get_Struct(fn->rbFunctionInfo, FunctionType, &rbffi_fntype_data_type, fn->info);
+    return fn;
+#else
+    return rbffi_Function_NewInstance(rbFunctionInfo, rbffi_Pointer_NewInstance(address));
+#endif
+}
 
-    if (rb_obj_is_kind_of(rbProc, rbffi_PointerClass)) {
-        Pointer* orig;
-        TypedData_Get_Struct(rbProc, Pointer, &rbffi_pointer_data_type, orig);
-        fn->base.memory = orig->memory;
-        RB_OBJ_WRITE(self, &fn->base.rbParent, rbProc);
+static const char*
+native_type_name(Type* type)
+{
+    static const char* names[] = {
+        "void", "int8", "uint8", "int16", "uint16", "int32", "uint32", "int64", "uint64",
+        "long", "ulong", "float", "double", "long_double", "pointer", "function",
+        "buffer_in", "buffer_out", "buffer_inout", "bool",
+    };
+
+    switch (type->nativeType) {
+        case NATIVE_STRING:
+            return "string";
+        case NATIVE_VARARGS:
+            return "varargs";
+        case NATIVE_STRUCT:
+            return "struct";
+        case NATIVE_ARRAY:
+            return "array";
+        case NATIVE_MAPPED:
+            return native_type_name(((MappedType *) type)->type);
+        default:
+            return (int) type->nativeType < (int) (sizeof(names) / sizeof(names[0]))
+                ? names[type->nativeType] : "unknown";
+    }
+}
 
-    } else if (rb_obj_is_kind_of(rbProc, rb_cProc) || rb_respond_to(rbProc, id_call)) {
-        if (fn->info->closurePool == NULL) {
-            fn->info->closurePool = rbffi_ClosurePool_New(sizeof(ffi_closure), callback_prep, fn->info);
-            if (fn->info->closurePool == NULL) {
-                rb_raise(rb_eNoMemError, "failed to create closure pool");
-            }
-        }
+/* The signature of the closures of fnInfo like "int32 (pointer, pointer)", for FFI.closure_pool_stats */
+void
+rbffi_FunctionType_Signature(FunctionType* fnInfo, char* buf, size_t size)
+{
+    size_t len;
+    int i;
 
-#if defined(DEFER_ASYNC_CALLBACK)
-        fn->dispatcher = async_cb_dispatcher_ensure_created();
-#endif
+    snprintf(buf, size, "%s (", native_type_name(fnInfo->returnType));
+    for (i = 0; i < fnInfo->parameterCount; i++) {
+        len = strlen(buf);
+        snprintf(buf + len, size - len, "%s%s", i > 0 ? ", " : "", native_type_name(fnInfo->parameterTypes[i]));
+    }
+    len = strlen(buf);
+    snprintf(buf + len, size - len, ")");
+}
 
-        fn->closure = rbffi_Closure_Alloc(fn->info->closurePool);
-        fn->closure->info = fn;
-        fn->base.memory.address = fn->closure->code;
-        fn->base.memory.size = sizeof(*fn->closure);
-        fn->autorelease = true;
+static ClosurePool*
+function_closure_pool(FunctionType* fnInfo)
+{
+    char name[96];
 
-    } else {
-        rb_raise(rb_eTypeError, "wrong argument type %s, expected pointer or proc",
-                rb_obj_classname(rbProc));
+    if (fnInfo->closurePool != NULL) {
+        return fnInfo->closurePool;
     }
 
-    RB_OBJ_WRITE(self, &fn->rbProc, rbProc);
+    /* FunctionTypes are shared between Ractors, which might race to create the pool */
+    rbffi_FunctionType_Signature(fnInfo, name, sizeof(name));
+    if (rbffi_ClosurePool_Get(&fnInfo->closurePool, sizeof(ffi_closure), callback_prep, fnInfo, name) == NULL) {
+        rb_raise(rb_eNoMemError, "failed to create closure pool");
+    }
 
-    return self;
+    return fnInfo->closurePool;
 }
 
 /*
- * call-seq: call(*args)
- * @param [Array] args function arguments
- * @return [FFI::Type]
- * Call the function
+ * call-seq: reserve_closures(count)
+ * @param [Integer] count number of closures
+ * @return [self]
+ * Preallocate the closures of +count+ callbacks of this type, so that creating them
+ * doesn't need to allocate executable memory.  The reserved closures are also kept
+ * when unused pages of the pool are given back to the system.
  */
 static VALUE
-function_call(int argc, VALUE* argv, VALUE self)
+fntype_reserve_closures(VALUE self, VALUE count)
 {
-    Function* fn;
+    FunctionType* fnInfo;
+    long n = NUM2LONG(count);
 
-    TypedData_Get_Struct(self, Function, &function_data_type, fn);
+    TypedData_Get_Struct(self, FunctionType, &rbffi_fntype_data_type, fnInfo);
+    if (n < 0) {
+        rb_raise(rb_eArgError, "negative number of closures (%ld)", n);
+    }
+    rbffi_ClosurePool_Reserve(function_closure_pool(fnInfo), n);
 
-    return (*fn->info->invoke)(argc, argv, fn->base.memory.address, fn->info);
+    return self;
 }
 
+#if defined(DEFER_ASYNC_CALLBACK)
 /*
- * call-seq: attach(m, name)
- * @param [Module] m
- * @param [String] name
- * @return [self]
+ * Native threads might still be about to queue a callback to the dispatcher a
+ * Function was bound to before, so it is kept referenced until the Function is freed.
+ */
+struct async_cb_retired {
+    struct async_cb_dispatcher *dispatcher;
+    struct async_cb_retired *next;
+};
+
+static void
+function_retire_dispatcher(Function* fn, struct async_cb_dispatcher *ctx)
+{
+    struct async_cb_retired *retired, *head;
+
+    /* Nodes are only removed by function_free(), so the list can be walked while others push */
+    for (retired = fn->retired; retired != NULL; retired = retired->next) {
+        if (retired->dispatcher == ctx) {
+            async_cb_dispatcher_unref(ctx);
+            return;
+        }
+    }
+
+    retired = ALLOC(struct async_cb_retired);
+    retired->dispatcher = ctx;
+# ifdef _MSC_VER
+    do {
+        head = fn->retired;
+        retired->next = head;
+    } while (InterlockedCompareExchangePointer((PVOID volatile *) &fn->retired, retired, head) != head);
+# else
+    head = __atomic_load_n(&fn->retired, __ATOMIC_RELAXED);
+    do {
+        retired->next = head;
+    } while (!__atomic_compare_exchange_n(&fn->retired, &head, retired, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+# endif
+}
+
+static void
+function_release_dispatchers(Function* fn)
+{
+    struct async_cb_retired *retired = fn->retired;
+
+    if (fn->dispatcher != NULL) {
+        async_cb_dispatcher_unref(fn->dispatcher);
+    }
+    while (retired != NULL) {
+        struct async_cb_retired *next = retired->next;
+        async_cb_dispatcher_unref(retired->dispatcher);
+        xfree(retired);
+        retired = next;
+    }
+    fn->dispatcher = NULL;
+    fn->retired = NULL;
+}
+
+/* The dispatcher fn is bound to, which another Ractor might replace at any time */
+static struct async_cb_dispatcher *
+function_dispatcher(Function* fn)
+{
+# ifdef _MSC_VER
+    return InterlockedCompareExchangePointer((PVOID volatile *) &fn->dispatcher, NULL, NULL);
+# else
+    return __atomic_load_n(&fn->dispatcher, __ATOMIC_ACQUIRE);
+# endif
+}
+
+/* Run the callbacks of fn from native threads in the current Ractor */
+static void
+function_bind_dispatcher(Function* fn)
+{
+    struct async_cb_dispatcher *ctx = async_cb_dispatcher_ensure_created();
+    struct async_cb_dispatcher *old;
+
+    if (ctx == function_dispatcher(fn)) {
+        return;
+    }
+    /* Shareable Functions might be bound by several Ractors at once */
+    async_cb_dispatcher_ref(ctx);
+# ifdef _MSC_VER
+    old = InterlockedExchangePointer((PVOID volatile *) &fn->dispatcher, ctx);
+# else
+    old = __atomic_exchange_n(&fn->dispatcher, ctx, __ATOMIC_ACQ_REL);
+# endif
+    if (old != NULL) {
+        function_retire_dispatcher(fn, old);
+    }
+}
+#endif
+
+static void
+function_closure_alloc(Function* fn)
+{
+    function_closure_pool(fn->info);
+
+#if defined(DEFER_ASYNC_CALLBACK)
+    function_bind_dispatcher(fn);
+#endif
+
+    fn->closure = rbffi_Closure_Alloc(fn->info->closurePool);
+    fn->closure->info = fn;
+}
+
+static VALUE
+function_init(VALUE self, VALUE rbFunctionInfo, VALUE rbProc)
+{
+    Function* fn = NULL;
+
+    TypedData_Get_Struct(self, Function, &function_data_type, fn);
+
+    RB_OBJ_WRITE(self, &fn->rbFunctionInfo, rbFunctionInfo);
+
+    TypedData_Get_Struct(fn->rbFunctionInfo, FunctionType, &rbffi_fntype_data_type, fn->info);
+
+    if (rb_obj_is_kind_of(rbProc, rbffi_PointerClass)) {
+        Pointer* orig;
+        TypedData_Get_Struct(rbProc, Pointer, &rbffi_pointer_data_type, orig);
+        fn->base.memory = orig->memory;
+        RB_OBJ_WRITE(self, &fn->base.rbParent, rbProc);
+
+    } else if (rb_obj_is_kind_of(rbProc, rb_cProc) || rb_respond_to(rbProc, id_call)) {
+        function_closure_alloc(fn);
+        fn->base.memory.address = fn->closure->code;
+        fn->base.memory.size = sizeof(*fn->closure);
+        fn->autorelease = true;
+
+        if (fn->info->callbackPointerCount > 0) {
+            RB_OBJ_WRITE(self, &fn->rbPointerArgs, callback_pointer_args_new(fn->info->callbackPointerCount));
+        }
+
+    } else {
+        rb_raise(rb_eTypeError, "wrong argument type %s, expected pointer or proc",
+                rb_obj_classname(rbProc));
+    }
+
+    RB_OBJ_WRITE(self, &fn->rbProc, rbProc);
+
+    return self;
+}
+
+/*
+ * Bindings of procs to callbacks declared with scope: :call.
+ *
+ * Such a proc is only invoked while the function it was passed to runs, so instead of
+ * wrapping it into a Function object, it is bound to a native trampoline that is reused
+ * from call to call.  The binding embeds a Function struct that is not a ruby object.
+ * FunctionTypes are shared between Ractors, so each Ractor keeps its own table of
+ * bindings per FunctionType.  Nested calls use further bindings, of which up to
+ * SCOPED_CALLBACKS_IDLE_MAX per type are kept for reuse.
+ */
+#define SCOPED_CALLBACKS_IDLE_MAX (8)
+
+typedef struct ScopedCallback_ {
+    Function fn;
+    bool busy;
+    struct ScopedCallback_* next;
+} ScopedCallback;
+
+static int
+scoped_callbacks_mark_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    ScopedCallback* scb;
+
+    for (scb = (ScopedCallback *) value; scb != NULL; scb = scb->next) {
+        rb_gc_mark(scb->fn.rbFunctionInfo);
+        rb_gc_mark(scb->fn.rbPointerArgs);
+        rb_gc_mark(scb->fn.rbProc);
+    }
+
+    return ST_CONTINUE;
+}
+
+static void
+scoped_callbacks_mark(void* ptr)
+{
+    if (ptr != NULL) {
+        st_foreach((st_table *) ptr, scoped_callbacks_mark_i, 0);
+    }
+}
+
+static void
+scoped_callback_free(ScopedCallback* scb)
+{
+    rbffi_Closure_Free(scb->fn.closure);
+#if defined(DEFER_ASYNC_CALLBACK)
+    function_release_dispatchers(&scb->fn);
+#endif
+    free(scb->fn.metrics);
+    xfree(scb);
+}
+
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+static int
+scoped_callbacks_free_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    ScopedCallback* scb = (ScopedCallback *) value;
+
+    while (scb != NULL) {
+        ScopedCallback* next = scb->next;
+        scoped_callback_free(scb);
+        scb = next;
+    }
+
+    return ST_CONTINUE;
+}
+
+static void
+scoped_callbacks_free(void* ptr)
+{
+    if (ptr != NULL) {
+        st_foreach((st_table *) ptr, scoped_callbacks_free_i, 0);
+        st_free_table((st_table *) ptr);
+    }
+}
+
+static struct rb_ractor_local_storage_type scoped_callbacks_key_type = {
+    scoped_callbacks_mark,
+    scoped_callbacks_free,
+};
+
+static rb_ractor_local_key_t scoped_callbacks_key;
+#endif
+
+/* The bindings of the current Ractor, by FunctionType */
+static st_table*
+scoped_callbacks(void)
+{
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    st_table* table = (st_table *) rb_ractor_local_storage_ptr(scoped_callbacks_key);
+
+    if (table == NULL) {
+        table = st_init_numtable();
+        rb_ractor_local_storage_ptr_set(scoped_callbacks_key, table);
+    }
+#else
+    static st_table* table = NULL;
+
+    if (table == NULL) {
+        table = st_init_numtable();
+        /* The table lives until the process exits, mark it through a hidden object */
+        rb_gc_register_mark_object(Data_Wrap_Struct(0, scoped_callbacks_mark, NULL, table));
+    }
+#endif
+    return table;
+}
+
+/*
+ * Bind proc to a free trampoline of cbInfo and return its native address.
+ * Returns NULL if no binding can be used, in which case a Function has to be created.
+ */
+void*
+rbffi_Function_BindScoped(VALUE rbFunctionInfo, FunctionType* cbInfo, VALUE proc)
+{
+    st_table* table = scoped_callbacks();
+    st_data_t head = 0;
+    ScopedCallback* scb;
+
+    st_lookup(table, (st_data_t) cbInfo, &head);
+    for (scb = (ScopedCallback *) head; scb != NULL && scb->busy; scb = scb->next);
+
+    if (scb == NULL) {
+        scb = ALLOC(ScopedCallback);
+        memset(scb, 0, sizeof(*scb));
+        scb->fn.info = cbInfo;
+        scb->fn.rbSelf = Qnil;
+        scb->fn.rbFunctionInfo = rbFunctionInfo;
+        scb->fn.rbPointerArgs = Qnil;
+        scb->fn.rbProc = Qnil;
+        scb->fn.base.rbParent = Qnil;
+        function_closure_alloc(&scb->fn);
+        if (cbInfo->callbackPointerCount > 0) {
+            scb->fn.rbPointerArgs = callback_pointer_args_new(cbInfo->callbackPointerCount);
+        }
+        scb->fn.base.memory.address = scb->fn.closure->code;
+        scb->fn.base.memory.size = sizeof(*scb->fn.closure);
+        scb->next = (ScopedCallback *) head;
+        st_insert(table, (st_data_t) cbInfo, (st_data_t) scb);
+    }
+
+    scb->busy = true;
+    scb->fn.rbProc = proc;
+
+    return scb->fn.closure->code;
+}
+
+/*
+ * Return the binding of the trampoline at code to cbInfo.
+ * Addresses that don't belong to a busy binding are ignored.
+ */
+void
+rbffi_Function_ReleaseScoped(FunctionType* cbInfo, void* code)
+{
+    st_table* table = scoped_callbacks();
+    st_data_t head = 0;
+    ScopedCallback *scb, **link;
+    long idle = 0;
+
+    if (code == NULL || !st_lookup(table, (st_data_t) cbInfo, &head)) {
+        return;
+    }
+
+    for (scb = (ScopedCallback *) head; scb != NULL; scb = scb->next) {
+        idle += scb->busy ? 0 : 1;
+    }
+
+    for (link = (ScopedCallback **) &head; (scb = *link) != NULL; link = &scb->next) {
+        if (scb->busy && scb->fn.closure->code == code) {
+            scb->busy = false;
+            scb->fn.rbProc = Qnil;
+            if (idle >= SCOPED_CALLBACKS_IDLE_MAX) {
+                *link = scb->next;
+                st_insert(table, (st_data_t) cbInfo, head);
+                scoped_callback_free(scb);
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * call-seq: call(*args)
+ * @param [Array] args function arguments
+ * @return [FFI::Type]
+ * Call the function
+ */
+static VALUE
+function_call(int argc, VALUE* argv, VALUE self)
+{
+    Function* fn;
+
+    TypedData_Get_Struct(self, Function, &function_data_type, fn);
+
+    return (*fn->info->invoke)(argc, argv, fn->base.memory.address, fn->info);
+}
+
+/*
+ * call-seq: attach(m, name)
+ * @param [Module] m
+ * @param [String] name
+ * @return [self]
  * Attach a Function to the Module +m+ as +name+.
  */
 static VALUE
@@ -568,6 +1438,141 @@ function_autorelease_p(VALUE self)
     return fn->autorelease ? Qtrue : Qfalse;
 }
 
+/*
+ * call-seq: bind_ractor
+ * @return [self]
+ * Run the callback in the current Ractor when it's called from native threads,
+ * instead of the Ractor it was created in.  Independent native event sources
+ * can so be processed in parallel, each by a Function bound to its own Ractor.
+ *
+ * Functions are passed to other Ractors after +Ractor.make_shareable+, which
+ * requires the proc to be shareable.  Calls from ruby threads always run on the
+ * calling thread.  Once the Ractor terminated, calls from native threads return
+ * zero without running the callback.
+ */
+static VALUE
+function_bind_ractor(VALUE self)
+{
+    Function* fn;
+
+    TypedData_Get_Struct(self, Function, &function_data_type, fn);
+
+    if (fn->closure == NULL) {
+        rb_raise(rb_eRuntimeError, "cannot bind function which was not allocated");
+    }
+#if defined(DEFER_ASYNC_CALLBACK)
+    function_bind_dispatcher(fn);
+#endif
+
+    return self;
+}
+
+/*
+ * call-seq: ractor
+ * @return [Ractor, nil] the Ractor running the callback when it's called from native threads,
+ *   +nil+ if it isn't a callback or Ractors aren't supported
+ */
+static VALUE
+function_ractor(VALUE self)
+{
+    Function* fn;
+#if defined(DEFER_ASYNC_CALLBACK)
+    struct async_cb_dispatcher *ctx;
+#endif
+
+    TypedData_Get_Struct(self, Function, &function_data_type, fn);
+
+#if defined(DEFER_ASYNC_CALLBACK)
+    ctx = function_dispatcher(fn);
+    if (ctx != NULL && !async_cb_dispatcher_dead(ctx)) {
+        return ctx->ractor;
+    }
+#endif
+
+    return Qnil;
+}
+
+static VALUE
+callback_phase_hash(const struct callback_phase* phase)
+{
+    VALUE rbHash = rb_hash_new();
+    VALUE rbHistogram;
+    int last = CALLBACK_METRICS_BUCKETS, i;
+
+    while (last > 0 && phase->histogram[last - 1] == 0) {
+        last--;
+    }
+    rbHistogram = rb_ary_new_capa(last);
+    for (i = 0; i < last; i++) {
+        rb_ary_push(rbHistogram, ULL2NUM(phase->histogram[i]));
+    }
+
+    rb_hash_aset(rbHash, ID2SYM(rb_intern("count")), ULL2NUM(phase->count));
+    rb_hash_aset(rbHash, ID2SYM(rb_intern("total_ns")), ULL2NUM(phase->total));
+    rb_hash_aset(rbHash, ID2SYM(rb_intern("max_ns")), ULL2NUM(phase->max));
+    rb_hash_aset(rbHash, ID2SYM(rb_intern("histogram")), rbHistogram);
+
+    return rbHash;
+}
+
+/*
+ * call-seq: metrics
+ * @return [Hash, nil] latency metrics of the calls of this callback, +nil+ if none were recorded
+ * Metrics are recorded while {FFI.callback_metrics=} is enabled.  The hash has an entry
+ * per phase of a call:
+ * * +:queue+ - calls from native threads waiting for the callback dispatcher
+ * * +:gvl+ - calls from threads without the GVL waiting to acquire it
+ * * +:ruby+ - running the proc, including the conversion of arguments and return value
+ *
+ * Each is a Hash with +:count+, +:total_ns+, +:max_ns+ and +:histogram+.  Element +i+
+ * of the histogram counts the durations below 2**i nanoseconds, which didn't fit into
+ * the previous elements.  Trailing empty elements are omitted.
+ */
+static VALUE
+function_metrics(VALUE self)
+{
+    Function* fn;
+    struct callback_metrics metrics;
+    VALUE rbHash;
+
+    TypedData_Get_Struct(self, Function, &function_data_type, fn);
+
+    rb_nativethread_lock_lock(&callback_metrics_lock);
+    if (fn->metrics == NULL) {
+        rb_nativethread_lock_unlock(&callback_metrics_lock);
+        return Qnil;
+    }
+    metrics = *fn->metrics;
+    rb_nativethread_lock_unlock(&callback_metrics_lock);
+
+    rbHash = rb_hash_new();
+    rb_hash_aset(rbHash, ID2SYM(rb_intern("queue")), callback_phase_hash(&metrics.phases[CALLBACK_PHASE_QUEUE]));
+    rb_hash_aset(rbHash, ID2SYM(rb_intern("gvl")), callback_phase_hash(&metrics.phases[CALLBACK_PHASE_GVL]));
+    rb_hash_aset(rbHash, ID2SYM(rb_intern("ruby")), callback_phase_hash(&metrics.phases[CALLBACK_PHASE_RUBY]));
+
+    return rbHash;
+}
+
+/*
+ * call-seq: reset_metrics
+ * @return [self]
+ * Discard the metrics recorded so far.
+ */
+static VALUE
+function_reset_metrics(VALUE self)
+{
+    Function* fn;
+
+    TypedData_Get_Struct(self, Function, &function_data_type, fn);
+
+    rb_nativethread_lock_lock(&callback_metrics_lock);
+    free(fn->metrics);
+    fn->metrics = NULL;
+    rb_nativethread_lock_unlock(&callback_metrics_lock);
+
+    return self;
+}
+
 static VALUE
 function_type(VALUE self)
 {
@@ -600,6 +1605,230 @@ function_release(VALUE self)
     return self;
 }
 
+#if defined(DEFER_ASYNC_CALLBACK)
+static unsigned int
+async_cb_origin(void)
+{
+# ifndef _WIN32
+    pthread_t self = pthread_self();
+    uint64_t key = 0;
+
+    memcpy(&key, &self, sizeof(self) < sizeof(key) ? sizeof(self) : sizeof(key));
+# else
+    uint64_t key = GetCurrentThreadId();
+# endif
+    /* thread ids are mostly aligned addresses, so mix the bits before taking a slot */
+    return (unsigned int) ((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static bool
+async_cb_is_string(Type* type)
+{
+    if (type->nativeType == NATIVE_MAPPED) {
+        type = ((MappedType *) type)->type;
+    }
+    return type->nativeType == NATIVE_STRING;
+}
+
+/*
+ * Native threads push onto ctx->async_cb_list with a CAS, the dispatcher
+ * takes all entries at once.  As entries are only ever removed all together
+ * there is no ABA problem.  Returns true if the list was empty before.
+ */
+static bool
+async_cb_list_push(struct async_cb_dispatcher *ctx, struct gvl_callback *cb)
+{
+    struct gvl_callback *head;
+# ifdef _MSC_VER
+    do {
+        head = ctx->async_cb_list;
+        cb->next = head;
+    } while (InterlockedCompareExchangePointer((PVOID volatile *) &ctx->async_cb_list, cb, head) != head);
+# else
+    head = __atomic_load_n(&ctx->async_cb_list, __ATOMIC_RELAXED);
+    do {
+        cb->next = head;
+    } while (!__atomic_compare_exchange_n(&ctx->async_cb_list, &head, cb, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+# endif
+    return head == NULL;
+}
+
+/* Take all pending callbacks, oldest first */
+static struct gvl_callback *
+async_cb_list_take(struct async_cb_dispatcher *ctx)
+{
+    struct gvl_callback *list, *fifo = NULL;
+# ifdef _MSC_VER
+    list = (struct gvl_callback *) InterlockedExchangePointer((PVOID volatile *) &ctx->async_cb_list, NULL);
+# else
+    list = __atomic_exchange_n(&ctx->async_cb_list, NULL, __ATOMIC_ACQUIRE);
+# endif
+    while (list != NULL) {
+        struct gvl_callback *next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+    }
+    return fifo;
+}
+
+static void
+async_cb_list_add(struct async_cb_dispatcher *ctx, struct gvl_callback *cb)
+{
+    /* Only the first entry of a batch has to wake up the dispatcher, it
+     * checks the list with async_cb_mutex held before going to sleep. */
+    if (async_cb_list_push(ctx, cb)) {
+# ifndef _WIN32
+        pthread_mutex_lock(&ctx->async_cb_mutex);
+        pthread_cond_signal(&ctx->async_cb_cond);
+        pthread_mutex_unlock(&ctx->async_cb_mutex);
+# else
+        SetEvent(ctx->async_cb_cond);
+# endif
+    }
+
+    /* The Ractor might have terminated since the caller checked, nobody takes the list then */
+# ifdef _MSC_VER
+    MemoryBarrier();
+# else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+# endif
+    if (async_cb_dispatcher_dead(ctx)) {
+        async_cb_abandon(ctx);
+    }
+}
+
+/*
+ * Queue a copy of a void callback, including its arguments and strings,
+ * so that the native thread can return without waiting for ruby.  Returns
+ * false if the copy can't be allocated.
+ */
+static bool
+async_cb_detach(struct async_cb_dispatcher *ctx, const struct gvl_callback *cb)
+{
+    FunctionType* info = ((Function *) cb->closure->info)->info;
+    struct gvl_callback* copy;
+    void** parameters;
+    size_t size, offset;
+    char* storage;
+    int i;
+
+    /* callback, pointers to the arguments, void retval, arguments, strings */
+    size = sizeof(*copy) + info->parameterCount * sizeof(void *) + sizeof(ffi_arg);
+    for (i = 0; i < info->parameterCount; i++) {
+        ffi_type* type = info->ffiParameterTypes[i];
+        size = FFI_ALIGN(size, type->alignment) + type->size;
+    }
+    for (i = 0; i < info->parameterCount; i++) {
+        if (async_cb_is_string(info->parameterTypes[i]) && *(char **) cb->parameters[i] != NULL) {
+            size += strlen(*(char **) cb->parameters[i]) + 1;
+        }
+    }
+
+    /* No GVL here, so ruby's allocator can't be used */
+    storage = (char *) malloc(size);
+    if (storage == NULL) {
+        return false;
+    }
+
+    copy = (struct gvl_callback *) storage;
+    *copy = *cb;
+    copy->detached = true;
+    copy->frame = NULL;
+    parameters = copy->parameters = (void **) (storage + sizeof(*copy));
+    offset = sizeof(*copy) + info->parameterCount * sizeof(void *);
+    copy->retval = storage + offset;
+    offset += sizeof(ffi_arg);
+
+    for (i = 0; i < info->parameterCount; i++) {
+        ffi_type* type = info->ffiParameterTypes[i];
+        offset = FFI_ALIGN(offset, type->alignment);
+        parameters[i] = storage + offset;
+        memcpy(parameters[i], cb->parameters[i], type->size);
+        offset += type->size;
+    }
+    for (i = 0; i < info->parameterCount; i++) {
+        const char* str = *(char **) cb->parameters[i];
+        if (async_cb_is_string(info->parameterTypes[i]) && str != NULL) {
+            size_t len = strlen(str) + 1;
+            memcpy(storage + offset, str, len);
+            *(char **) parameters[i] = storage + offset;
+            offset += len;
+        }
+    }
+
+    /* Nothing else references the Function once the native thread returned */
+    copy->dispatcher = async_cb_dispatcher_ref(ctx);
+    rb_nativethread_lock_lock(&ctx->detached_lock);
+    copy->detached_prev = NULL;
+    copy->detached_next = ctx->detached_list;
+    if (ctx->detached_list != NULL) {
+        ctx->detached_list->detached_prev = copy;
+    }
+    ctx->detached_list = copy;
+    rb_nativethread_lock_unlock(&ctx->detached_lock);
+
+    async_cb_list_add(ctx, copy);
+
+    return true;
+}
+
+# ifndef _WIN32
+static void
+async_cb_waiter_free(void *data)
+{
+    struct async_cb_waiter *waiter = (struct async_cb_waiter *) data;
+
+    pthread_cond_destroy(&waiter->cond);
+    pthread_mutex_destroy(&waiter->mutex);
+    free(waiter);
+}
+
+static struct async_cb_waiter *
+async_cb_waiter_get(void)
+{
+    struct async_cb_waiter *waiter = (struct async_cb_waiter *) pthread_getspecific(async_cb_waiter_key);
+
+    if (waiter == NULL) {
+        /* No GVL here, so ruby's allocator can't be used */
+        waiter = (struct async_cb_waiter *) malloc(sizeof(*waiter));
+        if (waiter == NULL) {
+            return NULL;
+        }
+        pthread_mutex_init(&waiter->mutex, NULL);
+        pthread_cond_init(&waiter->cond, NULL);
+        if (pthread_setspecific(async_cb_waiter_key, waiter) != 0) {
+            async_cb_waiter_free(waiter);
+            return NULL;
+        }
+    }
+
+    return waiter;
+}
+# else
+static VOID WINAPI
+async_cb_event_free(PVOID data)
+{
+    if (data != NULL) {
+        CloseHandle((HANDLE) data);
+    }
+}
+
+static HANDLE
+async_cb_event_get(void)
+{
+    HANDLE event = (HANDLE) FlsGetValue(async_cb_event_slot);
+
+    if (event == NULL) {
+        event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        FlsSetValue(async_cb_event_slot, event);
+    }
+
+    return event;
+}
+# endif
+#endif
+
 static void
 callback_invoke(ffi_cif* cif, void* retval, void** parameters, void* user_data)
 {
@@ -614,58 +1843,64 @@ callback_invoke(ffi_cif* cif, void* retval, void** parameters, void* user_data)
     fn = (Function *) cb.closure->info;
 
     if (cb.frame != NULL) cb.frame->exc = Qnil;
+    cb.timed = callback_metrics_enabled;
 
     if (ruby_native_thread_p()) {
       if(ruby_thread_has_gvl_p()) {
         callback_with_gvl(&cb);
       } else {
+        if (cb.timed) cb.waiting = callback_metrics_now();
         rb_thread_call_with_gvl(callback_with_gvl, &cb);
       }
-#if defined(DEFER_ASYNC_CALLBACK) && !defined(_WIN32)
+#if defined(DEFER_ASYNC_CALLBACK)
     } else {
-        bool empty = false;
-        struct async_cb_dispatcher *ctx = fn->dispatcher;
-
-        pthread_mutex_init(&cb.async_mutex, NULL);
-        pthread_cond_init(&cb.async_cond, NULL);
-
-        /* Now signal the async callback dispatcher thread */
-        pthread_mutex_lock(&ctx->async_cb_mutex);
-        empty = ctx->async_cb_list == NULL;
-        cb.next = ctx->async_cb_list;
-        ctx->async_cb_list = &cb;
-
-        pthread_cond_signal(&ctx->async_cb_cond);
-        pthread_mutex_unlock(&ctx->async_cb_mutex);
+        /* Use the same dispatcher throughout, even if the Function is rebound meanwhile */
+        struct async_cb_dispatcher *ctx = function_dispatcher(fn);
+# ifndef _WIN32
+        struct async_cb_waiter local;
+# endif
 
-        /* Wait for the thread executing the ruby callback to signal it is done */
-        pthread_mutex_lock(&cb.async_mutex);
-        while (!cb.done) {
-            pthread_cond_wait(&cb.async_cond, &cb.async_mutex);
+        cb.origin = async_cb_origin();
+        if (async_cb_dispatcher_dead(ctx)) {
+            ffi_type* returnType = fn->info->ffiReturnType;
+            memset(retval, 0, returnType->size > sizeof(ffi_arg) ? returnType->size : sizeof(ffi_arg));
+            return;
+        }
+        if (cb.timed) cb.queued = callback_metrics_now();
+        if (fn->info->asyncDetached && async_cb_detach(ctx, &cb)) {
+            return;
         }
-        pthread_mutex_unlock(&cb.async_mutex);
-        pthread_cond_destroy(&cb.async_cond);
-        pthread_mutex_destroy(&cb.async_mutex);
 
-#elif defined(DEFER_ASYNC_CALLBACK) && defined(_WIN32)
-    } else {
-        bool empty = false;
-        struct async_cb_dispatcher *ctx = fn->dispatcher;
+# ifndef _WIN32
 
-        cb.async_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        cb.waiter = async_cb_waiter_get();
+        if (cb.waiter == NULL) {
+            pthread_mutex_init(&local.mutex, NULL);
+            pthread_cond_init(&local.cond, NULL);
+            cb.waiter = &local;
+        }
+# else
+        cb.async_event = async_cb_event_get();
+# endif
 
         /* Now signal the async callback dispatcher thread */
-        EnterCriticalSection(&ctx->async_cb_lock);
-        empty = ctx->async_cb_list == NULL;
-        cb.next = ctx->async_cb_list;
-        ctx->async_cb_list = &cb;
-        LeaveCriticalSection(&ctx->async_cb_lock);
-
-        SetEvent(ctx->async_cb_cond);
+        async_cb_list_add(ctx, &cb);
 
         /* Wait for the thread executing the ruby callback to signal it is done */
+# ifndef _WIN32
+        pthread_mutex_lock(&cb.waiter->mutex);
+        while (!cb.done) {
+            pthread_cond_wait(&cb.waiter->cond, &cb.waiter->mutex);
+        }
+        pthread_mutex_unlock(&cb.waiter->mutex);
+
+        if (cb.waiter == &local) {
+            pthread_cond_destroy(&local.cond);
+            pthread_mutex_destroy(&local.mutex);
+        }
+# else
         WaitForSingleObject(cb.async_event, INFINITE);
-        CloseHandle(cb.async_event);
+# endif
 #endif
     }
 }
@@ -673,12 +1908,61 @@ callback_invoke(ffi_cif* cif, void* retval, void** parameters, void* user_data)
 #if defined(DEFER_ASYNC_CALLBACK)
 struct async_wait {
     struct async_cb_dispatcher *dispatcher;
-    void* cb;
+    struct gvl_callback* cb;
     bool stop;
 };
 
 static void * async_cb_wait(void *);
 static void async_cb_stop(void *);
+static void async_cb_dispatch(struct async_cb_dispatcher *, struct gvl_callback *);
+
+/* Callbacks taken from the list leave the queue phase and wait for the GVL */
+static void
+async_cb_taken(struct gvl_callback *list)
+{
+    uint64_t now = 0;
+
+    for (; list != NULL; list = list->next) {
+        if (list->timed) {
+            list->waiting = now != 0 ? now : (now = callback_metrics_now());
+        }
+    }
+}
+
+static VALUE
+async_cb_event_loop(VALUE data)
+{
+    struct async_wait* w = (struct async_wait *) data;
+
+    while (!w->stop) {
+        rb_thread_call_without_gvl(async_cb_wait, w, async_cb_stop, w);
+        /* Hand over the whole batch, in the order the callbacks were issued */
+        while (w->cb != NULL) {
+            struct gvl_callback* cb = w->cb;
+            w->cb = cb->next;
+            async_cb_dispatch(w->dispatcher, cb);
+        }
+    }
+
+    return Qnil;
+}
+
+static VALUE
+async_cb_event_exit(VALUE data)
+{
+    struct async_wait* w = (struct async_wait *) data;
+
+    /* The Ractor terminates, callbacks of the batch not handed over yet can't run anymore */
+    while (w->cb != NULL) {
+        struct gvl_callback* cb = w->cb;
+        w->cb = cb->next;
+        cb->next = NULL;
+        async_cb_list_push(w->dispatcher, cb);
+    }
+    async_cb_dispatcher_kill(w->dispatcher);
+
+    return Qnil;
+}
 
 static VALUE
 async_cb_event(void* ptr)
@@ -686,115 +1970,347 @@ async_cb_event(void* ptr)
     struct async_cb_dispatcher *ctx = (struct async_cb_dispatcher *)ptr;
     struct async_wait w = { ctx };
 
-    w.stop = false;
-    while (!w.stop) {
-        rb_thread_call_without_gvl(async_cb_wait, &w, async_cb_stop, &w);
-        if (w.cb != NULL) {
-            /* Start up a new ruby thread to run the ruby callback */
-            VALUE new_thread = rb_thread_create(async_cb_call, w.cb);
-            /* Name thread, for better debugging */
-            rb_funcall(new_thread, rb_intern("name="), 1, rb_str_new2("FFI Callback Runner"));
-        }
+    w.cb = NULL;
+    w.stop = false;
+
+    return rb_ensure(async_cb_event_loop, (VALUE) &w, async_cb_event_exit, (VALUE) &w);
+}
+
+#ifdef _WIN32
+static void *
+async_cb_wait(void *data)
+{
+    struct async_wait* w = (struct async_wait *) data;
+    struct async_cb_dispatcher *ctx = w->dispatcher;
+
+    while (!w->stop && (w->cb = async_cb_list_take(ctx)) == NULL) {
+        WaitForSingleObject(ctx->async_cb_cond, INFINITE);
+    }
+    async_cb_taken(w->cb);
+
+    return NULL;
+}
+
+static void
+async_cb_stop(void *data)
+{
+    struct async_wait* w = (struct async_wait *) data;
+    struct async_cb_dispatcher *ctx = w->dispatcher;
+
+    EnterCriticalSection(&ctx->async_cb_lock);
+    w->stop = true;
+    LeaveCriticalSection(&ctx->async_cb_lock);
+    SetEvent(ctx->async_cb_cond);
+}
+
+#else
+static void *
+async_cb_wait(void *data)
+{
+    struct async_wait* w = (struct async_wait *) data;
+    struct async_cb_dispatcher *ctx = w->dispatcher;
+
+    pthread_mutex_lock(&ctx->async_cb_mutex);
+
+    while (!w->stop && (w->cb = async_cb_list_take(ctx)) == NULL) {
+        pthread_cond_wait(&ctx->async_cb_cond, &ctx->async_cb_mutex);
+    }
+
+    pthread_mutex_unlock(&ctx->async_cb_mutex);
+    async_cb_taken(w->cb);
+
+    return NULL;
+}
+
+static void
+async_cb_stop(void *data)
+{
+    struct async_wait* w = (struct async_wait *) data;
+    struct async_cb_dispatcher *ctx = w->dispatcher;
+
+    pthread_mutex_lock(&ctx->async_cb_mutex);
+    w->stop = true;
+    pthread_cond_signal(&ctx->async_cb_cond);
+    pthread_mutex_unlock(&ctx->async_cb_mutex);
+}
+#endif
+
+static struct async_cb_runner *
+async_cb_runner_new(struct async_cb_dispatcher *ctx, long slot)
+{
+    struct async_cb_runner *runner = ALLOC(struct async_cb_runner);
+
+    runner->dispatcher = ctx;
+    runner->thread = Qnil;
+    runner->slot = slot;
+    runner->head = runner->tail = runner->cb = NULL;
+    runner->busy = runner->stop = runner->dead = false;
+#ifndef _WIN32
+    pthread_cond_init(&runner->cond, NULL);
+#else
+    runner->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+
+    if (ctx->runner_count == ctx->runner_capacity) {
+        ctx->runner_capacity = ctx->runner_capacity ? ctx->runner_capacity * 2 : 8;
+        REALLOC_N(ctx->runners, struct async_cb_runner *, ctx->runner_capacity);
+    }
+    ctx->runners[ctx->runner_count++] = runner;
+
+    runner->thread = rb_thread_create(async_cb_runner_loop, runner);
+    /* Name thread, for better debugging */
+    rb_funcall(runner->thread, rb_intern("name="), 1, rb_str_new2("FFI Callback Runner"));
+    rb_funcall(runner->thread, rb_intern("thread_variable_set"), 2, ID2SYM(rb_intern("fork_safe")), Qtrue);
+
+    return runner;
+}
+
+static void
+async_cb_runner_signal(struct async_cb_runner *runner)
+{
+#ifndef _WIN32
+    pthread_cond_signal(&runner->cond);
+#else
+    SetEvent(runner->event);
+#endif
+}
+
+/*
+ * Free runners whose thread has exited and stop pooled runners which are
+ * beyond the current pool size.  Called with the dispatcher lock held.
+ */
+static void
+async_cb_runners_trim(struct async_cb_dispatcher *ctx, long pool_size)
+{
+    long i, j;
+
+    for (i = j = 0; i < ctx->runner_count; i++) {
+        struct async_cb_runner *runner = ctx->runners[i];
+        if (runner->dead) {
+            async_cb_runner_release(runner);
+            continue;
+        }
+        if (runner->slot >= pool_size && !runner->stop) {
+            runner->stop = true;
+            async_cb_runner_signal(runner);
+        }
+        ctx->runners[j++] = runner;
+    }
+    ctx->runner_count = j;
+}
+
+static long
+async_cb_runner_free_slot(struct async_cb_dispatcher *ctx, long pool_size)
+{
+    long slot, i;
+
+    for (slot = 0; slot < pool_size; slot++) {
+        for (i = 0; i < ctx->runner_count; i++) {
+            if (ctx->runners[i]->slot == slot && !ctx->runners[i]->stop) {
+                break;
+            }
+        }
+        if (i == ctx->runner_count) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Hand a callback over to a runner thread.  With affinity, callbacks of one
+ * native thread always go to the same pooled runner.  Otherwise an idle
+ * pooled runner is used and if the pool is exhausted a transient runner is
+ * started, so that a callback never waits for an unrelated long running one.
+ */
+static void
+async_cb_dispatch(struct async_cb_dispatcher *ctx, struct gvl_callback *cb)
+{
+    struct async_cb_runner *runner = NULL;
+    long pool_size = async_cb_runner_pool_size;
+    long slot = -1, i;
+
+    async_cb_lock(ctx);
+    async_cb_runners_trim(ctx, pool_size);
+
+    /* Detached callbacks don't block their native thread, so keep them in order
+     * by always running the callbacks of one thread on the same runner. */
+    if (pool_size > 0 && (async_cb_runner_affinity || cb->detached)) {
+        slot = cb->origin % pool_size;
+        for (i = 0; i < ctx->runner_count && runner == NULL; i++) {
+            if (ctx->runners[i]->slot == slot && !ctx->runners[i]->stop) {
+                runner = ctx->runners[i];
+            }
+        }
+    } else if (pool_size > 0) {
+        long pooled = 0;
+        for (i = 0; i < ctx->runner_count && runner == NULL; i++) {
+            struct async_cb_runner *r = ctx->runners[i];
+            if (r->slot >= 0 && !r->stop) {
+                pooled++;
+                if (!r->busy && r->head == NULL) {
+                    runner = r;
+                }
+            }
+        }
+        if (runner == NULL && pooled < pool_size) {
+            slot = async_cb_runner_free_slot(ctx, pool_size);
+        }
+    }
+
+    if (runner == NULL) {
+        /* rb_thread_create() may run ruby code, so don't hold the lock */
+        async_cb_unlock(ctx);
+        runner = async_cb_runner_new(ctx, slot);
+        async_cb_lock(ctx);
+    }
+
+    cb->next = NULL;
+    if (runner->tail != NULL) {
+        runner->tail->next = cb;
+    } else {
+        runner->head = cb;
     }
+    runner->tail = cb;
+    async_cb_runner_signal(runner);
 
-    return Qnil;
+    async_cb_unlock(ctx);
 }
 
-#ifdef _WIN32
 static void *
-async_cb_wait(void *data)
+async_cb_runner_wait(void *data)
 {
-    struct async_wait* w = (struct async_wait *) data;
-    struct async_cb_dispatcher *ctx = w->dispatcher;
-
-    w->cb = NULL;
-
-    EnterCriticalSection(&ctx->async_cb_lock);
+    struct async_cb_runner *runner = (struct async_cb_runner *) data;
+    struct async_cb_dispatcher *ctx = runner->dispatcher;
 
-    while (!w->stop && ctx->async_cb_list == NULL) {
-        LeaveCriticalSection(&ctx->async_cb_lock);
-        WaitForSingleObject(ctx->async_cb_cond, INFINITE);
-        EnterCriticalSection(&ctx->async_cb_lock);
+    async_cb_lock(ctx);
+    runner->busy = false;
+    while (runner->head == NULL && !runner->stop && runner->slot >= 0) {
+#ifndef _WIN32
+        pthread_cond_wait(&runner->cond, &ctx->async_cb_mutex);
+#else
+        async_cb_unlock(ctx);
+        WaitForSingleObject(runner->event, INFINITE);
+        async_cb_lock(ctx);
+#endif
     }
 
-    if (ctx->async_cb_list != NULL) {
-        w->cb = ctx->async_cb_list;
-        ctx->async_cb_list = ctx->async_cb_list->next;
+    if (runner->head != NULL) {
+        runner->cb = runner->head;
+        runner->head = runner->head->next;
+        if (runner->head == NULL) {
+            runner->tail = NULL;
+        }
+        runner->busy = true;
     }
-
-    LeaveCriticalSection(&ctx->async_cb_lock);
+    async_cb_unlock(ctx);
 
     return NULL;
 }
 
 static void
-async_cb_stop(void *data)
+async_cb_runner_stop(void *data)
 {
-    struct async_wait* w = (struct async_wait *) data;
-    struct async_cb_dispatcher *ctx = w->dispatcher;
+    struct async_cb_runner *runner = (struct async_cb_runner *) data;
+    struct async_cb_dispatcher *ctx = runner->dispatcher;
 
-    EnterCriticalSection(&ctx->async_cb_lock);
-    w->stop = true;
-    LeaveCriticalSection(&ctx->async_cb_lock);
-    SetEvent(ctx->async_cb_cond);
+    async_cb_lock(ctx);
+    runner->stop = true;
+    async_cb_runner_signal(runner);
+    async_cb_unlock(ctx);
 }
 
-#else
-static void *
-async_cb_wait(void *data)
+static VALUE
+async_cb_runner_run(VALUE data)
 {
-    struct async_wait* w = (struct async_wait *) data;
-    struct async_cb_dispatcher *ctx = w->dispatcher;
+    struct async_cb_runner *runner = (struct async_cb_runner *) data;
 
-    w->cb = NULL;
+    for (;;) {
+        struct gvl_callback *cb;
 
-    pthread_mutex_lock(&ctx->async_cb_mutex);
-
-    while (!w->stop && ctx->async_cb_list == NULL) {
-        pthread_cond_wait(&ctx->async_cb_cond, &ctx->async_cb_mutex);
-    }
-
-    if (ctx->async_cb_list != NULL) {
-        w->cb = ctx->async_cb_list;
-        ctx->async_cb_list = ctx->async_cb_list->next;
+        rb_thread_call_without_gvl(async_cb_runner_wait, runner, async_cb_runner_stop, runner);
+        if ((cb = runner->cb) == NULL) {
+            break;
+        }
+        runner->cb = NULL;
+        callback_with_gvl(cb);
+
+        /* Become idle before the native thread can issue its next callback */
+        async_cb_lock(runner->dispatcher);
+        runner->busy = false;
+        async_cb_unlock(runner->dispatcher);
+        async_cb_done(cb);
     }
 
-    pthread_mutex_unlock(&ctx->async_cb_mutex);
-
-    return NULL;
+    return Qnil;
 }
 
-static void
-async_cb_stop(void *data)
+static VALUE
+async_cb_runner_exit(VALUE data)
 {
-    struct async_wait* w = (struct async_wait *) data;
-    struct async_cb_dispatcher *ctx = w->dispatcher;
+    struct async_cb_runner *runner = (struct async_cb_runner *) data;
+    struct async_cb_dispatcher *ctx = runner->dispatcher;
 
-    pthread_mutex_lock(&ctx->async_cb_mutex);
-    w->stop = true;
-    pthread_cond_signal(&ctx->async_cb_cond);
-    pthread_mutex_unlock(&ctx->async_cb_mutex);
+    struct gvl_callback *pending;
+
+    async_cb_lock(ctx);
+    /* The thread was killed, pass the callbacks not yet started back to the dispatcher */
+    if (runner->cb != NULL) {
+        runner->cb->next = runner->head;
+        runner->head = runner->cb;
+        runner->cb = NULL;
+    }
+    pending = runner->head;
+    runner->head = runner->tail = NULL;
+    runner->dead = true;
+    async_cb_unlock(ctx);
+
+    while (pending != NULL) {
+        struct gvl_callback *cb = pending;
+        pending = cb->next;
+        async_cb_list_add(ctx, cb);
+    }
+
+    return Qnil;
 }
-#endif
 
 static VALUE
-async_cb_call(void *data)
+async_cb_runner_loop(void *data)
 {
-    struct gvl_callback* cb = (struct gvl_callback *) data;
+    return rb_ensure(async_cb_runner_run, (VALUE) data, async_cb_runner_exit, (VALUE) data);
+}
 
-    callback_with_gvl(data);
+static void
+async_cb_done(struct gvl_callback* cb)
+{
+    if (cb->detached) {
+        struct async_cb_dispatcher *ctx = cb->dispatcher;
+
+        rb_nativethread_lock_lock(&ctx->detached_lock);
+        if (cb->detached_prev != NULL) {
+            cb->detached_prev->detached_next = cb->detached_next;
+        } else {
+            ctx->detached_list = cb->detached_next;
+        }
+        if (cb->detached_next != NULL) {
+            cb->detached_next->detached_prev = cb->detached_prev;
+        }
+        rb_nativethread_lock_unlock(&ctx->detached_lock);
+        free(cb);
+        async_cb_dispatcher_unref(ctx);
+        return;
+    }
 
     /* Signal the original native thread that the ruby code has completed */
 #ifdef _WIN32
     SetEvent(cb->async_event);
 #else
-    pthread_mutex_lock(&cb->async_mutex);
+    pthread_mutex_lock(&cb->waiter->mutex);
     cb->done = true;
-    pthread_cond_signal(&cb->async_cond);
-    pthread_mutex_unlock(&cb->async_mutex);
+    pthread_cond_signal(&cb->waiter->cond);
+    pthread_mutex_unlock(&cb->waiter->mutex);
 #endif
-
-    return Qnil;
 }
 
 #endif
@@ -802,10 +2318,49 @@ async_cb_call(void *data)
 static void *
 callback_with_gvl(void* data)
 {
+    struct gvl_callback* cb = (struct gvl_callback *) data;
+    uint64_t started = cb->timed ? callback_metrics_now() : 0;
+
     rb_rescue2(invoke_callback, (VALUE) data, save_callback_exception, (VALUE) data, rb_eException, (VALUE) 0);
+    if (cb->pointerArgs) {
+        callback_release_pointer_args((Function *) cb->closure->info);
+    }
+    if (cb->timed) {
+        callback_metrics_record((Function *) cb->closure->info, cb, started, callback_metrics_now());
+    }
     return NULL;
 }
 
+static VALUE
+callback_pointer_arg(VALUE rbPointerArgs, long slot, void* address)
+{
+    VALUE rbPointer = RARRAY_AREF(rbPointerArgs, slot);
+    Pointer* p;
+
+    if (OBJ_FROZEN(rbPointer)) {
+        rbPointer = rb_obj_alloc(rbffi_PointerClass);
+        rb_ary_store(rbPointerArgs, slot, rbPointer);
+    }
+
+    TypedData_Get_Struct(rbPointer, Pointer, &rbffi_pointer_data_type, p);
+    p->memory.address = address;
+    p->memory.size = LONG_MAX;
+    p->memory.flags = MEM_RD | MEM_WR;
+
+    return rbPointer;
+}
+
+static void
+callback_release_pointer_args(Function* fn)
+{
+    long i;
+
+    for (i = 0; i < RARRAY_LEN(fn->rbPointerArgs); i++) {
+        callback_pointer_invalidate(RARRAY_AREF(fn->rbPointerArgs, i));
+    }
+    fn->pointerArgsBusy = false;
+}
+
 static VALUE
 invoke_callback(VALUE data)
 {
@@ -813,199 +2368,320 @@ invoke_callback(VALUE data)
 
     Function* fn = (Function *) cb->closure->info;
     FunctionType *cbInfo = fn->info;
-    Type* returnType = cbInfo->returnType;
-    void* retval = cb->retval;
+    const CallbackReturn* ret = &cbInfo->callbackReturn;
     void** parameters = cb->parameters;
     VALUE* rbParams;
-    VALUE rbReturnType = cbInfo->rbReturnType;
     VALUE rbReturnValue;
+    VALUE rbPointerArgs = Qnil;
     int i;
 
+    /* Nested and concurrent calls, or ones after the Function was made shareable, get new Pointers */
+    if (fn->rbPointerArgs != Qnil && !fn->pointerArgsBusy && !OBJ_FROZEN(fn->rbPointerArgs)) {
+        rbPointerArgs = fn->rbPointerArgs;
+        fn->pointerArgsBusy = true;
+        cb->pointerArgs = true;
+    }
+
     rbParams = ALLOCA_N(VALUE, cbInfo->parameterCount);
     for (i = 0; i < cbInfo->parameterCount; ++i) {
-        VALUE param;
-        Type* paramType = cbInfo->parameterTypes[i];
-        VALUE rbParamType = rb_ary_entry(cbInfo->rbParameterTypes, i);
+        const CallbackParam* param = &cbInfo->callbackParams[i];
 
-        if (unlikely(paramType->nativeType == NATIVE_MAPPED)) {
-            rbParamType = ((MappedType *) paramType)->rbType;
-            paramType = ((MappedType *) paramType)->type;
+        if (rbPointerArgs != Qnil && param->pointerSlot >= 0 && *(void **) parameters[i] != NULL) {
+            rbParams[i] = callback_pointer_arg(rbPointerArgs, param->pointerSlot, *(void **) parameters[i]);
+            continue;
         }
 
-        switch (paramType->nativeType) {
-            case NATIVE_INT8:
-                param = INT2NUM(*(int8_t *) parameters[i]);
-                break;
-            case NATIVE_UINT8:
-                param = UINT2NUM(*(uint8_t *) parameters[i]);
-                break;
-            case NATIVE_INT16:
-                param = INT2NUM(*(int16_t *) parameters[i]);
-                break;
-            case NATIVE_UINT16:
-                param = UINT2NUM(*(uint16_t *) parameters[i]);
-                break;
-            case NATIVE_INT32:
-                param = INT2NUM(*(int32_t *) parameters[i]);
-                break;
-            case NATIVE_UINT32:
-                param = UINT2NUM(*(uint32_t *) parameters[i]);
-                break;
-            case NATIVE_INT64:
-                param = LL2NUM(*(int64_t *) parameters[i]);
-                break;
-            case NATIVE_UINT64:
-                param = ULL2NUM(*(uint64_t *) parameters[i]);
-                break;
-            case NATIVE_LONG:
-                param = LONG2NUM(*(long *) parameters[i]);
-                break;
-            case NATIVE_ULONG:
-                param = ULONG2NUM(*(unsigned long *) parameters[i]);
-                break;
-            case NATIVE_FLOAT32:
-                param = rb_float_new(*(float *) parameters[i]);
-                break;
-            case NATIVE_FLOAT64:
-                param = rb_float_new(*(double *) parameters[i]);
-                break;
-            case NATIVE_LONGDOUBLE:
-                param = rbffi_longdouble_new(*(long double *) parameters[i]);
-                break;
-            case NATIVE_STRING:
-                param = (*(void **) parameters[i] != NULL) ? rb_str_new2(*(char **) parameters[i]) : Qnil;
-                break;
-            case NATIVE_POINTER:
-                param = rbffi_Pointer_NewInstance(*(void **) parameters[i]);
-                break;
-            case NATIVE_BOOL:
-                param = (*(uint8_t *) parameters[i]) ? Qtrue : Qfalse;
-                break;
-
-            case NATIVE_FUNCTION:
-            case NATIVE_STRUCT:
-                param = rbffi_NativeValue_ToRuby(paramType, rbParamType, parameters[i]);
-                break;
-
-            default:
-                param = Qnil;
-                break;
-        }
+        rbParams[i] = (*param->toRuby)(param, parameters[i]);
 
         /* Convert the native value into a custom ruby value */
-        if (unlikely(cbInfo->parameterTypes[i]->nativeType == NATIVE_MAPPED)) {
-            VALUE values[] = { param, Qnil };
-            param = rb_funcall2(((MappedType *) cbInfo->parameterTypes[i])->rbConverter, id_from_native, 2, values);
+        if (unlikely(param->mapped != NULL)) {
+            VALUE values[] = { rbParams[i], Qnil };
+            rbParams[i] = rb_funcall2(param->mapped->rbConverter, id_from_native, 2, values);
         }
-
-        rbParams[i] = param;
     }
 
     rbReturnValue = rb_funcall2(fn->rbProc, id_call, cbInfo->parameterCount, rbParams);
 
-    if (unlikely(returnType->nativeType == NATIVE_MAPPED)) {
+    if (unlikely(ret->mapped != NULL)) {
         VALUE values[] = { rbReturnValue, Qnil };
-        rbReturnValue = rb_funcall2(((MappedType *) returnType)->rbConverter, id_to_native, 2, values);
-        rbReturnType = ((MappedType *) returnType)->rbType;
-        returnType = ((MappedType* ) returnType)->type;
+        rbReturnValue = rb_funcall2(ret->mapped->rbConverter, id_to_native, 2, values);
     }
 
     if (rbReturnValue == Qnil || TYPE(rbReturnValue) == T_NIL) {
-        memset(retval, 0, returnType->ffiType->size);
-    } else switch (returnType->nativeType) {
-        case NATIVE_INT8:
-        case NATIVE_INT16:
-        case NATIVE_INT32:
-            *((ffi_sarg *) retval) = NUM2INT(rbReturnValue);
-            break;
-        case NATIVE_UINT8:
-        case NATIVE_UINT16:
-        case NATIVE_UINT32:
-            *((ffi_arg *) retval) = NUM2UINT(rbReturnValue);
-            break;
-        case NATIVE_INT64:
-            *((int64_t *) retval) = NUM2LL(rbReturnValue);
-            break;
-        case NATIVE_UINT64:
-            *((uint64_t *) retval) = NUM2ULL(rbReturnValue);
-            break;
-        case NATIVE_LONG:
-            *((ffi_sarg *) retval) = NUM2LONG(rbReturnValue);
-            break;
-        case NATIVE_ULONG:
-            *((ffi_arg *) retval) = NUM2ULONG(rbReturnValue);
-            break;
-        case NATIVE_FLOAT32:
-            *((float *) retval) = (float) NUM2DBL(rbReturnValue);
-            break;
-        case NATIVE_FLOAT64:
-            *((double *) retval) = NUM2DBL(rbReturnValue);
-            break;
-        case NATIVE_LONGDOUBLE:
-            *((long double *) retval) = rbffi_num2longdouble(rbReturnValue);
-            break;
-        case NATIVE_POINTER:
-            if (TYPE(rbReturnValue) == T_DATA && rb_obj_is_kind_of(rbReturnValue, rbffi_PointerClass)) {
-                AbstractMemory* memory;
-                TypedData_Get_Struct(rbReturnValue, AbstractMemory, &rbffi_abstract_memory_data_type, memory);
-                *((void **) retval) = memory->address;
-            } else {
-                /* Default to returning NULL if not a value pointer object.  handles nil case as well */
-                *((void **) retval) = NULL;
-            }
-            break;
+        memset(cb->retval, 0, ret->type->ffiType->size);
+    } else {
+        (*ret->toNative)(ret, rbReturnValue, cb->retval);
+    }
 
-        case NATIVE_BOOL:
-            *((ffi_arg *) retval) = rbReturnValue == Qtrue;
-            break;
+    return Qnil;
+}
 
-        case NATIVE_FUNCTION:
-            if (TYPE(rbReturnValue) == T_DATA && rb_obj_is_kind_of(rbReturnValue, rbffi_PointerClass)) {
-                AbstractMemory* memory;
-                TypedData_Get_Struct(rbReturnValue, AbstractMemory, &rbffi_abstract_memory_data_type, memory);
+/*
+ * Converters for the arguments and the return value of callbacks.  They are
+ * selected once per FunctionType by rbffi_FunctionType_PrepareCallback().
+ */
+#define CBPARAM(name, ctype, conv) \
+static VALUE \
+cbparam_##name(const CallbackParam* param, const void* value) \
+{ \
+    return conv(*(ctype *) value); \
+}
 
-                *((void **) retval) = memory->address;
+CBPARAM(int8, int8_t, INT2NUM)
+CBPARAM(uint8, uint8_t, UINT2NUM)
+CBPARAM(int16, int16_t, INT2NUM)
+CBPARAM(uint16, uint16_t, UINT2NUM)
+CBPARAM(int32, int32_t, INT2NUM)
+CBPARAM(uint32, uint32_t, UINT2NUM)
+CBPARAM(int64, int64_t, LL2NUM)
+CBPARAM(uint64, uint64_t, ULL2NUM)
+CBPARAM(long, long, LONG2NUM)
+CBPARAM(ulong, unsigned long, ULONG2NUM)
+CBPARAM(float32, float, rb_float_new)
+CBPARAM(float64, double, rb_float_new)
+CBPARAM(longdouble, long double, rbffi_longdouble_new)
+CBPARAM(pointer, void *, rbffi_Pointer_NewInstance)
+#undef CBPARAM
 
-            } else if (rb_obj_is_kind_of(rbReturnValue, rb_cProc) || rb_respond_to(rbReturnValue, id_call)) {
-                VALUE function;
-                AbstractMemory* memory;
+static VALUE
+cbparam_string(const CallbackParam* param, const void* value)
+{
+    return (*(void **) value != NULL) ? rb_str_new2(*(char **) value) : Qnil;
+}
 
-                function = rbffi_Function_ForProc(rbReturnType, rbReturnValue);
+static VALUE
+cbparam_bool(const CallbackParam* param, const void* value)
+{
+    return (*(uint8_t *) value) ? Qtrue : Qfalse;
+}
 
-                TypedData_Get_Struct(function, AbstractMemory, &rbffi_abstract_memory_data_type, memory);
+static VALUE
+cbparam_native(const CallbackParam* param, const void* value)
+{
+    VALUE rbType = param->mapped != NULL
+            ? param->mapped->rbType : RARRAY_AREF(param->info->rbParameterTypes, param->index);
 
-                *((void **) retval) = memory->address;
-            } else {
-                *((void **) retval) = NULL;
-            }
-            break;
+    return rbffi_NativeValue_ToRuby(param->type, rbType, value);
+}
 
-        case NATIVE_STRUCT:
-            if (TYPE(rbReturnValue) == T_DATA && rb_obj_is_kind_of(rbReturnValue, rbffi_StructClass)) {
-                Struct* s;
-                AbstractMemory* memory;
+static VALUE
+cbparam_nil(const CallbackParam* param, const void* value)
+{
+    return Qnil;
+}
 
-                TypedData_Get_Struct(rbReturnValue, Struct, &rbffi_struct_data_type, s);
-                memory = s->pointer;
+static void
+cbret_sint(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((ffi_sarg *) retval) = NUM2INT(value);
+}
 
-                if (memory->address != NULL) {
-                    memcpy(retval, memory->address, returnType->ffiType->size);
+static void
+cbret_uint(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((ffi_arg *) retval) = NUM2UINT(value);
+}
 
-                } else {
-                    memset(retval, 0, returnType->ffiType->size);
-                }
+static void
+cbret_int64(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((int64_t *) retval) = NUM2LL(value);
+}
 
-            } else {
-                memset(retval, 0, returnType->ffiType->size);
-            }
-            break;
+static void
+cbret_uint64(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((uint64_t *) retval) = NUM2ULL(value);
+}
+
+static void
+cbret_long(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((ffi_sarg *) retval) = NUM2LONG(value);
+}
+
+static void
+cbret_ulong(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((ffi_arg *) retval) = NUM2ULONG(value);
+}
+
+static void
+cbret_float32(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((float *) retval) = (float) NUM2DBL(value);
+}
+
+static void
+cbret_float64(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((double *) retval) = NUM2DBL(value);
+}
+
+static void
+cbret_longdouble(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((long double *) retval) = rbffi_num2longdouble(value);
+}
+
+static void
+cbret_pointer(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    if (TYPE(value) == T_DATA && rb_obj_is_kind_of(value, rbffi_PointerClass)) {
+        AbstractMemory* memory;
+        TypedData_Get_Struct(value, AbstractMemory, &rbffi_abstract_memory_data_type, memory);
+        *((void **) retval) = memory->address;
+    } else {
+        /* Default to returning NULL if not a value pointer object.  handles nil case as well */
+        *((void **) retval) = NULL;
+    }
+}
+
+static void
+cbret_bool(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((ffi_arg *) retval) = value == Qtrue;
+}
+
+static void
+cbret_function(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    if (TYPE(value) == T_DATA && rb_obj_is_kind_of(value, rbffi_PointerClass)) {
+        AbstractMemory* memory;
+        TypedData_Get_Struct(value, AbstractMemory, &rbffi_abstract_memory_data_type, memory);
+
+        *((void **) retval) = memory->address;
+
+    } else if (rb_obj_is_kind_of(value, rb_cProc) || rb_respond_to(value, id_call)) {
+        VALUE function;
+        AbstractMemory* memory;
+        VALUE rbReturnType = ret->mapped != NULL ? ret->mapped->rbType : ret->info->rbReturnType;
+
+        function = rbffi_Function_ForProc(rbReturnType, value);
+
+        TypedData_Get_Struct(function, AbstractMemory, &rbffi_abstract_memory_data_type, memory);
+
+        *((void **) retval) = memory->address;
+    } else {
+        *((void **) retval) = NULL;
+    }
+}
+
+static void
+cbret_struct(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    if (TYPE(value) == T_DATA && rb_obj_is_kind_of(value, rbffi_StructClass)) {
+        Struct* s;
+        AbstractMemory* memory;
+
+        TypedData_Get_Struct(value, Struct, &rbffi_struct_data_type, s);
+        memory = s->pointer;
+
+        if (memory->address != NULL) {
+            memcpy(retval, memory->address, ret->type->ffiType->size);
+
+        } else {
+            memset(retval, 0, ret->type->ffiType->size);
+        }
+
+    } else {
+        memset(retval, 0, ret->type->ffiType->size);
+    }
+}
+
+static void
+cbret_zero(const CallbackReturn* ret, VALUE value, void* retval)
+{
+    *((ffi_arg *) retval) = 0;
+}
 
+void
+rbffi_FunctionType_PrepareCallback(FunctionType* fnInfo, bool reusePointers)
+{
+    CallbackReturn* ret = &fnInfo->callbackReturn;
+    int i;
+
+    fnInfo->callbackPointerCount = 0;
+    fnInfo->callbackParams = xcalloc(fnInfo->parameterCount, sizeof(*fnInfo->callbackParams));
+    for (i = 0; i < fnInfo->parameterCount; ++i) {
+        CallbackParam* param = &fnInfo->callbackParams[i];
+
+        param->info = fnInfo;
+        param->index = i;
+        param->type = fnInfo->parameterTypes[i];
+        param->mapped = NULL;
+        if (param->type->nativeType == NATIVE_MAPPED) {
+            param->mapped = (MappedType *) param->type;
+            param->type = param->mapped->type;
+        }
+
+        /* Pointers handed to data converters may be kept in the converted object */
+        param->pointerSlot = -1;
+        if (reusePointers && param->mapped == NULL && param->type->nativeType == NATIVE_POINTER) {
+            param->pointerSlot = fnInfo->callbackPointerCount++;
+        }
+
+        switch (param->type->nativeType) {
+            case NATIVE_INT8: param->toRuby = cbparam_int8; break;
+            case NATIVE_UINT8: param->toRuby = cbparam_uint8; break;
+            case NATIVE_INT16: param->toRuby = cbparam_int16; break;
+            case NATIVE_UINT16: param->toRuby = cbparam_uint16; break;
+            case NATIVE_INT32: param->toRuby = cbparam_int32; break;
+            case NATIVE_UINT32: param->toRuby = cbparam_uint32; break;
+            case NATIVE_INT64: param->toRuby = cbparam_int64; break;
+            case NATIVE_UINT64: param->toRuby = cbparam_uint64; break;
+            case NATIVE_LONG: param->toRuby = cbparam_long; break;
+            case NATIVE_ULONG: param->toRuby = cbparam_ulong; break;
+            case NATIVE_FLOAT32: param->toRuby = cbparam_float32; break;
+            case NATIVE_FLOAT64: param->toRuby = cbparam_float64; break;
+            case NATIVE_LONGDOUBLE: param->toRuby = cbparam_longdouble; break;
+            case NATIVE_STRING: param->toRuby = cbparam_string; break;
+            case NATIVE_POINTER: param->toRuby = cbparam_pointer; break;
+            case NATIVE_BOOL: param->toRuby = cbparam_bool; break;
+            case NATIVE_FUNCTION:
+            case NATIVE_STRUCT:
+                param->toRuby = cbparam_native;
+                break;
+            default:
+                param->toRuby = cbparam_nil;
+                break;
+        }
+    }
+
+    ret->info = fnInfo;
+    ret->type = fnInfo->returnType;
+    ret->mapped = NULL;
+    if (ret->type->nativeType == NATIVE_MAPPED) {
+        ret->mapped = (MappedType *) ret->type;
+        ret->type = ret->mapped->type;
+    }
+
+    switch (ret->type->nativeType) {
+        case NATIVE_INT8:
+        case NATIVE_INT16:
+        case NATIVE_INT32:
+            ret->toNative = cbret_sint;
+            break;
+        case NATIVE_UINT8:
+        case NATIVE_UINT16:
+        case NATIVE_UINT32:
+            ret->toNative = cbret_uint;
+            break;
+        case NATIVE_INT64: ret->toNative = cbret_int64; break;
+        case NATIVE_UINT64: ret->toNative = cbret_uint64; break;
+        case NATIVE_LONG: ret->toNative = cbret_long; break;
+        case NATIVE_ULONG: ret->toNative = cbret_ulong; break;
+        case NATIVE_FLOAT32: ret->toNative = cbret_float32; break;
+        case NATIVE_FLOAT64: ret->toNative = cbret_float64; break;
+        case NATIVE_LONGDOUBLE: ret->toNative = cbret_longdouble; break;
+        case NATIVE_POINTER: ret->toNative = cbret_pointer; break;
+        case NATIVE_BOOL: ret->toNative = cbret_bool; break;
+        case NATIVE_FUNCTION: ret->toNative = cbret_function; break;
+        case NATIVE_STRUCT: ret->toNative = cbret_struct; break;
         default:
-            *((ffi_arg *) retval) = 0;
+            ret->toNative = cbret_zero;
             break;
     }
-
-    return Qnil;
 }
 
 static VALUE
@@ -1053,6 +2729,10 @@ rbffi_Function_Init(VALUE moduleFFI)
     rb_define_method(rbffi_FunctionClass, "free", function_release, 0);
     rb_define_method(rbffi_FunctionClass, "autorelease=", function_set_autorelease, 1);
     rb_define_private_method(rbffi_FunctionClass, "type", function_type, 0);
+    rb_define_method(rbffi_FunctionClass, "bind_ractor", function_bind_ractor, 0);
+    rb_define_method(rbffi_FunctionClass, "ractor", function_ractor, 0);
+    rb_define_method(rbffi_FunctionClass, "metrics", function_metrics, 0);
+    rb_define_method(rbffi_FunctionClass, "reset_metrics", function_reset_metrics, 0);
     /*
      * call-seq: autorelease
      * @return [Boolean]
@@ -1067,17 +2747,43 @@ rbffi_Function_Init(VALUE moduleFFI)
      */
     rb_define_method(rbffi_FunctionClass, "autorelease?", function_autorelease_p, 0);
 
+    rb_define_method(rbffi_FunctionTypeClass, "reserve_closures", fntype_reserve_closures, 1);
+
     id_call = rb_intern("call");
     id_cbtable = rb_intern("@__ffi_callback_table__");
     id_cb_ref = rb_intern("@__ffi_callback__");
     id_to_native = rb_intern("to_native");
     id_from_native = rb_intern("from_native");
+    id_aref = rb_intern("[]");
+    id_aset = rb_intern("[]=");
+
+    rbWeakMapClass = rb_path2class("ObjectSpace::WeakMap");
+    rb_global_variable(&rbWeakMapClass);
+    rb_nativethread_lock_initialize(&callback_metrics_lock);
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    function_cache_key = rb_ractor_local_storage_value_newkey();
+    scoped_callbacks_key = rb_ractor_local_storage_ptr_newkey(&scoped_callbacks_key_type);
+#elif defined(HAVE_RB_GC_MARK_MOVABLE)
+    function_cache = rb_class_new_instance(0, NULL, rbWeakMapClass);
+    rb_global_variable(&function_cache);
+#endif
+#if defined(DEFER_ASYNC_CALLBACK) && !defined(_WIN32)
+    pthread_key_create(&async_cb_waiter_key, async_cb_waiter_free);
+#elif defined(DEFER_ASYNC_CALLBACK)
+    async_cb_event_slot = FlsAlloc(async_cb_event_free);
+#endif
 #if defined(DEFER_ASYNC_CALLBACK) && defined(HAVE_RB_EXT_RACTOR_SAFE)
     async_cb_dispatcher_key = rb_ractor_local_storage_ptr_newkey(&async_cb_dispatcher_key_type);
 #endif
+  rb_define_module_function(moduleFFI, "callback_metrics?", callback_metrics_get_enabled, 0);
+  rb_define_module_function(moduleFFI, "callback_metrics=", callback_metrics_set_enabled, 1);
 #ifdef DEFER_ASYNC_CALLBACK
   /* Ruby code will call this method in a Process._fork patch */
   rb_define_singleton_method(moduleFFI, "_async_cb_dispatcher_atfork_child",
                              async_cb_dispatcher_atfork_child, 0);
+  rb_define_module_function(moduleFFI, "callback_runner_pool_size", async_cb_get_pool_size, 0);
+  rb_define_module_function(moduleFFI, "callback_runner_pool_size=", async_cb_set_pool_size, 1);
+  rb_define_module_function(moduleFFI, "callback_runner_affinity?", async_cb_get_affinity, 0);
+  rb_define_module_function(moduleFFI, "callback_runner_affinity=", async_cb_set_affinity, 1);
 #endif
 }
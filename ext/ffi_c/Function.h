@@ -43,6 +43,28 @@ typedef struct FunctionType_ FunctionType;
 #include "Type.h"
 #include "Call.h"
 #include "ClosurePool.h"
+#include "MappedType.h"
+
+typedef struct CallbackParam_ CallbackParam;
+typedef struct CallbackReturn_ CallbackReturn;
+
+/* Converts a native callback argument into the ruby value passed to the proc */
+struct CallbackParam_ {
+    VALUE (*toRuby)(const CallbackParam* param, const void* value);
+    Type* type;          /* the native type, data converters resolved */
+    MappedType* mapped;  /* the data converter of the parameter, or NULL */
+    FunctionType* info;
+    int index;
+    int pointerSlot;     /* index of the reused Pointer of the argument, or -1 */
+};
+
+/* Stores the value returned by the proc into the native return value */
+struct CallbackReturn_ {
+    void (*toNative)(const CallbackReturn* ret, VALUE value, void* retval);
+    Type* type;
+    MappedType* mapped;
+    FunctionType* info;
+};
 
 struct FunctionType_ {
     Type type; /* The native type of a FunctionInfo object */
@@ -57,15 +79,30 @@ struct FunctionType_ {
     ffi_cif ffi_cif;
     Invoker invoke;
     ClosurePool* closurePool;
+    /* closures recording into an FFI::CallbackQueue */
+    ClosurePool* queuePool;
     int parameterCount;
     int flags;
     ffi_abi abi;
     int callbackCount;
     VALUE* callbackParameters;
+    CallbackParam* callbackParams;
+    CallbackReturn callbackReturn;
+    long structStorageCount;
     VALUE rbEnums;
+    /* signature the type is interned by, see rbffi_FunctionType_New() */
+    VALUE rbInternKey;
     bool ignoreErrno;
     bool blocking;
     bool hasStruct;
+    /* run from native threads without waiting for the ruby proc, see :async option */
+    bool asyncDetached;
+    /* number of :pointer arguments passed as reused Pointer objects, see :reuse_pointers option */
+    int callbackPointerCount;
+    /* procs are only bound for the duration of a call, see :scope option */
+    bool callScoped;
+    /* some parameter is a callback with scope: :call */
+    bool hasScopedCallback;
 };
 
 extern const rb_data_type_t rbffi_fntype_data_type;
@@ -74,7 +111,13 @@ extern VALUE rbffi_FunctionTypeClass, rbffi_FunctionClass;
 void rbffi_Function_Init(VALUE moduleFFI);
 VALUE rbffi_Function_NewInstance(VALUE functionInfo, VALUE proc);
 VALUE rbffi_Function_ForProc(VALUE cbInfo, VALUE proc);
+VALUE rbffi_Function_ForAddress(VALUE rbFunctionInfo, void* address);
 void rbffi_FunctionInfo_Init(VALUE moduleFFI);
+VALUE rbffi_FunctionType_New(int argc, VALUE* argv);
+void rbffi_FunctionType_PrepareCallback(FunctionType* fnInfo, bool reusePointers);
+void rbffi_FunctionType_Signature(FunctionType* fnInfo, char* buf, size_t size);
+void* rbffi_Function_BindScoped(VALUE rbFunctionInfo, FunctionType* cbInfo, VALUE proc);
+void rbffi_Function_ReleaseScoped(FunctionType* cbInfo, void* code);
 
 #ifdef	__cplusplus
 }
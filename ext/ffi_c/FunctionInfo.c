@@ -38,6 +38,9 @@
 
 #include <errno.h>
 #include <ruby.h>
+#if HAVE_RB_EXT_RACTOR_SAFE
+#include <ruby/ractor.h>
+#endif
 
 #include <ffi.h>
 #include "rbffi.h"
@@ -47,7 +50,9 @@
 #include "Types.h"
 #include "Type.h"
 #include "StructByValue.h"
+#include "MappedType.h"
 #include "Function.h"
+#include "Call.h"
 
 static VALUE fntype_allocate(VALUE klass);
 static VALUE fntype_initialize(int argc, VALUE* argv, VALUE self);
@@ -72,6 +77,11 @@ const rb_data_type_t rbffi_fntype_data_type = { /* extern */
 
 VALUE rbffi_FunctionTypeClass = Qnil;
 
+#if HAVE_RB_EXT_RACTOR_SAFE
+static rb_ractor_local_key_t interned_fntypes_key;
+#endif
+static ID id_aref = 0, id_aset = 0;
+
 static VALUE
 fntype_allocate(VALUE klass)
 {
@@ -83,8 +93,10 @@ fntype_allocate(VALUE klass)
     RB_OBJ_WRITE(obj, &fnInfo->rbReturnType, Qnil);
     RB_OBJ_WRITE(obj, &fnInfo->rbParameterTypes, Qnil);
     RB_OBJ_WRITE(obj, &fnInfo->rbEnums, Qnil);
+    RB_OBJ_WRITE(obj, &fnInfo->rbInternKey, Qnil);
     fnInfo->invoke = rbffi_CallFunction;
     fnInfo->closurePool = NULL;
+    fnInfo->queuePool = NULL;
 
     return obj;
 }
@@ -96,6 +108,7 @@ fntype_mark(void *data)
     rb_gc_mark_movable(fnInfo->rbReturnType);
     rb_gc_mark_movable(fnInfo->rbParameterTypes);
     rb_gc_mark_movable(fnInfo->rbEnums);
+    rb_gc_mark_movable(fnInfo->rbInternKey);
     if (fnInfo->callbackCount > 0 && fnInfo->callbackParameters != NULL) {
         size_t index;
         for (index = 0; index < fnInfo->callbackCount; index++) {
@@ -111,6 +124,7 @@ fntype_compact(void *data)
     ffi_gc_location(fnInfo->rbReturnType);
     ffi_gc_location(fnInfo->rbParameterTypes);
     ffi_gc_location(fnInfo->rbEnums);
+    ffi_gc_location(fnInfo->rbInternKey);
     if (fnInfo->callbackCount > 0 && fnInfo->callbackParameters != NULL) {
         size_t index;
         for (index = 0; index < fnInfo->callbackCount; index++) {
@@ -127,9 +141,13 @@ fntype_free(void *data)
     xfree(fnInfo->ffiParameterTypes);
     xfree(fnInfo->nativeParameterTypes);
     xfree(fnInfo->callbackParameters);
+    xfree(fnInfo->callbackParams);
     if (fnInfo->closurePool != NULL) {
         rbffi_ClosurePool_Free(fnInfo->closurePool);
     }
+    if (fnInfo->queuePool != NULL) {
+        rbffi_ClosurePool_Free(fnInfo->queuePool);
+    }
     xfree(fnInfo);
 }
 
@@ -158,6 +176,16 @@ fntype_memsize(const void *data)
  * @option options [Boolean] :blocking set to true if the C function is a blocking call
  * @option options [Symbol] :convention calling convention see {FFI::Library#calling_convention}
  * @option options [FFI::Enums] :enums
+ * @option options [Symbol] :async +:detached+ to let native threads return from a void
+ *   callback immediately, while the proc runs later on a callback runner thread.
+ *   Arguments are copied, strings included, but memory behind other pointers must
+ *   outlive the call of the proc.
+ * @option options [Boolean] :reuse_pointers pass the +:pointer+ arguments of a callback as
+ *   Pointer objects which are reused for every call of the proc and become null pointers
+ *   once the proc returns, so they must not be kept.
+ * @option options [Symbol] :scope +:call+ if the callback is only invoked during the call of the
+ *   function it is passed to.  Procs and blocks are then bound to a reused native trampoline
+ *   for the duration of that call, without creating a Function.
  * @return [self]
  * A new FunctionType instance.
  */
@@ -167,7 +195,8 @@ fntype_initialize(int argc, VALUE* argv, VALUE self)
     FunctionType *fnInfo;
     ffi_status status;
     VALUE rbReturnType = Qnil, rbParamTypes = Qnil, rbOptions = Qnil;
-    VALUE rbEnums = Qnil, rbConvention = Qnil, rbBlocking = Qnil;
+    VALUE rbEnums = Qnil, rbConvention = Qnil, rbBlocking = Qnil, rbAsync = Qnil, rbReusePointers = Qnil;
+    VALUE rbScope = Qnil, callbackType;
 #if defined(X86_WIN32)
     VALUE rbConventionStr;
 #endif
@@ -178,9 +207,23 @@ fntype_initialize(int argc, VALUE* argv, VALUE self)
         rbConvention = rb_hash_aref(rbOptions, ID2SYM(rb_intern("convention")));
         rbEnums = rb_hash_aref(rbOptions, ID2SYM(rb_intern("enums")));
         rbBlocking = rb_hash_aref(rbOptions, ID2SYM(rb_intern("blocking")));
+        rbAsync = rb_hash_aref(rbOptions, ID2SYM(rb_intern("async")));
+        rbReusePointers = rb_hash_aref(rbOptions, ID2SYM(rb_intern("reuse_pointers")));
+        rbScope = rb_hash_aref(rbOptions, ID2SYM(rb_intern("scope")));
     }
 
     Check_Type(rbParamTypes, T_ARRAY);
+    if (RTEST(rbAsync) && rbAsync != ID2SYM(rb_intern("detached"))) {
+        VALUE modeName = rb_funcall2(rbAsync, rb_intern("inspect"), 0, NULL);
+        rb_raise(rb_eArgError, "Invalid async mode (%s)", RSTRING_PTR(modeName));
+    }
+    if (RTEST(rbScope) && rbScope != ID2SYM(rb_intern("call"))) {
+        VALUE scopeName = rb_funcall2(rbScope, rb_intern("inspect"), 0, NULL);
+        rb_raise(rb_eArgError, "Invalid callback scope (%s)", RSTRING_PTR(scopeName));
+    }
+    if (RTEST(rbScope) && RTEST(rbAsync)) {
+        rb_raise(rb_eArgError, "Call scoped callbacks can't be detached");
+    }
 
     TypedData_Get_Struct(self, FunctionType, &rbffi_fntype_data_type, fnInfo);
     fnInfo->parameterCount = RARRAY_LENINT(rbParamTypes);
@@ -191,6 +234,9 @@ fntype_initialize(int argc, VALUE* argv, VALUE self)
     RB_OBJ_WRITE(self, &fnInfo->rbEnums, rbEnums);
     fnInfo->blocking = RTEST(rbBlocking);
     fnInfo->hasStruct = false;
+    fnInfo->structStorageCount = 0;
+    fnInfo->callScoped = RTEST(rbScope);
+    fnInfo->hasScopedCallback = false;
 
     for (i = 0; i < fnInfo->parameterCount; ++i) {
         VALUE entry = rb_ary_entry(rbParamTypes, i);
@@ -201,10 +247,16 @@ fntype_initialize(int argc, VALUE* argv, VALUE self)
             rb_raise(rb_eTypeError, "Invalid parameter type (%s)", RSTRING_PTR(typeName));
         }
 
-        if (rb_obj_is_kind_of(type, rbffi_FunctionTypeClass)) {
+        callbackType = type;
+        if (rb_obj_is_kind_of(type, rbffi_MappedTypeClass)) {
+            /* The callback the converter maps to */
+            callbackType = ((MappedType *) RTYPEDDATA_DATA(type))->rbType;
+        }
+        if (rb_obj_is_kind_of(callbackType, rbffi_FunctionTypeClass)) {
             REALLOC_N(fnInfo->callbackParameters, VALUE, fnInfo->callbackCount + 1);
-            RB_OBJ_WRITE(self, &fnInfo->callbackParameters[fnInfo->callbackCount], type);
+            RB_OBJ_WRITE(self, &fnInfo->callbackParameters[fnInfo->callbackCount], callbackType);
             fnInfo->callbackCount++;
+            fnInfo->hasScopedCallback |= ((FunctionType *) RTYPEDDATA_DATA(callbackType))->callScoped;
         }
 
         if (rb_obj_is_kind_of(type, rbffi_StructByValueClass)) {
@@ -213,6 +265,7 @@ fntype_initialize(int argc, VALUE* argv, VALUE self)
 
         rb_ary_push(fnInfo->rbParameterTypes, type);
         TypedData_Get_Struct(type, Type, &rbffi_type_data_type, fnInfo->parameterTypes[i]);
+        fnInfo->structStorageCount += rbffi_StructParamStorageCount(fnInfo->parameterTypes[i]);
         fnInfo->ffiParameterTypes[i] = fnInfo->parameterTypes[i]->ffiType;
         fnInfo->nativeParameterTypes[i] = fnInfo->parameterTypes[i]->nativeType;
     }
@@ -230,6 +283,11 @@ fntype_initialize(int argc, VALUE* argv, VALUE self)
     TypedData_Get_Struct(fnInfo->rbReturnType, Type, &rbffi_type_data_type, fnInfo->returnType);
     fnInfo->ffiReturnType = fnInfo->returnType->ffiType;
 
+    fnInfo->asyncDetached = RTEST(rbAsync);
+    if (fnInfo->asyncDetached && fnInfo->returnType->nativeType != NATIVE_VOID) {
+        rb_raise(rb_eArgError, "Detached callbacks must return void");
+    }
+
 #if defined(X86_WIN32)
     rbConventionStr = (rbConvention != Qnil) ? rb_funcall2(rbConvention, rb_intern("to_s"), 0, NULL) : Qnil;
     fnInfo->abi = (rbConventionStr != Qnil && strcmp(StringValueCStr(rbConventionStr), "stdcall") == 0)
@@ -252,12 +310,151 @@ fntype_initialize(int argc, VALUE* argv, VALUE self)
     }
 
     fnInfo->invoke = rbffi_GetInvoker(fnInfo);
+    rbffi_FunctionType_PrepareCallback(fnInfo, RTEST(rbReusePointers));
 
     rb_obj_freeze(fnInfo->rbParameterTypes);
     rb_obj_freeze(self);
     return self;
 }
 
+/*
+ * The table only refers to the interned FunctionTypes weakly, keyed by the hash of their
+ * signature, so that types built on the fly don't stay around forever.  WeakMap accepts
+ * Integer keys since ruby-2.7, older rubies use a Hash, which is cleared when it grows
+ * beyond INTERNED_FNTYPES_MAX entries.
+ */
+#define INTERNED_FNTYPES_MAX (1024)
+
+static VALUE
+interned_fntypes_new(void)
+{
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    return rb_class_new_instance(0, NULL, rb_path2class("ObjectSpace::WeakMap"));
+#else
+    return rb_hash_new();
+#endif
+}
+
+static VALUE
+interned_fntypes(void)
+{
+#if HAVE_RB_EXT_RACTOR_SAFE
+    VALUE hash = rb_ractor_local_storage_value(interned_fntypes_key);
+    if (hash == Qnil) {
+        hash = interned_fntypes_new();
+        rb_ractor_local_storage_value_set(interned_fntypes_key, hash);
+    }
+#else
+    static VALUE hash = Qundef;
+    if (hash == Qundef) {
+        rb_global_variable(&hash);
+        hash = interned_fntypes_new();
+    }
+#endif
+    return hash;
+}
+
+static VALUE
+interned_fntype_get(VALUE types, VALUE key)
+{
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    VALUE hash = rb_hash(key);
+    VALUE fnInfo = rb_funcall2(types, id_aref, 1, &hash);
+
+    /* Different signatures might have the same hash */
+    if (fnInfo != Qnil && rb_eql(((FunctionType *) RTYPEDDATA_DATA(fnInfo))->rbInternKey, key)) {
+        return fnInfo;
+    }
+    return Qnil;
+#else
+    return rb_hash_lookup(types, key);
+#endif
+}
+
+static void
+interned_fntype_set(VALUE types, VALUE key, VALUE fnInfo)
+{
+    FunctionType* p;
+
+    TypedData_Get_Struct(fnInfo, FunctionType, &rbffi_fntype_data_type, p);
+    RB_OBJ_WRITE(fnInfo, &p->rbInternKey, key);
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    rb_funcall(types, id_aset, 2, rb_hash(key), fnInfo);
+#else
+    if (RHASH_SIZE(types) >= INTERNED_FNTYPES_MAX) {
+        rb_hash_clear(types);
+    }
+    rb_hash_aset(types, key, fnInfo);
+#endif
+}
+
+/*
+ * Return a FunctionType for the signature, reusing an existing one with the same
+ * return type, parameter types, convention, enums and callback options.
+ *
+ * FunctionTypes are frozen after initialization, so sharing them is invisible to
+ * callers, while functions with the same signature share the prepared cif and
+ * closure pool.
+ */
+VALUE
+rbffi_FunctionType_New(int argc, VALUE* argv)
+{
+    VALUE rbReturnType = Qnil, rbParamTypes = Qnil, rbOptions = Qnil;
+    VALUE rbConvention = Qnil, rbEnums = Qnil, rbBlocking = Qnil, rbAsync = Qnil, rbReusePointers = Qnil;
+    VALUE rbScope = Qnil;
+    VALUE key, params, fnInfo, types;
+    long i;
+
+    rb_scan_args(argc, argv, "21", &rbReturnType, &rbParamTypes, &rbOptions);
+    if (!RB_TYPE_P(rbParamTypes, T_ARRAY) || (rbOptions != Qnil && !RB_TYPE_P(rbOptions, T_HASH))) {
+        /* Let initialize report the error */
+        return rb_class_new_instance(argc, argv, rbffi_FunctionTypeClass);
+    }
+
+    if (rbOptions != Qnil) {
+        rbConvention = rb_hash_aref(rbOptions, ID2SYM(rb_intern("convention")));
+        rbEnums = rb_hash_aref(rbOptions, ID2SYM(rb_intern("enums")));
+        rbBlocking = rb_hash_aref(rbOptions, ID2SYM(rb_intern("blocking")));
+        rbAsync = rb_hash_aref(rbOptions, ID2SYM(rb_intern("async")));
+        rbReusePointers = rb_hash_aref(rbOptions, ID2SYM(rb_intern("reuse_pointers")));
+        rbScope = rb_hash_aref(rbOptions, ID2SYM(rb_intern("scope")));
+    }
+
+    params = rb_ary_new2(RARRAY_LEN(rbParamTypes));
+    for (i = 0; i < RARRAY_LEN(rbParamTypes); ++i) {
+        VALUE type = rbffi_Type_Lookup(RARRAY_AREF(rbParamTypes, i));
+        if (!RTEST(type)) {
+            return rb_class_new_instance(argc, argv, rbffi_FunctionTypeClass);
+        }
+        rb_ary_push(params, type);
+    }
+
+    key = rb_ary_new_from_args(8, rbffi_Type_Lookup(rbReturnType), params,
+            rbConvention, rbEnums, RTEST(rbBlocking) ? Qtrue : Qfalse, RTEST(rbAsync) ? rbAsync : Qnil,
+            RTEST(rbReusePointers) ? Qtrue : Qfalse, RTEST(rbScope) ? rbScope : Qnil);
+    rb_obj_freeze(params);
+    rb_obj_freeze(key);
+    types = interned_fntypes();
+    if ((fnInfo = interned_fntype_get(types, key)) != Qnil) {
+        return fnInfo;
+    }
+
+    fnInfo = rb_class_new_instance(argc, argv, rbffi_FunctionTypeClass);
+    interned_fntype_set(types, key, fnInfo);
+
+    return fnInfo;
+}
+
+static VALUE
+fntype_s_new(int argc, VALUE* argv, VALUE klass)
+{
+    if (klass != rbffi_FunctionTypeClass) {
+        return rb_class_new_instance(argc, argv, klass);
+    }
+
+    return rbffi_FunctionType_New(argc, argv);
+}
+
 /*
  * call-seq: return_type
  * @return [Type]
@@ -314,9 +511,21 @@ rbffi_FunctionInfo_Init(VALUE moduleFFI)
     rb_define_const(ffi_Type, "Function", rbffi_FunctionTypeClass);
 
     rb_define_alloc_func(rbffi_FunctionTypeClass, fntype_allocate);
+    /*
+     * call-seq: new(return_type, param_types, options={})
+     * @return [FunctionType]
+     * A FunctionType for the signature; identical signatures share one instance.
+     */
+    rb_define_singleton_method(rbffi_FunctionTypeClass, "new", fntype_s_new, -1);
     rb_define_method(rbffi_FunctionTypeClass, "initialize", fntype_initialize, -1);
     rb_define_method(rbffi_FunctionTypeClass, "return_type", fntype_return_type, 0);
     rb_define_method(rbffi_FunctionTypeClass, "param_types", fntype_param_types, 0);
 
+#if HAVE_RB_EXT_RACTOR_SAFE
+    interned_fntypes_key = rb_ractor_local_storage_value_newkey();
+#endif
+    id_aref = rb_intern("[]");
+    id_aset = rb_intern("[]=");
+
 }
 
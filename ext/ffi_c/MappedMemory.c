@@ -0,0 +1,551 @@
+/*
+ * Copyright (c) 2008-2013, Ruby FFI project contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Ruby FFI project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MSC_VER
+#include <sys/param.h>
+#endif
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#if defined(__CYGWIN__) || !defined(_WIN32)
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# include <fcntl.h>
+# define MAPPED_MEMORY 1
+#endif
+#include <ruby.h>
+#include <ruby/io.h>
+
+#include "rbffi.h"
+#include "compat.h"
+#include "AbstractMemory.h"
+#include "Pointer.h"
+#include "MappedMemory.h"
+
+/*
+ * A Pointer to a region of a file, which is mapped with mmap(2).  The kernel
+ * pages the data in on access, so large files are neither read up front nor
+ * copied into the ruby heap.  The file stays open while the region is mapped,
+ * so that it can be remapped.
+ */
+
+VALUE rbffi_MappedMemoryClass = Qnil;
+
+#ifdef MAPPED_MEMORY
+
+typedef struct MappedMemory_ {
+    Pointer base;
+    /* page aligned start and length of the mapping, which covers base.memory */
+    void* mapAddress;
+    size_t mapLength;
+    off_t offset;
+    int fd;
+    int prot;
+    int mapFlags;
+    VALUE rbPath;
+} MappedMemory;
+
+static VALUE mapped_allocate(VALUE klass);
+static void mapped_mark(void *data);
+static void mapped_compact(void *data);
+static void mapped_release(void *data);
+static size_t mapped_memsize(const void *data);
+static VALUE mapped_unmap(VALUE self);
+
+static const rb_data_type_t mapped_memory_data_type = {
+    .wrap_struct_name = "FFI::MappedMemory",
+    .function = {
+        .dmark = mapped_mark,
+        .dfree = mapped_release,
+        .dsize = mapped_memsize,
+        ffi_compact_callback( mapped_compact )
+    },
+    .parent = &rbffi_pointer_data_type,
+    // IMPORTANT: WB_PROTECTED objects must only use the RB_OBJ_WRITE()
+    // macro to update VALUE references, as to trigger write barriers.
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED | FFI_RUBY_TYPED_FROZEN_SHAREABLE
+};
+
+static VALUE
+mapped_allocate(VALUE klass)
+{
+    MappedMemory* m;
+    VALUE obj = TypedData_Make_Struct(klass, MappedMemory, &mapped_memory_data_type, m);
+
+    RB_OBJ_WRITE(obj, &m->base.rbParent, Qnil);
+    RB_OBJ_WRITE(obj, &m->rbPath, Qnil);
+    m->base.memory.flags = 0;
+    m->fd = -1;
+
+    return obj;
+}
+
+static void
+mapped_mark(void *data)
+{
+    MappedMemory* m = (MappedMemory *) data;
+    rb_gc_mark_movable(m->base.rbParent);
+    rb_gc_mark_movable(m->rbPath);
+}
+
+static void
+mapped_compact(void *data)
+{
+    MappedMemory* m = (MappedMemory *) data;
+    ffi_gc_location(m->base.rbParent);
+    ffi_gc_location(m->rbPath);
+}
+
+static void
+mapped_release(void *data)
+{
+    MappedMemory* m = (MappedMemory *) data;
+
+    /* without autorelease the mapping has to outlive the object, the file is not needed for that */
+    if (m->mapAddress != NULL && m->base.autorelease) {
+        munmap(m->mapAddress, m->mapLength);
+    }
+    if (m->fd >= 0) {
+        close(m->fd);
+    }
+    xfree(m);
+}
+
+static size_t
+mapped_memsize(const void *data)
+{
+    /* the mapped pages are not part of the ruby heap */
+    return sizeof(MappedMemory);
+}
+
+static MappedMemory*
+mapped_get(VALUE self)
+{
+    MappedMemory* m;
+
+    TypedData_Get_Struct(self, MappedMemory, &mapped_memory_data_type, m);
+
+    return m;
+}
+
+static MappedMemory*
+mapped_check(VALUE self)
+{
+    MappedMemory* m = mapped_get(self);
+
+    if (m->mapAddress == NULL) {
+        rb_raise(rb_eRuntimeError, "memory is not mapped");
+    }
+
+    return m;
+}
+
+/*
+ * Map +length+ bytes at +offset+ of the file, or the rest of the file if +rbLength+ is nil.
+ * The previous mapping is only unmapped after the new one succeeded.
+ */
+static void
+mapped_map(MappedMemory* m, VALUE rbOffset, VALUE rbLength)
+{
+    struct stat st;
+    off_t offset = 0, delta;
+    long long length;
+    void* address;
+
+    if (rbOffset != Qundef && rbOffset != Qnil) {
+        offset = NUM2OFFT(rbOffset);
+    }
+    if (fstat(m->fd, &st) != 0) {
+        rb_sys_fail_str(m->rbPath);
+    }
+    if (offset < 0 || offset > st.st_size) {
+        rb_raise(rb_eArgError, "offset %lld is outside of the file", (long long) offset);
+    }
+    if (rbLength != Qundef && rbLength != Qnil) {
+        length = NUM2LL(rbLength);
+        if (length < 0 || length > st.st_size - offset) {
+            rb_raise(rb_eArgError, "length %lld exceeds the file", length);
+        }
+    } else {
+        length = st.st_size - offset;
+    }
+    if (length == 0) {
+        rb_raise(rb_eArgError, "cannot map an empty region");
+    }
+#if SIZEOF_SIZE_T < 8
+    if ((unsigned long long) length > LONG_MAX) {
+        rb_raise(rb_eArgError, "length %lld is too large to be mapped", length);
+    }
+#endif
+
+    /* mmap wants a page aligned offset, the region starts within the first page */
+    delta = offset % sysconf(_SC_PAGESIZE);
+    address = mmap(NULL, (size_t) (length + delta), m->prot, m->mapFlags, m->fd, offset - delta);
+    if (address == MAP_FAILED) {
+        rb_sys_fail("mmap");
+    }
+
+    if (m->mapAddress != NULL) {
+        munmap(m->mapAddress, m->mapLength);
+    }
+    m->mapAddress = address;
+    m->mapLength = (size_t) (length + delta);
+    m->offset = offset;
+    m->base.memory.address = (char *) address + delta;
+    m->base.memory.size = (long) length;
+    m->base.memory.typeSize = 1;
+    m->base.memory.flags = (m->prot & PROT_WRITE) != 0 ? (MEM_RD | MEM_WR) : MEM_RD;
+    m->base.autorelease = true;
+}
+
+/*
+ * Get the page aligned range of an optional +offset+ and +length+ within the memory.
+ */
+static void
+mapped_range(MappedMemory* m, VALUE rbOffset, VALUE rbLength, char** address, size_t* length)
+{
+    long offset = rbOffset != Qnil ? NUM2LONG(rbOffset) : 0;
+    long size = rbLength != Qnil ? NUM2LONG(rbLength) : m->base.memory.size - offset;
+    char* start;
+    uintptr_t delta;
+
+    if (offset < 0 || size < 0 || offset > m->base.memory.size || size > m->base.memory.size - offset) {
+        rb_raise(rb_eIndexError, "Memory access offset=%ld size=%ld is out of bounds", offset, size);
+    }
+
+    start = m->base.memory.address + offset;
+    delta = (uintptr_t) start % (uintptr_t) sysconf(_SC_PAGESIZE);
+    *address = start - delta;
+    *length = (size_t) size + delta;
+}
+
+static const char*
+mapped_mode(MappedMemory* m, VALUE rbMode, int* openFlags)
+{
+    const char* mode = rbMode != Qnil ? StringValueCStr(rbMode) : "r";
+
+    if (strcmp(mode, "r") == 0) {
+        *openFlags = O_RDONLY;
+        m->prot = PROT_READ;
+        m->mapFlags = MAP_SHARED;
+    } else if (strcmp(mode, "r+") == 0) {
+        *openFlags = O_RDWR;
+        m->prot = PROT_READ | PROT_WRITE;
+        m->mapFlags = MAP_SHARED;
+    } else if (strcmp(mode, "c") == 0) {
+        *openFlags = O_RDONLY;
+        m->prot = PROT_READ | PROT_WRITE;
+        m->mapFlags = MAP_PRIVATE;
+    } else {
+        rb_raise(rb_eArgError, "invalid mode %s, expected \"r\", \"r+\" or \"c\"", mode);
+    }
+
+    return mode;
+}
+
+/*
+ * call-seq: initialize(path, mode = "r", offset: 0, length: nil)
+ * @param [String, #to_path] path file to map
+ * @param [String] mode +"r"+ for read-only, +"r+"+ to write to the file or
+ *   +"c"+ for copy-on-write, where writes are private to the mapping
+ * @param [Integer] offset start of the region in the file
+ * @param [Integer, nil] length size of the region, or +nil+ for the rest of the file
+ * @return [self]
+ * Map a region of a file.
+ */
+static VALUE
+mapped_initialize(int argc, VALUE* argv, VALUE self)
+{
+    MappedMemory* m = mapped_get(self);
+    VALUE rbPath = Qnil, rbMode = Qnil, rbOptions = Qnil;
+    ID keywords[2];
+    VALUE values[2] = { Qundef, Qundef };
+    int openFlags = 0;
+
+    rb_scan_args(argc, argv, "11:", &rbPath, &rbMode, &rbOptions);
+    if (rbOptions != Qnil) {
+        keywords[0] = rb_intern("offset");
+        keywords[1] = rb_intern("length");
+        rb_get_kwargs(rbOptions, keywords, 0, 2, values);
+    }
+    if (m->fd >= 0) {
+        rb_raise(rb_eRuntimeError, "memory is already mapped");
+    }
+
+    FilePathValue(rbPath);
+    mapped_mode(m, rbMode, &openFlags);
+    RB_OBJ_WRITE(self, &m->rbPath, rb_str_new_frozen(rbPath));
+
+    m->fd = rb_cloexec_open(RSTRING_PTR(m->rbPath), openFlags, 0);
+    if (m->fd < 0) {
+        rb_sys_fail_str(m->rbPath);
+    }
+    rb_update_max_fd(m->fd);
+
+    mapped_map(m, values[0], values[1]);
+
+    return self;
+}
+
+/*
+ * call-seq: open(path, mode = "r", offset: 0, length: nil) { |memory| ... }
+ * @param (see #initialize)
+ * @yieldparam [MappedMemory] memory
+ * @return [MappedMemory, Object] the memory, or the result of the block
+ * Map a region of a file.  If a block is given, the region is unmapped after it returns.
+ */
+static VALUE
+mapped_s_open(int argc, VALUE* argv, VALUE klass)
+{
+#ifdef RB_PASS_CALLED_KEYWORDS
+    VALUE obj = rb_class_new_instance_kw(argc, argv, klass, RB_PASS_CALLED_KEYWORDS);
+#else
+    VALUE obj = rb_class_new_instance(argc, argv, klass);
+#endif
+
+    if (rb_block_given_p()) {
+        return rb_ensure(rb_yield, obj, mapped_unmap, obj);
+    }
+
+    return obj;
+}
+
+/*
+ * call-seq: remap(offset: 0, length: nil)
+ * @param [Integer] offset start of the region in the file
+ * @param [Integer, nil] length size of the region, or +nil+ for the rest of the file
+ * @return [self]
+ * Map another region of the same file, for instance after the file grew.
+ * Pointers derived from the memory, like slices and struct views, keep
+ * pointing to the previous region, which is unmapped.
+ */
+static VALUE
+mapped_remap(int argc, VALUE* argv, VALUE self)
+{
+    MappedMemory* m;
+    VALUE rbOptions = Qnil;
+    ID keywords[2];
+    VALUE values[2] = { Qundef, Qundef };
+
+    rb_check_frozen(self);
+    m = mapped_check(self);
+
+    rb_scan_args(argc, argv, "0:", &rbOptions);
+    if (rbOptions != Qnil) {
+        keywords[0] = rb_intern("offset");
+        keywords[1] = rb_intern("length");
+        rb_get_kwargs(rbOptions, keywords, 0, 2, values);
+    }
+    mapped_map(m, values[0], values[1]);
+
+    return self;
+}
+
+/*
+ * call-seq: unmap
+ * @return [self]
+ * Unmap the memory and close the file now, rather than when the object is garbage collected.
+ * Further accesses raise a {NullPointerError}.  Pointers derived from the memory must not
+ * be used any longer.
+ */
+static VALUE
+mapped_unmap(VALUE self)
+{
+    MappedMemory* m;
+
+    rb_check_frozen(self);
+    m = mapped_get(self);
+
+    if (m->mapAddress != NULL) {
+        munmap(m->mapAddress, m->mapLength);
+        m->mapAddress = NULL;
+        m->mapLength = 0;
+    }
+    if (m->fd >= 0) {
+        close(m->fd);
+        m->fd = -1;
+    }
+    m->base.memory.address = NULL;
+    m->base.memory.size = 0;
+    m->base.memory.flags = 0;
+
+    return self;
+}
+
+/*
+ * call-seq: msync(offset = 0, length = nil, async: false)
+ * @param [Integer] offset start of the range within the memory
+ * @param [Integer, nil] length size of the range, or +nil+ for the rest of the memory
+ * @param [Boolean] async only schedule the write instead of waiting for it
+ * @return [self]
+ * Write changes of a +"r+"+ mapping back to the file.
+ */
+static VALUE
+mapped_msync(int argc, VALUE* argv, VALUE self)
+{
+    MappedMemory* m = mapped_check(self);
+    VALUE rbOffset = Qnil, rbLength = Qnil, rbOptions = Qnil;
+    VALUE async = Qundef;
+    ID keyword;
+    char* address;
+    size_t length;
+
+    rb_scan_args(argc, argv, "02:", &rbOffset, &rbLength, &rbOptions);
+    if (rbOptions != Qnil) {
+        keyword = rb_intern("async");
+        rb_get_kwargs(rbOptions, &keyword, 0, 1, &async);
+    }
+    mapped_range(m, rbOffset, rbLength, &address, &length);
+
+    if (msync(address, length, async != Qundef && RTEST(async) ? MS_ASYNC : MS_SYNC) != 0) {
+        rb_sys_fail("msync");
+    }
+
+    return self;
+}
+
+/*
+ * call-seq: madvise(advice, offset = 0, length = nil)
+ * @param [Symbol] advice one of +:normal+, +:sequential+, +:random+, +:willneed+,
+ *   +:dontneed+ or +:hugepage+
+ * @param [Integer] offset start of the range within the memory
+ * @param [Integer, nil] length size of the range, or +nil+ for the rest of the memory
+ * @return [self]
+ * Tell the kernel how the memory is going to be accessed.  The advice is a hint only,
+ * advices which the platform doesn't know are ignored.
+ */
+static VALUE
+mapped_madvise(int argc, VALUE* argv, VALUE self)
+{
+    MappedMemory* m = mapped_check(self);
+    VALUE rbAdvice = Qnil, rbOffset = Qnil, rbLength = Qnil;
+    ID id;
+    int advice = -1;
+    char* address;
+    size_t length;
+
+    rb_scan_args(argc, argv, "12", &rbAdvice, &rbOffset, &rbLength);
+    Check_Type(rbAdvice, T_SYMBOL);
+    id = SYM2ID(rbAdvice);
+
+    if (id == rb_intern("normal")) {
+        advice = MADV_NORMAL;
+    } else if (id == rb_intern("sequential")) {
+        advice = MADV_SEQUENTIAL;
+    } else if (id == rb_intern("random")) {
+        advice = MADV_RANDOM;
+    } else if (id == rb_intern("willneed")) {
+        advice = MADV_WILLNEED;
+    } else if (id == rb_intern("dontneed")) {
+        advice = MADV_DONTNEED;
+    } else if (id == rb_intern("hugepage")) {
+#ifdef MADV_HUGEPAGE
+        advice = MADV_HUGEPAGE;
+#endif
+    } else {
+        rb_raise(rb_eArgError, "unknown advice :%s", rb_id2name(id));
+    }
+    mapped_range(m, rbOffset, rbLength, &address, &length);
+
+    if (advice != -1 && madvise(address, length, advice) != 0) {
+        rb_sys_fail("madvise");
+    }
+
+    return self;
+}
+
+/*
+ * call-seq: mapped?
+ * @return [Boolean] +false+ after {#unmap}
+ */
+static VALUE
+mapped_mapped_p(VALUE self)
+{
+    return mapped_get(self)->mapAddress != NULL ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq: path
+ * @return [String] path of the mapped file
+ */
+static VALUE
+mapped_path(VALUE self)
+{
+    return mapped_get(self)->rbPath;
+}
+
+/*
+ * call-seq: offset
+ * @return [Integer] start of the region in the file
+ */
+static VALUE
+mapped_offset(VALUE self)
+{
+    return OFFT2NUM(mapped_get(self)->offset);
+}
+
+#endif /* MAPPED_MEMORY */
+
+void
+rbffi_MappedMemory_Init(VALUE moduleFFI)
+{
+    /*
+     * Document-class: FFI::MappedMemory < FFI::Pointer
+     * A {Pointer} to a region of a file, which is mapped into memory.  The kernel reads
+     * the data on demand, so large files don't have to be read and copied up front.
+     * It can be used like any other memory, as argument of functions and for {Struct}s.
+     *
+     * @example Read the header of a large file
+     *   FFI::MappedMemory.open("data.bin") do |mem|
+     *     mem.madvise(:sequential)
+     *     header = Header.new(mem)
+     *     values = mem.get_array_of_float(Header.size, header[:count])
+     *   end
+     */
+    rbffi_MappedMemoryClass = rb_define_class_under(moduleFFI, "MappedMemory", rbffi_PointerClass);
+    rb_global_variable(&rbffi_MappedMemoryClass);
+#ifdef MAPPED_MEMORY
+    rb_define_alloc_func(rbffi_MappedMemoryClass, mapped_allocate);
+
+    rb_define_singleton_method(rbffi_MappedMemoryClass, "open", mapped_s_open, -1);
+    rb_define_method(rbffi_MappedMemoryClass, "initialize", mapped_initialize, -1);
+    rb_define_method(rbffi_MappedMemoryClass, "remap", mapped_remap, -1);
+    rb_define_method(rbffi_MappedMemoryClass, "unmap", mapped_unmap, 0);
+    rb_define_alias(rbffi_MappedMemoryClass, "free", "unmap");
+    rb_define_method(rbffi_MappedMemoryClass, "msync", mapped_msync, -1);
+    rb_define_method(rbffi_MappedMemoryClass, "madvise", mapped_madvise, -1);
+    rb_define_method(rbffi_MappedMemoryClass, "mapped?", mapped_mapped_p, 0);
+    rb_define_method(rbffi_MappedMemoryClass, "path", mapped_path, 0);
+    rb_define_method(rbffi_MappedMemoryClass, "offset", mapped_offset, 0);
+#else
+    rb_define_singleton_method(rbffi_MappedMemoryClass, "open", rb_f_notimplement, -1);
+    rb_define_method(rbffi_MappedMemoryClass, "initialize", rb_f_notimplement, -1);
+#endif
+}
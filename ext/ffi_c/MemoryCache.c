@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2008-2013, Ruby FFI project contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Ruby FFI project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MSC_VER
+#include <sys/param.h>
+#endif
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#ifndef _WIN32
+# include <pthread.h>
+#else
+# include <windows.h>
+#endif
+#include <ruby.h>
+
+#include "rbffi.h"
+#include "MemoryCache.h"
+
+/*
+ * Backing storage of MemoryPointer, Buffer and duplicated Pointers.  Blocks of
+ * up to 4096 bytes are rounded up to a power of two and kept on freelists of
+ * the native thread releasing them, so that allocating and dropping many small
+ * buffers doesn't go through malloc every time.  The freelists don't need locks,
+ * also not with Ractors running in parallel.
+ *
+ * Blocks are allocated with malloc, since cached blocks are freed when their
+ * thread exits, without the GVL.  Until then each thread keeps up to
+ * cache_class_bytes per size class.  Blocks in use are reported to ruby's GC
+ * with rb_gc_adjust_memory_usage(), like xmalloc'ed ones.
+ */
+
+#define CACHE_MIN_SHIFT 4
+#define CACHE_CLASSES 9
+#define CACHE_MAX_SIZE (1 << (CACHE_MIN_SHIFT + CACHE_CLASSES - 1))
+
+/* upper bound of the bytes cached per size class and thread, see FFI.memory_cache_limit= */
+static long cache_class_bytes = 256 * 1024;
+
+/* In front of each block, keeps the data as aligned as malloc does, 16 bytes on 64 bit platforms */
+typedef union CacheHeader_ {
+    /* size of the block while in use */
+    size_t size;
+    /* next free block while cached */
+    union CacheHeader_* next;
+    unsigned char align[16];
+} CacheHeader;
+
+typedef struct MemoryCache_ {
+    CacheHeader* free[CACHE_CLASSES];
+    long count[CACHE_CLASSES];
+    unsigned long hits[CACHE_CLASSES];
+    unsigned long misses[CACHE_CLASSES];
+} MemoryCache;
+
+#ifndef _WIN32
+static pthread_key_t cache_key;
+#else
+static DWORD cache_slot = FLS_OUT_OF_INDEXES;
+#endif
+static bool cache_initialized = false;
+
+static void
+#ifdef _WIN32
+WINAPI
+#endif
+cache_free(void* data)
+{
+    MemoryCache* cache = (MemoryCache *) data;
+    int i;
+
+    if (cache == NULL) {
+        return;
+    }
+    for (i = 0; i < CACHE_CLASSES; i++) {
+        while (cache->free[i] != NULL) {
+            CacheHeader* block = cache->free[i];
+            cache->free[i] = block->next;
+            free(block);
+        }
+    }
+    free(cache);
+}
+
+static MemoryCache*
+cache_get(void)
+{
+    MemoryCache* cache;
+
+    if (!cache_initialized) {
+        return NULL;
+    }
+#ifndef _WIN32
+    cache = (MemoryCache *) pthread_getspecific(cache_key);
+#else
+    cache = (MemoryCache *) FlsGetValue(cache_slot);
+#endif
+    if (cache == NULL) {
+        cache = (MemoryCache *) calloc(1, sizeof(*cache));
+        if (cache == NULL) {
+            return NULL;
+        }
+#ifndef _WIN32
+        if (pthread_setspecific(cache_key, cache) != 0) {
+#else
+        if (!FlsSetValue(cache_slot, cache)) {
+#endif
+            free(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+static int
+size_class(size_t size)
+{
+    int i = 0;
+
+    while (((size_t) 1 << (CACHE_MIN_SHIFT + i)) < size) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Allocate at least +size+ bytes, aligned like malloc.  Returns NULL if the
+ * memory is exhausted.
+ */
+void*
+rbffi_MemoryCache_Alloc(size_t size)
+{
+    CacheHeader* block = NULL;
+    int i = -1;
+
+    if (size <= CACHE_MAX_SIZE) {
+        MemoryCache* cache = cache_get();
+
+        i = size_class(size);
+        size = (size_t) 1 << (CACHE_MIN_SHIFT + i);
+        if (cache != NULL && (block = cache->free[i]) != NULL) {
+            cache->free[i] = block->next;
+            cache->count[i]--;
+            cache->hits[i]++;
+        } else if (cache != NULL) {
+            cache->misses[i]++;
+        }
+    } else if (size > (size_t) LONG_MAX - sizeof(CacheHeader)) {
+        return NULL;
+    }
+
+    if (block == NULL) {
+        block = (CacheHeader *) malloc(sizeof(CacheHeader) + size);
+        if (block == NULL) {
+            /* Let the GC release unreachable memory, like xmalloc does */
+            rb_gc();
+            block = (CacheHeader *) malloc(sizeof(CacheHeader) + size);
+            if (block == NULL) {
+                return NULL;
+            }
+        }
+    }
+
+    block->size = size;
+    rb_gc_adjust_memory_usage((ssize_t) size);
+
+    return block + 1;
+}
+
+/* Release memory of rbffi_MemoryCache_Alloc() */
+void
+rbffi_MemoryCache_Free(void* ptr)
+{
+    CacheHeader* block;
+    size_t size;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    block = (CacheHeader *) ptr - 1;
+    size = block->size;
+    rb_gc_adjust_memory_usage(-(ssize_t) size);
+
+    if (size <= CACHE_MAX_SIZE) {
+        MemoryCache* cache = cache_get();
+        int i = size_class(size);
+
+        if (cache != NULL && cache->count[i] < cache_class_bytes / (long) size) {
+            block->next = cache->free[i];
+            cache->free[i] = block;
+            cache->count[i]++;
+            return;
+        }
+    }
+
+    free(block);
+}
+
+/*
+ * call-seq: memory_cache_stats
+ * @return [Hash{Integer => Hash}] block size => { free:, hits:, misses: }
+ * Usage of the freelists of small memory blocks of the calling thread, which back
+ * {MemoryPointer} and {Buffer}.  +free+ is the number of cached blocks, +hits+ and
+ * +misses+ count the allocations served from the freelist or by malloc.
+ */
+static VALUE
+memory_cache_stats(VALUE self)
+{
+    MemoryCache* cache = cache_get();
+    VALUE rbStats = rb_hash_new();
+    int i;
+
+    for (i = 0; i < CACHE_CLASSES; i++) {
+        VALUE rbClass = rb_hash_new();
+
+        rb_hash_aset(rbClass, ID2SYM(rb_intern("free")), LONG2NUM(cache != NULL ? cache->count[i] : 0));
+        rb_hash_aset(rbClass, ID2SYM(rb_intern("hits")), ULONG2NUM(cache != NULL ? cache->hits[i] : 0));
+        rb_hash_aset(rbClass, ID2SYM(rb_intern("misses")), ULONG2NUM(cache != NULL ? cache->misses[i] : 0));
+        rb_hash_aset(rbStats, INT2FIX(1 << (CACHE_MIN_SHIFT + i)), rbClass);
+    }
+
+    return rbStats;
+}
+
+/*
+ * call-seq: memory_cache_limit
+ * @return [Integer] maximum number of bytes cached per block size and thread, 256 KiB by default
+ */
+static VALUE
+memory_cache_get_limit(VALUE self)
+{
+    return LONG2NUM(cache_class_bytes);
+}
+
+/*
+ * call-seq: memory_cache_limit=(bytes)
+ * @param [Integer] bytes maximum number of bytes cached per block size and thread, +0+ disables the cache
+ * @return [Integer] +bytes+
+ * Cached blocks are only released when their thread exits, so every thread that
+ * released blocks keeps up to 9 times the limit, one for each block size.  Blocks
+ * already cached are kept when the limit is lowered.
+ */
+static VALUE
+memory_cache_set_limit(VALUE self, VALUE bytes)
+{
+    long n = NUM2LONG(bytes);
+
+    if (n < 0) {
+        rb_raise(rb_eArgError, "memory cache limit must not be negative");
+    }
+    cache_class_bytes = n;
+
+    return bytes;
+}
+
+void
+rbffi_MemoryCache_Init(VALUE moduleFFI)
+{
+#ifndef _WIN32
+    cache_initialized = pthread_key_create(&cache_key, cache_free) == 0;
+#else
+    cache_slot = FlsAlloc(cache_free);
+    cache_initialized = cache_slot != FLS_OUT_OF_INDEXES;
+#endif
+
+    rb_define_module_function(moduleFFI, "memory_cache_stats", memory_cache_stats, 0);
+    rb_define_module_function(moduleFFI, "memory_cache_limit", memory_cache_get_limit, 0);
+    rb_define_module_function(moduleFFI, "memory_cache_limit=", memory_cache_set_limit, 1);
+}
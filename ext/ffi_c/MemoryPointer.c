@@ -36,6 +36,7 @@
 #include "AbstractMemory.h"
 #include "Pointer.h"
 #include "MemoryPointer.h"
+#include "MemoryCache.h"
 
 
 static VALUE memptr_allocate(VALUE klass);
@@ -44,6 +45,19 @@ static size_t memptr_memsize(const void *data);
 static VALUE memptr_malloc(VALUE self, long size, long count, bool clear);
 static VALUE memptr_free(VALUE self);
 
+/*
+ * Memory of up to MEMPTR_EMBED_MAXLEN bytes is stored right behind the Pointer
+ * struct, so that small pointers (struct values, out-params) need a single
+ * allocation only.  The struct is malloc'ed, so the address doesn't move on GC
+ * compaction.
+ */
+#define MEMPTR_EMBED_MAXLEN (64)
+
+typedef struct MemoryPointer_ {
+    Pointer base;
+    uint64_t embed[MEMPTR_EMBED_MAXLEN / sizeof(uint64_t)];
+} MemoryPointer;
+
 VALUE rbffi_MemoryPointerClass;
 
 #define MEMPTR(obj) ((MemoryPointer *) rbffi_AbstractMemory_Cast(obj, &memory_pointer_data_type))
@@ -70,10 +84,10 @@ static const rb_data_type_t memory_pointer_data_type = {
 static VALUE
 memptr_allocate(VALUE klass)
 {
-    Pointer* p;
-    VALUE obj = TypedData_Make_Struct(klass, Pointer, &memory_pointer_data_type, p);
-    RB_OBJ_WRITE(obj, &p->rbParent, Qnil);
-    p->memory.flags = MEM_RD | MEM_WR;
+    MemoryPointer* p;
+    VALUE obj = TypedData_Make_Struct(klass, MemoryPointer, &memory_pointer_data_type, p);
+    RB_OBJ_WRITE(obj, &p->base.rbParent, Qnil);
+    p->base.memory.flags = MEM_RD | MEM_WR;
 
     return obj;
 }
@@ -105,23 +119,32 @@ memptr_initialize(int argc, VALUE* argv, VALUE self)
 static VALUE
 memptr_malloc(VALUE self, long size, long count, bool clear)
 {
+    MemoryPointer* mp;
     Pointer* p;
     unsigned long msize;
 
-    TypedData_Get_Struct(self, Pointer, &memory_pointer_data_type, p);
+    TypedData_Get_Struct(self, MemoryPointer, &memory_pointer_data_type, mp);
+    p = &mp->base;
 
     msize = size * count;
 
-    p->storage = xmalloc(msize + 7);
-    if (p->storage == NULL) {
-        rb_raise(rb_eNoMemError, "Failed to allocate memory size=%ld bytes", msize);
-        return Qnil;
+    if (msize <= MEMPTR_EMBED_MAXLEN) {
+        p->storage = NULL;
+        p->memory.flags |= MEM_EMBED;
+        p->memory.address = (char *) mp->embed;
+    } else {
+        p->storage = rbffi_MemoryCache_Alloc(msize);
+        if (p->storage == NULL) {
+            rb_raise(rb_eNoMemError, "Failed to allocate memory size=%ld bytes", msize);
+            return Qnil;
+        }
+        p->memory.flags &= ~MEM_EMBED;
+        /* the memory cache aligns like malloc */
+        p->memory.address = p->storage;
     }
     p->autorelease = true;
     p->memory.typeSize = (int) size;
     p->memory.size = msize;
-    /* ensure the memory is aligned on at least a 8 byte boundary */
-    p->memory.address = (char *) (((uintptr_t) p->storage + 0x7) & (uintptr_t) ~0x7ULL);
     p->allocated = true;
 
     if (clear && p->memory.size > 0) {
@@ -141,7 +164,7 @@ memptr_free(VALUE self)
 
     if (ptr->allocated) {
         if (ptr->storage != NULL) {
-            xfree(ptr->storage);
+            rbffi_MemoryCache_Free(ptr->storage);
             ptr->storage = NULL;
         }
         ptr->allocated = false;
@@ -155,9 +178,16 @@ memptr_release(void *data)
 {
     Pointer *ptr = (Pointer *)data;
     if (ptr->autorelease && ptr->allocated && ptr->storage != NULL) {
-        xfree(ptr->storage);
+        rbffi_MemoryCache_Free(ptr->storage);
         ptr->storage = NULL;
     }
+    /*
+     * Embedded memory with autorelease disabled has to outlive the object,
+     * like malloc'ed memory does, so the struct is intentionally leaked.
+     */
+    if ((ptr->memory.flags & MEM_EMBED) != 0 && ptr->allocated && !ptr->autorelease) {
+        return;
+    }
     xfree(ptr);
 }
 
@@ -165,8 +195,8 @@ static size_t
 memptr_memsize(const void *data)
 {
     const Pointer *ptr = (const Pointer *)data;
-    size_t memsize = sizeof(Pointer);
-    if (ptr->allocated) {
+    size_t memsize = sizeof(MemoryPointer);
+    if (ptr->allocated && ptr->storage != NULL) {
         memsize += ptr->memory.size;
     }
     return memsize;
@@ -0,0 +1,765 @@
+/*
+ * Copyright (c) 2008-2013, Ruby FFI project contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Ruby FFI project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MSC_VER
+#include <sys/param.h>
+#endif
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ruby.h>
+
+#include <ffi.h>
+#include "extconf.h"
+#include "rbffi.h"
+#include "compat.h"
+#include "AbstractMemory.h"
+#include "Pointer.h"
+#include "Type.h"
+#include "Types.h"
+#include "ArrayType.h"
+#include "MappedType.h"
+#include "ClosurePool.h"
+#include "NativeCallback.h"
+
+/*
+ * Callbacks implemented in C, which only look at fields at fixed offsets of the records
+ * they are passed.  They are called without the GVL and never enter ruby, so they are
+ * safe to pass to sorting, searching or hashing functions running on any thread.
+ */
+
+typedef enum {
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE
+} NativeOp;
+
+typedef struct NativeKey_ {
+    NativeType type;
+    long offset;
+    /* length of char arrays */
+    long size;
+    /* 1 for ascending, -1 for descending order */
+    int order;
+    NativeOp op;
+    /* predicate operand, laid out like the field */
+    union {
+        int64_t i64;
+        uint64_t u64;
+        double f64;
+        void* ptr;
+    } value;
+    char* string;
+} NativeKey;
+
+typedef struct NativeCallbackKind_ {
+    const char* name;
+    ffi_type* returnType;
+    int parameterCount;
+    void (*handler)(ffi_cif* cif, void* retval, void** parameters, void* user_data);
+    /* called by the custom trampoline, with the closure as additional last argument */
+    void* direct;
+    ffi_cif cif;
+    ffi_type* parameterTypes[2];
+    ClosurePool* pool;
+} NativeCallbackKind;
+
+typedef struct NativeCallback_ {
+    Pointer base;
+    NativeCallbackKind* kind;
+    Closure* closure;
+    int keyCount;
+    NativeKey* keys;
+} NativeCallback;
+
+static void native_compare(ffi_cif* cif, void* retval, void** parameters, void* user_data);
+static void native_predicate(ffi_cif* cif, void* retval, void** parameters, void* user_data);
+static void native_hash(ffi_cif* cif, void* retval, void** parameters, void* user_data);
+static int direct_compare(const void* a, const void* b, Closure* closure);
+static int direct_predicate(const void* record, Closure* closure);
+static size_t direct_hash(const void* record, Closure* closure);
+
+static NativeCallbackKind kinds[] = {
+    { "compare", &ffi_type_sint, 2, native_compare, (void *) direct_compare },
+    { "predicate", &ffi_type_sint, 1, native_predicate, (void *) direct_predicate },
+    { "hash", NULL, 1, native_hash, (void *) direct_hash },
+};
+
+#if defined(__x86_64__) && \
+    (defined(__linux__) || defined(__APPLE__)) && \
+    !USE_FFI_ALLOC
+# define CUSTOM_TRAMPOLINE 1
+#endif
+
+VALUE rbffi_NativeCallbackClass = Qnil;
+
+static void ncb_mark(void *data);
+static void ncb_compact(void *data);
+static void ncb_free(void *data);
+static size_t ncb_memsize(const void *data);
+
+static const rb_data_type_t native_callback_data_type = {
+    .wrap_struct_name = "FFI::NativeCallback",
+    .function = {
+        .dmark = ncb_mark,
+        .dfree = ncb_free,
+        .dsize = ncb_memsize,
+        ffi_compact_callback( ncb_compact )
+    },
+    .parent = &rbffi_pointer_data_type,
+    // IMPORTANT: WB_PROTECTED objects must only use the RB_OBJ_WRITE()
+    // macro to update VALUE references, as to trigger write barriers.
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static VALUE
+ncb_allocate(VALUE klass)
+{
+    NativeCallback* ncb;
+    VALUE obj = TypedData_Make_Struct(klass, NativeCallback, &native_callback_data_type, ncb);
+
+    ncb->base.memory.flags = MEM_RD;
+    RB_OBJ_WRITE(obj, &ncb->base.rbParent, Qnil);
+
+    return obj;
+}
+
+static void
+ncb_mark(void *data)
+{
+    NativeCallback* ncb = (NativeCallback *) data;
+    rb_gc_mark_movable(ncb->base.rbParent);
+}
+
+static void
+ncb_compact(void *data)
+{
+    NativeCallback* ncb = (NativeCallback *) data;
+    ffi_gc_location(ncb->base.rbParent);
+}
+
+static void
+ncb_free(void *data)
+{
+    NativeCallback* ncb = (NativeCallback *) data;
+    int i;
+
+    if (ncb->closure != NULL) {
+        rbffi_Closure_Free(ncb->closure);
+    }
+    for (i = 0; i < ncb->keyCount; i++) {
+        xfree(ncb->keys[i].string);
+    }
+    xfree(ncb->keys);
+    xfree(ncb);
+}
+
+static size_t
+ncb_memsize(const void *data)
+{
+    const NativeCallback* ncb = (const NativeCallback *) data;
+
+    return sizeof(*ncb) + ncb->keyCount * sizeof(*ncb->keys) + (ncb->closure != NULL ? sizeof(Closure) : 0);
+}
+
+#define CMP_FIELD(T) do { \
+    T x_, y_; \
+    memcpy(&x_, a, sizeof(T)); \
+    memcpy(&y_, b, sizeof(T)); \
+    return (x_ > y_) - (x_ < y_); \
+} while (0)
+
+/* Compare the field values at a and b, returning -1, 0 or 1 */
+static int
+key_compare(const NativeKey* key, const char* a, const char* b)
+{
+    switch (key->type) {
+        case NATIVE_INT8:
+            CMP_FIELD(int8_t);
+        case NATIVE_UINT8:
+        case NATIVE_BOOL:
+            CMP_FIELD(uint8_t);
+        case NATIVE_INT16:
+            CMP_FIELD(int16_t);
+        case NATIVE_UINT16:
+            CMP_FIELD(uint16_t);
+        case NATIVE_INT32:
+            CMP_FIELD(int32_t);
+        case NATIVE_UINT32:
+            CMP_FIELD(uint32_t);
+        case NATIVE_INT64:
+            CMP_FIELD(int64_t);
+        case NATIVE_UINT64:
+            CMP_FIELD(uint64_t);
+        case NATIVE_LONG:
+            CMP_FIELD(long);
+        case NATIVE_ULONG:
+            CMP_FIELD(unsigned long);
+        case NATIVE_FLOAT32:
+            CMP_FIELD(float);
+        case NATIVE_FLOAT64:
+            CMP_FIELD(double);
+        case NATIVE_POINTER:
+            CMP_FIELD(uintptr_t);
+
+        case NATIVE_STRING: {
+            const char *x, *y;
+            int result;
+            memcpy(&x, a, sizeof(x));
+            memcpy(&y, b, sizeof(y));
+            /* NULL sorts before any string */
+            if (x == NULL || y == NULL) {
+                return (x != NULL) - (y != NULL);
+            }
+            result = strcmp(x, y);
+            return (result > 0) - (result < 0);
+        }
+
+        case NATIVE_ARRAY: {
+            int result = strncmp(a, b, key->size);
+            return (result > 0) - (result < 0);
+        }
+
+        default:
+            return 0;
+    }
+}
+
+static int
+ncb_compare(const NativeCallback* ncb, const char* a, const char* b)
+{
+    int i, result = 0;
+
+    if (a == NULL || b == NULL) {
+        return (a != NULL) - (b != NULL);
+    }
+
+    for (i = 0; i < ncb->keyCount && result == 0; i++) {
+        const NativeKey* key = &ncb->keys[i];
+        result = key->order * key_compare(key, a + key->offset, b + key->offset);
+    }
+
+    return result;
+}
+
+static int
+ncb_predicate(const NativeCallback* ncb, const char* record)
+{
+    bool match = record != NULL;
+    int i;
+
+    for (i = 0; i < ncb->keyCount && match; i++) {
+        const NativeKey* key = &ncb->keys[i];
+        const char* operand = key->type == NATIVE_ARRAY ? key->string : (const char *) &key->value;
+        int result = key_compare(key, record + key->offset, operand);
+
+        switch (key->op) {
+            case OP_EQ: match = result == 0; break;
+            case OP_NE: match = result != 0; break;
+            case OP_LT: match = result < 0; break;
+            case OP_LE: match = result <= 0; break;
+            case OP_GT: match = result > 0; break;
+            case OP_GE: match = result >= 0; break;
+        }
+    }
+
+    return match;
+}
+
+/* 64 bit FNV-1a, folded to the size of size_t */
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t
+fnv1a(uint64_t hash, const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char *) data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static size_t
+ncb_hash(const NativeCallback* ncb, const char* record)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    int i;
+
+    for (i = 0; i < ncb->keyCount && record != NULL; i++) {
+        const NativeKey* key = &ncb->keys[i];
+        const char* field = record + key->offset;
+
+        switch (key->type) {
+            case NATIVE_STRING: {
+                const char* s;
+                memcpy(&s, field, sizeof(s));
+                hash = s != NULL ? fnv1a(hash, s, strlen(s) + 1) : fnv1a(hash, "", 0);
+                break;
+            }
+
+            case NATIVE_ARRAY: {
+                const char* end = memchr(field, 0, key->size);
+                hash = fnv1a(hash, field, end != NULL ? (size_t) (end - field) : (size_t) key->size);
+                break;
+            }
+
+            case NATIVE_FLOAT32: {
+                float f;
+                memcpy(&f, field, sizeof(f));
+                /* 0.0 and -0.0 are equal, so they have to hash the same */
+                f = f == 0.0f ? 0.0f : f;
+                hash = fnv1a(hash, &f, sizeof(f));
+                break;
+            }
+
+            case NATIVE_FLOAT64: {
+                double d;
+                memcpy(&d, field, sizeof(d));
+                d = d == 0.0 ? 0.0 : d;
+                hash = fnv1a(hash, &d, sizeof(d));
+                break;
+            }
+
+            default:
+                hash = fnv1a(hash, field, key->size);
+                break;
+        }
+    }
+
+    if (sizeof(size_t) < sizeof(hash)) {
+        hash ^= hash >> 32;
+    }
+
+    return (size_t) hash;
+}
+
+static void
+native_compare(ffi_cif* cif, void* retval, void** parameters, void* user_data)
+{
+    NativeCallback* ncb = (NativeCallback *) ((Closure *) user_data)->info;
+    *(ffi_sarg *) retval = ncb_compare(ncb, *(const char **) parameters[0], *(const char **) parameters[1]);
+}
+
+static void
+native_predicate(ffi_cif* cif, void* retval, void** parameters, void* user_data)
+{
+    NativeCallback* ncb = (NativeCallback *) ((Closure *) user_data)->info;
+    *(ffi_sarg *) retval = ncb_predicate(ncb, *(const char **) parameters[0]);
+}
+
+static void
+native_hash(ffi_cif* cif, void* retval, void** parameters, void* user_data)
+{
+    NativeCallback* ncb = (NativeCallback *) ((Closure *) user_data)->info;
+    *(ffi_arg *) retval = (ffi_arg) ncb_hash(ncb, *(const char **) parameters[0]);
+}
+
+static int
+direct_compare(const void* a, const void* b, Closure* closure)
+{
+    return ncb_compare((const NativeCallback *) closure->info, a, b);
+}
+
+static int
+direct_predicate(const void* record, Closure* closure)
+{
+    return ncb_predicate((const NativeCallback *) closure->info, record);
+}
+
+static size_t
+direct_hash(const void* record, Closure* closure)
+{
+    return ncb_hash((const NativeCallback *) closure->info, record);
+}
+
+#if defined(CUSTOM_TRAMPOLINE)
+
+/*
+ * The native callbacks take one or two pointer arguments, which are passed in %rdi and %rsi.
+ * Like the trampoline of attached methods, the stub tacks the closure on as next register
+ * argument and jumps straight into the C handler, which skips the argument marshalling of
+ * libffi closures.  Comparators are called several hundred million times when sorting large
+ * arrays, so this matters.
+ */
+static const unsigned char trampoline_template[] = {
+    0x48, 0xba, 0, 0, 0, 0, 0, 0, 0, 0,     /* movabsq $closure, %rdx */
+    0x49, 0xbb, 0, 0, 0, 0, 0, 0, 0, 0,     /* movabsq $function, %r11 */
+    0x41, 0xff, 0xe3                        /* jmpq *%r11 */
+};
+
+#define TRAMPOLINE_CTX_OFFSET 2
+#define TRAMPOLINE_FUN_OFFSET 12
+
+static bool
+ncb_prep(void* ctx, void* code, Closure* closure, char* errmsg, size_t errmsgsize)
+{
+    NativeCallbackKind* kind = (NativeCallbackKind *) ctx;
+    unsigned char* stub = (unsigned char *) code;
+    intptr_t value;
+
+    memcpy(stub, trampoline_template, sizeof(trampoline_template));
+    if (kind->parameterCount == 1) {
+        stub[1] = 0xbe; /* movabsq $closure, %rsi */
+    }
+
+    /* Patch the context and function addresses into the stub code */
+    value = (intptr_t) closure;
+    memcpy(stub + TRAMPOLINE_CTX_OFFSET, &value, sizeof(value));
+    value = (intptr_t) kind->direct;
+    memcpy(stub + TRAMPOLINE_FUN_OFFSET, &value, sizeof(value));
+
+    return true;
+}
+
+static int
+trampoline_size(void)
+{
+    return (int) sizeof(trampoline_template);
+}
+
+#else
+
+static bool
+ncb_prep(void* ctx, void* code, Closure* closure, char* errmsg, size_t errmsgsize)
+{
+    NativeCallbackKind* kind = (NativeCallbackKind *) ctx;
+    ffi_status ffiStatus;
+
+    ffiStatus = ffi_prep_closure_loc(closure->pcl, &kind->cif, kind->handler, closure, code);
+    if (ffiStatus != FFI_OK) {
+        snprintf(errmsg, errmsgsize, "ffi_prep_closure_loc failed.  status=%#x", ffiStatus);
+        return false;
+    }
+
+    return true;
+}
+
+static int
+trampoline_size(void)
+{
+    return (int) sizeof(ffi_closure);
+}
+
+#endif /* CUSTOM_TRAMPOLINE */
+
+static void
+key_type(NativeKey* key, VALUE rbType)
+{
+    VALUE rbLookup = rbffi_Type_Lookup(rbType);
+    Type* type = NULL;
+
+    if (rbLookup != Qnil) {
+        TypedData_Get_Struct(rbLookup, Type, &rbffi_type_data_type, type);
+        if (type->nativeType == NATIVE_MAPPED) {
+            type = ((MappedType *) type)->type;
+        }
+    }
+
+    switch (type != NULL ? type->nativeType : NATIVE_VOID) {
+        case NATIVE_INT8:
+        case NATIVE_UINT8:
+        case NATIVE_INT16:
+        case NATIVE_UINT16:
+        case NATIVE_INT32:
+        case NATIVE_UINT32:
+        case NATIVE_INT64:
+        case NATIVE_UINT64:
+        case NATIVE_LONG:
+        case NATIVE_ULONG:
+        case NATIVE_FLOAT32:
+        case NATIVE_FLOAT64:
+        case NATIVE_BOOL:
+        case NATIVE_POINTER:
+        case NATIVE_STRING:
+            key->type = type->nativeType;
+            key->size = (long) type->ffiType->size;
+            return;
+
+        case NATIVE_ARRAY:
+            /* char arrays compare like fixed size strings */
+            if (((ArrayType *) type)->componentType->nativeType == NATIVE_INT8
+                    || ((ArrayType *) type)->componentType->nativeType == NATIVE_UINT8) {
+                key->type = NATIVE_ARRAY;
+                key->size = ((ArrayType *) type)->length;
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    rbType = rb_funcall2(rbType, rb_intern("inspect"), 0, NULL);
+    rb_raise(rb_eTypeError, "Invalid key type (%s)", RSTRING_PTR(rbType));
+}
+
+static int
+key_order(VALUE rbOrder)
+{
+    if (rbOrder == Qnil || rbOrder == ID2SYM(rb_intern("asc"))) {
+        return 1;
+    } else if (rbOrder == ID2SYM(rb_intern("desc"))) {
+        return -1;
+    }
+
+    rbOrder = rb_funcall2(rbOrder, rb_intern("inspect"), 0, NULL);
+    rb_raise(rb_eArgError, "Invalid sort order (%s)", RSTRING_PTR(rbOrder));
+}
+
+static NativeOp
+key_op(VALUE rbOp)
+{
+    static const char* ops[] = { "==", "!=", "<", "<=", ">", ">=" };
+    int i;
+
+    for (i = 0; i < (int) (sizeof(ops) / sizeof(ops[0])); i++) {
+        if (rbOp == ID2SYM(rb_intern(ops[i]))) {
+            return (NativeOp) i;
+        }
+    }
+
+    rbOp = rb_funcall2(rbOp, rb_intern("inspect"), 0, NULL);
+    rb_raise(rb_eArgError, "Invalid operator (%s)", RSTRING_PTR(rbOp));
+}
+
+#define SET_VALUE(T, v) do { \
+    T v_ = (T) (v); \
+    memcpy(&key->value, &v_, sizeof(v_)); \
+} while (0)
+
+static void
+key_value(NativeKey* key, VALUE rbValue)
+{
+    switch (key->type) {
+        case NATIVE_INT8:
+            SET_VALUE(int8_t, NUM2INT(rbValue));
+            break;
+        case NATIVE_UINT8:
+            SET_VALUE(uint8_t, NUM2UINT(rbValue));
+            break;
+        case NATIVE_INT16:
+            SET_VALUE(int16_t, NUM2INT(rbValue));
+            break;
+        case NATIVE_UINT16:
+            SET_VALUE(uint16_t, NUM2UINT(rbValue));
+            break;
+        case NATIVE_INT32:
+            SET_VALUE(int32_t, NUM2INT(rbValue));
+            break;
+        case NATIVE_UINT32:
+            SET_VALUE(uint32_t, NUM2UINT(rbValue));
+            break;
+        case NATIVE_INT64:
+            SET_VALUE(int64_t, NUM2LL(rbValue));
+            break;
+        case NATIVE_UINT64:
+            SET_VALUE(uint64_t, NUM2ULL(rbValue));
+            break;
+        case NATIVE_LONG:
+            SET_VALUE(long, NUM2LONG(rbValue));
+            break;
+        case NATIVE_ULONG:
+            SET_VALUE(unsigned long, NUM2ULONG(rbValue));
+            break;
+        case NATIVE_FLOAT32:
+            SET_VALUE(float, NUM2DBL(rbValue));
+            break;
+        case NATIVE_FLOAT64:
+            SET_VALUE(double, NUM2DBL(rbValue));
+            break;
+        case NATIVE_BOOL:
+            SET_VALUE(uint8_t, RTEST(rbValue));
+            break;
+
+        case NATIVE_POINTER:
+            if (rbValue == Qnil) {
+                key->value.ptr = NULL;
+            } else if (rb_obj_is_kind_of(rbValue, rbffi_AbstractMemoryClass)) {
+                AbstractMemory* mem;
+                TypedData_Get_Struct(rbValue, AbstractMemory, &rbffi_abstract_memory_data_type, mem);
+                key->value.ptr = mem->address;
+            } else {
+                rb_raise(rb_eTypeError, "wrong argument type %s, expected pointer", rb_obj_classname(rbValue));
+            }
+            break;
+
+        case NATIVE_STRING:
+            if (rbValue != Qnil) {
+                const char* s = StringValueCStr(rbValue);
+                key->string = xmalloc(strlen(s) + 1);
+                strcpy(key->string, s);
+            }
+            key->value.ptr = key->string;
+            break;
+
+        case NATIVE_ARRAY:
+            StringValue(rbValue);
+            key->string = xcalloc(1, key->size + 1);
+            memcpy(key->string, RSTRING_PTR(rbValue), MIN(RSTRING_LEN(rbValue), key->size));
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * call-seq: initialize(kind, keys)
+ * @param [Symbol] kind +:compare+, +:predicate+ or +:hash+
+ * @param [Array<Array>] keys fields to look at, in order of significance.
+ *   Comparator keys are +[type, offset, order]+, predicate keys +[type, offset, operator, value]+
+ *   and hash keys +[type, offset]+.
+ * @return [self]
+ * A native callback over the fields of the records it is passed.  See {FFI::NativeCallback.compare},
+ * {FFI::NativeCallback.predicate} and {FFI::NativeCallback.hash_of} for the usual constructors.
+ */
+static VALUE
+ncb_initialize(VALUE self, VALUE rbKind, VALUE rbKeys)
+{
+    NativeCallback* ncb;
+    NativeCallbackKind* kind = NULL;
+    long i, keyCount;
+    int k;
+
+    TypedData_Get_Struct(self, NativeCallback, &native_callback_data_type, ncb);
+    if (ncb->closure != NULL) {
+        rb_raise(rb_eRuntimeError, "native callback already initialized");
+    }
+
+    for (k = 0; k < (int) (sizeof(kinds) / sizeof(kinds[0])); k++) {
+        if (rbKind == ID2SYM(rb_intern(kinds[k].name))) {
+            kind = &kinds[k];
+        }
+    }
+    if (kind == NULL) {
+        rbKind = rb_funcall2(rbKind, rb_intern("inspect"), 0, NULL);
+        rb_raise(rb_eArgError, "Invalid native callback kind (%s)", RSTRING_PTR(rbKind));
+    }
+
+    Check_Type(rbKeys, T_ARRAY);
+    keyCount = RARRAY_LEN(rbKeys);
+    if (keyCount < 1) {
+        rb_raise(rb_eArgError, "no keys given");
+    }
+
+    ncb->kind = kind;
+    ncb->keys = ZALLOC_N(NativeKey, keyCount);
+    ncb->keyCount = (int) keyCount;
+
+    for (i = 0; i < keyCount; i++) {
+        NativeKey* key = &ncb->keys[i];
+        VALUE rbKey = RARRAY_AREF(rbKeys, i);
+        long len = kind->handler == native_predicate ? 4 : kind->handler == native_compare ? 3 : 2;
+
+        Check_Type(rbKey, T_ARRAY);
+        if (RARRAY_LEN(rbKey) < 2 || RARRAY_LEN(rbKey) > len) {
+            rb_raise(rb_eArgError, "wrong number of key elements (%ld for 2..%ld)", RARRAY_LEN(rbKey), len);
+        }
+
+        key_type(key, RARRAY_AREF(rbKey, 0));
+        key->offset = NUM2LONG(RARRAY_AREF(rbKey, 1));
+        if (key->offset < 0) {
+            rb_raise(rb_eArgError, "negative key offset");
+        }
+
+        if (kind->handler == native_compare) {
+            key->order = key_order(rb_ary_entry(rbKey, 2));
+
+        } else if (kind->handler == native_predicate) {
+            if (RARRAY_LEN(rbKey) != 4) {
+                rb_raise(rb_eArgError, "predicate keys need an operator and a value");
+            }
+            key->op = key_op(RARRAY_AREF(rbKey, 2));
+            key_value(key, RARRAY_AREF(rbKey, 3));
+        }
+    }
+
+    ncb->closure = rbffi_Closure_Alloc(kind->pool);
+    ncb->closure->info = ncb;
+    ncb->base.memory.address = ncb->closure->code;
+    ncb->base.memory.size = sizeof(*ncb->closure);
+
+    return self;
+}
+
+/*
+ * call-seq: kind
+ * @return [Symbol] +:compare+, +:predicate+ or +:hash+
+ */
+static VALUE
+ncb_kind(VALUE self)
+{
+    NativeCallback* ncb;
+
+    TypedData_Get_Struct(self, NativeCallback, &native_callback_data_type, ncb);
+
+    return ncb->kind != NULL ? ID2SYM(rb_intern(ncb->kind->name)) : Qnil;
+}
+
+void
+rbffi_NativeCallback_Init(VALUE moduleFFI)
+{
+    char name[32];
+    int k;
+
+    for (k = 0; k < (int) (sizeof(kinds) / sizeof(kinds[0])); k++) {
+        NativeCallbackKind* kind = &kinds[k];
+
+        kind->parameterTypes[0] = kind->parameterTypes[1] = &ffi_type_pointer;
+        if (kind->returnType == NULL) {
+            /* size_t */
+            kind->returnType = sizeof(size_t) == 8 ? &ffi_type_uint64 : &ffi_type_uint32;
+        }
+        if (ffi_prep_cif(&kind->cif, FFI_DEFAULT_ABI, kind->parameterCount, kind->returnType,
+                kind->parameterTypes) != FFI_OK) {
+            rb_raise(rb_eRuntimeError, "failed to prepare native %s callback", kind->name);
+        }
+        snprintf(name, sizeof(name), "native %s", kind->name);
+        kind->pool = rbffi_ClosurePool_New(trampoline_size(), ncb_prep, kind, name);
+    }
+
+    /*
+     * Document-class: FFI::NativeCallback < FFI::Pointer
+     * A comparator, predicate or hash callback implemented in C.
+     * It's called without entering ruby, so it neither needs the GVL nor allocates.
+     */
+    rbffi_NativeCallbackClass = rb_define_class_under(moduleFFI, "NativeCallback", rbffi_PointerClass);
+    rb_global_variable(&rbffi_NativeCallbackClass);
+    rb_define_alloc_func(rbffi_NativeCallbackClass, ncb_allocate);
+
+    rb_define_method(rbffi_NativeCallbackClass, "initialize", ncb_initialize, 2);
+    rb_define_method(rbffi_NativeCallbackClass, "kind", ncb_kind, 0);
+}
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2008-2013, Ruby FFI project contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Ruby FFI project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MSC_VER
+#include <sys/param.h>
+#endif
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#if defined(__CYGWIN__) || !defined(_WIN32)
+# include <unistd.h>
+# include <fcntl.h>
+# define NOTIFIER_FD 1
+#endif
+#include <ruby.h>
+#include <ruby/io.h>
+
+#include <ffi.h>
+#include "extconf.h"
+#ifdef HAVE_SYS_EVENTFD_H
+# include <sys/eventfd.h>
+#endif
+#include "rbffi.h"
+#include "compat.h"
+#include "AbstractMemory.h"
+#include "Pointer.h"
+#include "ClosurePool.h"
+#include "Notifier.h"
+
+/*
+ * Signals from native code to ruby which don't carry data.  Signalling neither takes the
+ * GVL nor allocates, it only writes to an eventfd (or a pipe), so it's also safe from
+ * signal handlers.  Signals arriving before ruby looks at the notifier are coalesced
+ * into a counter.
+ */
+
+typedef struct Notifier_ {
+    Pointer base;
+    Closure* closure;
+    /* read and write end, both are the same eventfd if available */
+    int fds[2];
+    /* signals since the last take, without eventfd */
+    long pending;
+} Notifier;
+
+VALUE rbffi_NotifierClass = Qnil;
+
+static ffi_cif notifier_cif;
+static ClosurePool* notifier_pool = NULL;
+
+static void notifier_mark(void *data);
+static void notifier_compact(void *data);
+static void notifier_free(void *data);
+static size_t notifier_memsize(const void *data);
+
+static const rb_data_type_t notifier_data_type = {
+    .wrap_struct_name = "FFI::Notifier",
+    .function = {
+        .dmark = notifier_mark,
+        .dfree = notifier_free,
+        .dsize = notifier_memsize,
+        ffi_compact_callback( notifier_compact )
+    },
+    .parent = &rbffi_pointer_data_type,
+    // IMPORTANT: WB_PROTECTED objects must only use the RB_OBJ_WRITE()
+    // macro to update VALUE references, as to trigger write barriers.
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static VALUE
+notifier_allocate(VALUE klass)
+{
+    Notifier* notifier;
+    VALUE obj = TypedData_Make_Struct(klass, Notifier, &notifier_data_type, notifier);
+
+    notifier->base.memory.flags = MEM_RD;
+    RB_OBJ_WRITE(obj, &notifier->base.rbParent, Qnil);
+    notifier->fds[0] = notifier->fds[1] = -1;
+
+    return obj;
+}
+
+static void
+notifier_mark(void *data)
+{
+    Notifier* notifier = (Notifier *) data;
+    rb_gc_mark_movable(notifier->base.rbParent);
+}
+
+static void
+notifier_compact(void *data)
+{
+    Notifier* notifier = (Notifier *) data;
+    ffi_gc_location(notifier->base.rbParent);
+}
+
+static void
+notifier_free(void *data)
+{
+    Notifier* notifier = (Notifier *) data;
+
+    if (notifier->closure != NULL) {
+        rbffi_Closure_Free(notifier->closure);
+    }
+#ifdef NOTIFIER_FD
+    if (notifier->fds[0] >= 0) {
+        close(notifier->fds[0]);
+    }
+    if (notifier->fds[1] >= 0 && notifier->fds[1] != notifier->fds[0]) {
+        close(notifier->fds[1]);
+    }
+#endif
+    xfree(notifier);
+}
+
+static size_t
+notifier_memsize(const void *data)
+{
+    const Notifier* notifier = (const Notifier *) data;
+
+    return sizeof(*notifier) + (notifier->closure != NULL ? sizeof(Closure) : 0);
+}
+
+static Notifier*
+notifier_get(VALUE self)
+{
+    Notifier* notifier;
+
+    TypedData_Get_Struct(self, Notifier, &notifier_data_type, notifier);
+    if (notifier->closure == NULL) {
+        rb_raise(rb_eRuntimeError, "notifier not initialized");
+    }
+
+    return notifier;
+}
+
+/* Called from any thread, possibly from a signal handler */
+static void
+notifier_signal(void* data)
+{
+#ifdef NOTIFIER_FD
+    Notifier* notifier = (Notifier *) data;
+# ifdef HAVE_SYS_EVENTFD_H
+    uint64_t one = 1;
+    ssize_t ret = write(notifier->fds[1], &one, sizeof(one));
+# else
+    char c = 0;
+    ssize_t ret = 0;
+    /* Only the first signal since the last take needs to wake the reader */
+    if (__atomic_fetch_add(&notifier->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        ret = write(notifier->fds[1], &c, 1);
+    }
+# endif
+    (void) ret;
+#endif
+}
+
+static void
+notifier_closure(ffi_cif* cif, void* retval, void** parameters, void* user_data)
+{
+    notifier_signal(((Closure *) user_data)->info);
+}
+
+static bool
+notifier_prep(void* ctx, void* code, Closure* closure, char* errmsg, size_t errmsgsize)
+{
+    ffi_status ffiStatus;
+
+    ffiStatus = ffi_prep_closure_loc(closure->pcl, &notifier_cif, notifier_closure, closure, code);
+    if (ffiStatus != FFI_OK) {
+        snprintf(errmsg, errmsgsize, "ffi_prep_closure_loc failed.  status=%#x", ffiStatus);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * call-seq: initialize
+ * @return [self]
+ * A notifier is a +void (*)(void)+ callback which native code calls to signal ruby.
+ * Use {#data} with {SIGNAL_FUNCTION} for C APIs taking a +void (*)(void *)+
+ * callback and its user data.
+ */
+static VALUE
+notifier_initialize(VALUE self)
+{
+    Notifier* notifier;
+
+    TypedData_Get_Struct(self, Notifier, &notifier_data_type, notifier);
+    if (notifier->closure != NULL) {
+        rb_raise(rb_eRuntimeError, "notifier already initialized");
+    }
+
+#if defined(NOTIFIER_FD) && defined(HAVE_SYS_EVENTFD_H)
+    notifier->fds[0] = notifier->fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notifier->fds[0] < 0) {
+        rb_sys_fail("eventfd");
+    }
+    rb_update_max_fd(notifier->fds[0]);
+#elif defined(NOTIFIER_FD)
+    if (rb_cloexec_pipe(notifier->fds) < 0) {
+        rb_sys_fail("pipe");
+    }
+    rb_update_max_fd(notifier->fds[0]);
+    rb_update_max_fd(notifier->fds[1]);
+    fcntl(notifier->fds[0], F_SETFL, fcntl(notifier->fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(notifier->fds[1], F_SETFL, fcntl(notifier->fds[1], F_GETFL) | O_NONBLOCK);
+#else
+    rb_raise(rb_eNotImpError, "notifiers are not supported on this platform");
+#endif
+
+    notifier->closure = rbffi_Closure_Alloc(notifier_pool);
+    notifier->closure->info = notifier;
+    notifier->base.memory.address = notifier->closure->code;
+    notifier->base.memory.size = sizeof(*notifier->closure);
+
+    return self;
+}
+
+/*
+ * call-seq: signal
+ * @return [self]
+ * Signal the notifier, like native code calling it does.
+ */
+static VALUE
+notifier_signal_m(VALUE self)
+{
+    notifier_signal(notifier_get(self));
+
+    return self;
+}
+
+/*
+ * call-seq: take
+ * @return [Integer] number of signals since the last take, 0 if there were none
+ * Take the signals without waiting.  See {#wait} to wait for signals.
+ */
+static VALUE
+notifier_take(VALUE self)
+{
+    Notifier* notifier = notifier_get(self);
+    unsigned long long count = 0;
+#ifdef NOTIFIER_FD
+# ifdef HAVE_SYS_EVENTFD_H
+    uint64_t value;
+
+    if (read(notifier->fds[0], &value, sizeof(value)) == sizeof(value)) {
+        count = value;
+    }
+# else
+    char buf[64];
+
+    /*
+     * Drain before taking the count: a signal arriving in between only writes to the
+     * pipe if it found the count taken, so its byte is never lost.  It might leave the
+     * pipe readable with nothing pending though, making the next wait return 0.
+     */
+    while (read(notifier->fds[0], buf, sizeof(buf)) > 0);
+    count = (unsigned long) __atomic_exchange_n(&notifier->pending, 0, __ATOMIC_ACQ_REL);
+# endif
+#endif
+
+    return ULL2NUM(count);
+}
+
+/*
+ * call-seq: fileno
+ * @return [Integer] file descriptor which is readable while signals are pending
+ * Use {#to_io} to wait for signals with +IO.select+ or a fiber scheduler.  Where eventfd
+ * is available, native code may also signal by writing a 64 bit count to the descriptor.
+ */
+static VALUE
+notifier_fileno(VALUE self)
+{
+    return INT2FIX(notifier_get(self)->fds[0]);
+}
+
+/*
+ * call-seq: data
+ * @return [Pointer] user data to pass to {SIGNAL_FUNCTION}
+ */
+static VALUE
+notifier_data(VALUE self)
+{
+    return rbffi_Pointer_NewInstance(notifier_get(self));
+}
+
+void
+rbffi_Notifier_Init(VALUE moduleFFI)
+{
+    /*
+     * Document-class: FFI::Notifier < FFI::Pointer
+     * A callback which only tells ruby that something is ready, without running ruby code
+     * on the calling thread.
+     */
+    rbffi_NotifierClass = rb_define_class_under(moduleFFI, "Notifier", rbffi_PointerClass);
+    rb_global_variable(&rbffi_NotifierClass);
+    rb_define_alloc_func(rbffi_NotifierClass, notifier_allocate);
+
+    rb_define_method(rbffi_NotifierClass, "initialize", notifier_initialize, 0);
+    rb_define_method(rbffi_NotifierClass, "signal", notifier_signal_m, 0);
+    rb_define_method(rbffi_NotifierClass, "take", notifier_take, 0);
+    rb_define_method(rbffi_NotifierClass, "fileno", notifier_fileno, 0);
+    rb_define_method(rbffi_NotifierClass, "data", notifier_data, 0);
+
+    /*
+     * Document-const: FFI::Notifier::SIGNAL_FUNCTION
+     * Address of a +void (*)(void *data)+ function signalling the notifier
+     * passed as {#data}.
+     */
+    rb_define_const(rbffi_NotifierClass, "SIGNAL_FUNCTION", rbffi_Pointer_NewInstance((void *) notifier_signal));
+
+    if (ffi_prep_cif(&notifier_cif, FFI_DEFAULT_ABI, 0, &ffi_type_void, NULL) != FFI_OK) {
+        rb_raise(rb_eRuntimeError, "failed to prepare notifier callback");
+    }
+    notifier_pool = rbffi_ClosurePool_New(sizeof(ffi_closure), notifier_prep, NULL, "notifiers");
+}
@@ -36,6 +36,7 @@
 #include "compat.h"
 #include "AbstractMemory.h"
 #include "Pointer.h"
+#include "MemoryCache.h"
 
 #define POINTER(obj) rbffi_AbstractMemory_Cast((obj), &rbffi_pointer_data_type)
 
@@ -181,11 +182,11 @@ ptr_initialize_copy(VALUE self, VALUE other)
     }
 
     if (dst->storage != NULL) {
-        xfree(dst->storage);
+        rbffi_MemoryCache_Free(dst->storage);
         dst->storage = NULL;
     }
 
-    dst->storage = xmalloc(src->size + 7);
+    dst->storage = rbffi_MemoryCache_Alloc(src->size);
     if (dst->storage == NULL) {
         rb_raise(rb_eNoMemError, "failed to allocate memory size=%lu bytes", src->size);
         return Qnil;
@@ -193,7 +194,8 @@ ptr_initialize_copy(VALUE self, VALUE other)
 
     dst->allocated = true;
     dst->autorelease = true;
-    dst->memory.address = (void *) (((uintptr_t) dst->storage + 0x7) & (uintptr_t) ~0x7ULL);
+    dst->memory.flags &= ~MEM_EMBED;
+    dst->memory.address = dst->storage;
     dst->memory.size = src->size;
     dst->memory.typeSize = src->typeSize;
 
@@ -406,7 +408,7 @@ ptr_free(VALUE self)
 
     if (ptr->allocated) {
         if (ptr->storage != NULL) {
-            xfree(ptr->storage);
+            rbffi_MemoryCache_Free(ptr->storage);
             ptr->storage = NULL;
         }
         ptr->allocated = false;
@@ -469,7 +471,7 @@ ptr_release(void *data)
 {
     Pointer *ptr = (Pointer *)data;
     if (ptr->autorelease && ptr->allocated && ptr->storage != NULL) {
-        xfree(ptr->storage);
+        rbffi_MemoryCache_Free(ptr->storage);
         ptr->storage = NULL;
     }
     xfree(ptr);
@@ -89,7 +89,7 @@ rbffi_NativeValue_ToRuby(Type* type, VALUE rbType, const void* ptr)
 
         case NATIVE_FUNCTION: {
             return *(void **) ptr != NULL
-                    ? rbffi_Function_NewInstance(rbType, rbffi_Pointer_NewInstance(*(void **) ptr))
+                    ? rbffi_Function_ForAddress(rbType, *(void **) ptr)
                     : Qnil;
         }
 
@@ -35,7 +35,9 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <ruby.h>
+#include <ruby/thread_native.h>
 #if HAVE_RB_EXT_RACTOR_SAFE
 #include <ruby/ractor.h>
 #endif
@@ -53,16 +55,37 @@
 #include "Call.h"
 #include "Thread.h"
 
+/* Number of distinct call shapes (vararg types) with a prepared cif per invoker */
+#define VARIADIC_SHAPE_CACHE_SIZE 8
+
+typedef struct VariadicShape_ {
+    int paramCount;
+    ffi_type** ffiParamTypes;
+    ffi_cif cif;
+} VariadicShape;
+
 typedef struct VariadicInvoker_ {
     VALUE rbAddress;
     VALUE rbReturnType;
     VALUE rbEnums;
+    VALUE rbFixedTypes;
+    VALUE rbTypeMap;
 
     Type* returnType;
     ffi_abi abi;
     void* function;
     int paramCount;
+    int fixedCount;
     bool blocking;
+
+    /*
+     * Shapes are only ever appended, under shapeLock, and never change once published
+     * by a release-store of shapeCount, so lookups don't take the lock.  Invokers are
+     * shareable between Ractors, hence the native lock.
+     */
+    rb_nativethread_lock_t shapeLock;
+    int shapeCount;
+    VariadicShape shapes[VARIADIC_SHAPE_CACHE_SIZE];
 } VariadicInvoker;
 
 static VALUE variadic_allocate(VALUE klass);
@@ -70,15 +93,20 @@ static VALUE variadic_initialize(VALUE self, VALUE rbFunction, VALUE rbParameter
         VALUE rbReturnType, VALUE options);
 static void variadic_mark(void *);
 static void variadic_compact(void *);
+static void variadic_free(void *);
 static size_t variadic_memsize(const void *);
 
 static VALUE classVariadicInvoker = Qnil;
+static VALUE rbInt32Type = Qnil, rbUInt32Type = Qnil, rbDoubleType = Qnil;
+static VALUE rbInt64Type = Qnil, rbPointerType = Qnil, rbStringType = Qnil;
+static ID id_find_type = 0, id_ffi_functions = 0, id_define_method = 0, id_to_proc = 0;
+static ID id_data_converter = 0;
 
 static const rb_data_type_t variadic_data_type = {
   .wrap_struct_name = "FFI::VariadicInvoker",
   .function = {
       .dmark = variadic_mark,
-      .dfree = RUBY_TYPED_DEFAULT_FREE,
+      .dfree = variadic_free,
       .dsize = variadic_memsize,
       ffi_compact_callback( variadic_compact )
   },
@@ -97,7 +125,10 @@ variadic_allocate(VALUE klass)
     RB_OBJ_WRITE(obj, &invoker->rbAddress, Qnil);
     RB_OBJ_WRITE(obj, &invoker->rbEnums, Qnil);
     RB_OBJ_WRITE(obj, &invoker->rbReturnType, Qnil);
+    RB_OBJ_WRITE(obj, &invoker->rbFixedTypes, Qnil);
+    RB_OBJ_WRITE(obj, &invoker->rbTypeMap, Qnil);
     invoker->blocking = false;
+    rb_nativethread_lock_initialize(&invoker->shapeLock);
 
     return obj;
 }
@@ -109,6 +140,8 @@ variadic_mark(void *data)
     rb_gc_mark_movable(invoker->rbEnums);
     rb_gc_mark_movable(invoker->rbAddress);
     rb_gc_mark_movable(invoker->rbReturnType);
+    rb_gc_mark_movable(invoker->rbFixedTypes);
+    rb_gc_mark_movable(invoker->rbTypeMap);
 }
 
 static void
@@ -118,12 +151,35 @@ variadic_compact(void *data)
     ffi_gc_location(invoker->rbEnums);
     ffi_gc_location(invoker->rbAddress);
     ffi_gc_location(invoker->rbReturnType);
+    ffi_gc_location(invoker->rbFixedTypes);
+    ffi_gc_location(invoker->rbTypeMap);
+}
+
+static void
+variadic_free(void *data)
+{
+    VariadicInvoker *invoker = (VariadicInvoker *)data;
+    int i;
+
+    for (i = 0; i < invoker->shapeCount; ++i) {
+        free(invoker->shapes[i].ffiParamTypes);
+    }
+    rb_nativethread_lock_destroy(&invoker->shapeLock);
+    xfree(invoker);
 }
 
 static size_t
 variadic_memsize(const void *data)
 {
-    return sizeof(VariadicInvoker);
+    const VariadicInvoker *invoker = (const VariadicInvoker *)data;
+    size_t memsize = sizeof(VariadicInvoker);
+    int i;
+
+    for (i = 0; i < invoker->shapeCount; ++i) {
+        memsize += invoker->shapes[i].paramCount * sizeof(ffi_type *);
+    }
+
+    return memsize;
 }
 
 static VALUE
@@ -132,7 +188,7 @@ variadic_initialize(VALUE self, VALUE rbFunction, VALUE rbParameterTypes, VALUE
     VariadicInvoker* invoker = NULL;
     VALUE retval = Qnil;
     VALUE convention = Qnil;
-    VALUE fixed = Qnil;
+    VALUE fixed = Qnil, fixedTypes = Qnil;
 #if defined(X86_WIN32)
     VALUE rbConventionStr;
 #endif
@@ -166,6 +222,7 @@ variadic_initialize(VALUE self, VALUE rbFunction, VALUE rbParameterTypes, VALUE
     invoker->paramCount = -1;
 
     fixed = rb_ary_new2(RARRAY_LEN(rbParameterTypes) - 1);
+    fixedTypes = rb_ary_new2(RARRAY_LEN(rbParameterTypes) - 1);
     for (i = 0; i < RARRAY_LEN(rbParameterTypes); ++i) {
         VALUE entry = rb_ary_entry(rbParameterTypes, i);
         VALUE rbType = rbffi_Type_Lookup(entry);
@@ -178,121 +235,223 @@ variadic_initialize(VALUE self, VALUE rbFunction, VALUE rbParameterTypes, VALUE
         TypedData_Get_Struct(rbType, Type, &rbffi_type_data_type, type);
         if (type->nativeType != NATIVE_VARARGS) {
             rb_ary_push(fixed, entry);
+            rb_ary_push(fixedTypes, rbType);
         }
     }
+    invoker->fixedCount = (int) RARRAY_LEN(fixed);
+    RB_OBJ_WRITE(self, &invoker->rbFixedTypes, rb_obj_freeze(fixedTypes));
+    RB_OBJ_WRITE(self, &invoker->rbTypeMap, rb_hash_aref(options, ID2SYM(rb_intern("type_map"))));
     /*
-     * @fixed and @type_map are used by the parameter mangling ruby code
+     * @fixed and @type_map are kept for ruby code inspecting the invoker
      */
     rb_iv_set(self, "@fixed", rb_obj_freeze(fixed));
-    rb_iv_set(self, "@type_map", rb_hash_aref(options, ID2SYM(rb_intern("type_map"))));
+    rb_iv_set(self, "@type_map", invoker->rbTypeMap);
 
     return retval;
 }
 
+/*
+ * Apply the C default argument promotions to a vararg type
+ */
 static VALUE
-variadic_invoke(VALUE self, VALUE parameterTypes, VALUE parameterValues)
+variadic_promote(VALUE rbType, Type* type)
+{
+    switch (type->nativeType) {
+        case NATIVE_INT8:
+        case NATIVE_INT16:
+        case NATIVE_INT32:
+            return rbInt32Type;
+
+        case NATIVE_UINT8:
+        case NATIVE_UINT16:
+        case NATIVE_UINT32:
+            return rbUInt32Type;
+
+        case NATIVE_FLOAT32:
+            return rbDoubleType;
+
+        default:
+            return rbType;
+    }
+}
+
+static int
+variadic_shape_count(VariadicInvoker* invoker)
+{
+#ifdef _MSC_VER
+    int count = *(volatile int *) &invoker->shapeCount;
+    MemoryBarrier();
+    return count;
+#else
+    return __atomic_load_n(&invoker->shapeCount, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void
+variadic_shape_publish(VariadicInvoker* invoker, int count)
+{
+#ifdef _MSC_VER
+    MemoryBarrier();
+    *(volatile int *) &invoker->shapeCount = count;
+#else
+    __atomic_store_n(&invoker->shapeCount, count, __ATOMIC_RELEASE);
+#endif
+}
+
+static ffi_cif*
+variadic_shape_find(VariadicInvoker* invoker, int from, int to, int paramCount, ffi_type** ffiParamTypes)
+{
+    int i;
+
+    for (i = from; i < to; ++i) {
+        VariadicShape* shape = &invoker->shapes[i];
+        if (shape->paramCount == paramCount
+                && memcmp(shape->ffiParamTypes, ffiParamTypes, paramCount * sizeof(ffi_type *)) == 0) {
+            return &shape->cif;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Find the prepared cif for a call shape, preparing and caching it if there is room left.
+ * Returns NULL if the shape can't be cached.
+ */
+static ffi_cif*
+variadic_shape_cif(VariadicInvoker* invoker, int paramCount, Type** paramTypes, ffi_type** ffiParamTypes)
+{
+    ffi_cif* cif = NULL;
+    int i, count;
+
+    /* struct by value types own their ffi_type, only shapes of shared ffi_types are safe to keep */
+    for (i = 0; i < paramCount; ++i) {
+        if (paramTypes[i]->nativeType == NATIVE_STRUCT) {
+            return NULL;
+        }
+    }
+
+    count = variadic_shape_count(invoker);
+    if ((cif = variadic_shape_find(invoker, 0, count, paramCount, ffiParamTypes)) != NULL
+            || count == VARIADIC_SHAPE_CACHE_SIZE) {
+        return cif;
+    }
+
+    rb_nativethread_lock_lock(&invoker->shapeLock);
+
+    /* Another thread might have added the shape in the meantime */
+    cif = variadic_shape_find(invoker, count, invoker->shapeCount, paramCount, ffiParamTypes);
+    count = invoker->shapeCount;
+
+    if (cif == NULL && count < VARIADIC_SHAPE_CACHE_SIZE) {
+        VariadicShape* shape = &invoker->shapes[count];
+        ffi_status status;
+
+        shape->ffiParamTypes = malloc(MAX(paramCount, 1) * sizeof(ffi_type *));
+        if (shape->ffiParamTypes != NULL) {
+            memcpy(shape->ffiParamTypes, ffiParamTypes, paramCount * sizeof(ffi_type *));
+            shape->paramCount = paramCount;
+#ifdef HAVE_FFI_PREP_CIF_VAR
+            status = ffi_prep_cif_var(&shape->cif, invoker->abi, invoker->fixedCount, paramCount,
+                    invoker->returnType->ffiType, shape->ffiParamTypes);
+#else
+            status = ffi_prep_cif(&shape->cif, invoker->abi, paramCount,
+                    invoker->returnType->ffiType, shape->ffiParamTypes);
+#endif
+            if (status == FFI_OK) {
+                cif = &shape->cif;
+                variadic_shape_publish(invoker, count + 1);
+            } else {
+                /* Let the caller prepare it again and report the error */
+                free(shape->ffiParamTypes);
+                shape->ffiParamTypes = NULL;
+            }
+        }
+    }
+
+    rb_nativethread_lock_unlock(&invoker->shapeLock);
+
+    return cif;
+}
+
+/*
+ * Call the function with the (already promoted) types +rbParamTypes+ and values +argv+
+ */
+static VALUE
+variadic_do_call(VariadicInvoker* invoker, int paramCount, VALUE* rbParamTypes, VALUE* argv)
 {
-    VariadicInvoker* invoker;
     FFIStorage* params;
+    FFIStorage* structs = NULL;
     void* retval;
-    ffi_cif cif;
+    ffi_cif stackCif;
+    ffi_cif* cif;
     void** ffiValues;
     ffi_type** ffiParamTypes;
-    ffi_type* ffiReturnType;
     Type** paramTypes;
-    VALUE* argv;
     VALUE* callbackParameters;
     VALUE callbackProc;
-    int paramCount = 0, fixedCount = 0, callbackCount = 0, i;
+    int callbackCount = 0, i;
+    long structCount = 0;
     ffi_status ffiStatus;
     rbffi_frame_t frame = { 0 };
 
-    Check_Type(parameterTypes, T_ARRAY);
-    Check_Type(parameterValues, T_ARRAY);
-
-    TypedData_Get_Struct(self, VariadicInvoker, &variadic_data_type, invoker);
-    paramCount = RARRAY_LENINT(parameterTypes);
-    paramTypes = ALLOCA_N(Type *, paramCount);
-    ffiParamTypes = ALLOCA_N(ffi_type *, paramCount);
-    params = ALLOCA_N(FFIStorage, paramCount);
-    ffiValues = ALLOCA_N(void*, paramCount);
-    argv = ALLOCA_N(VALUE, paramCount);
-    callbackParameters = ALLOCA_N(VALUE, paramCount);
+    paramTypes = ALLOCA_N(Type *, MAX(paramCount, 1));
+    ffiParamTypes = ALLOCA_N(ffi_type *, MAX(paramCount, 1));
+    params = ALLOCA_N(FFIStorage, MAX(paramCount, 1));
+    ffiValues = ALLOCA_N(void*, MAX(paramCount, 1));
+    callbackParameters = ALLOCA_N(VALUE, MAX(paramCount, 1));
     retval = alloca(MAX(invoker->returnType->ffiType->size, FFI_SIZEOF_ARG));
 
     for (i = 0; i < paramCount; ++i) {
-        VALUE rbType = rb_ary_entry(parameterTypes, i);
+        VALUE rbType = rbParamTypes[i];
 
-        if (!rb_obj_is_kind_of(rbType, rbffi_TypeClass)) {
-            rb_raise(rb_eTypeError, "wrong type.  Expected (FFI::Type)");
-        }
         TypedData_Get_Struct(rbType, Type, &rbffi_type_data_type, paramTypes[i]);
 
-        switch (paramTypes[i]->nativeType) {
-            case NATIVE_INT8:
-            case NATIVE_INT16:
-            case NATIVE_INT32:
-                rbType = rb_const_get(rbffi_TypeClass, rb_intern("INT32"));
-                TypedData_Get_Struct(rbType, Type, &rbffi_type_data_type, paramTypes[i]);
-                break;
-            case NATIVE_UINT8:
-            case NATIVE_UINT16:
-            case NATIVE_UINT32:
-                rbType = rb_const_get(rbffi_TypeClass, rb_intern("UINT32"));
-                TypedData_Get_Struct(rbType, Type, &rbffi_type_data_type, paramTypes[i]);
-                break;
-
-            case NATIVE_FLOAT32:
-                rbType = rb_const_get(rbffi_TypeClass, rb_intern("DOUBLE"));
-                TypedData_Get_Struct(rbType, Type, &rbffi_type_data_type, paramTypes[i]);
-                break;
-
-            case NATIVE_FUNCTION:
-                if (!rb_obj_is_kind_of(rbType, rbffi_FunctionTypeClass)) {
-                    VALUE typeName = rb_funcall2(rbType, rb_intern("inspect"), 0, NULL);
-                    rb_raise(rb_eTypeError, "Incorrect parameter type (%s)", RSTRING_PTR(typeName));
-                }
-                callbackParameters[callbackCount++] = rbType;
-                break;
-
-            default:
-                break;
+        if (paramTypes[i]->nativeType == NATIVE_FUNCTION) {
+            if (!rb_obj_is_kind_of(rbType, rbffi_FunctionTypeClass)) {
+                VALUE typeName = rb_funcall2(rbType, rb_intern("inspect"), 0, NULL);
+                rb_raise(rb_eTypeError, "Incorrect parameter type (%s)", RSTRING_PTR(typeName));
+            }
+            callbackParameters[callbackCount++] = rbType;
         }
 
-
         ffiParamTypes[i] = paramTypes[i]->ffiType;
         if (ffiParamTypes[i] == NULL) {
             rb_raise(rb_eArgError, "Invalid parameter type #%x", paramTypes[i]->nativeType);
         }
-        argv[i] = rb_ary_entry(parameterValues, i);
+        structCount += rbffi_StructParamStorageCount(paramTypes[i]);
     }
 
-    ffiReturnType = invoker->returnType->ffiType;
-    if (ffiReturnType == NULL) {
-        rb_raise(rb_eArgError, "Invalid return type");
+    if (structCount > 0) {
+        structs = ALLOCA_N(FFIStorage, structCount);
     }
 
-    /*Get the number of fixed args from @fixed array*/
-    fixedCount = RARRAY_LEN(rb_iv_get(self, "@fixed"));
+    if (invoker->returnType->ffiType == NULL) {
+        rb_raise(rb_eArgError, "Invalid return type");
+    }
 
+    cif = variadic_shape_cif(invoker, paramCount, paramTypes, ffiParamTypes);
+    if (cif == NULL) {
+        cif = &stackCif;
 #ifdef HAVE_FFI_PREP_CIF_VAR
-    ffiStatus = ffi_prep_cif_var(&cif, invoker->abi, fixedCount, paramCount, ffiReturnType, ffiParamTypes);
+        ffiStatus = ffi_prep_cif_var(cif, invoker->abi, invoker->fixedCount, paramCount, invoker->returnType->ffiType, ffiParamTypes);
 #else
-    ffiStatus = ffi_prep_cif(&cif, invoker->abi, paramCount, ffiReturnType, ffiParamTypes);
+        ffiStatus = ffi_prep_cif(cif, invoker->abi, paramCount, invoker->returnType->ffiType, ffiParamTypes);
 #endif
-    switch (ffiStatus) {
-        case FFI_BAD_ABI:
-            rb_raise(rb_eArgError, "Invalid ABI specified");
-        case FFI_BAD_TYPEDEF:
-            rb_raise(rb_eArgError, "Invalid argument type specified");
-        case FFI_OK:
-            break;
-        default:
-            rb_raise(rb_eArgError, "Unknown FFI error");
+        switch (ffiStatus) {
+            case FFI_BAD_ABI:
+                rb_raise(rb_eArgError, "Invalid ABI specified");
+            case FFI_BAD_TYPEDEF:
+                rb_raise(rb_eArgError, "Invalid argument type specified");
+            case FFI_OK:
+                break;
+            default:
+                rb_raise(rb_eArgError, "Unknown FFI error");
+        }
     }
 
     callbackProc = rbffi_SetupCallParams(paramCount, argv, -1, paramTypes, params,
-        ffiValues, callbackParameters, callbackCount,
+        ffiValues, structs, callbackParameters, callbackCount,
         invoker->rbEnums);
 
     rbffi_frame_push(&frame);
@@ -305,11 +464,11 @@ variadic_invoke(VALUE self, VALUE parameterTypes, VALUE parameterValues)
         bc->ffiValues = ffiValues;
         bc->params = params;
         bc->frame = &frame;
-        bc->cif = cif;
+        bc->cif = *cif;
 
         rb_rescue2(rbffi_do_blocking_call, (VALUE) bc, rbffi_save_frame_exception, (VALUE) &frame, rb_eException, (VALUE) 0);
     } else {
-        ffi_call(&cif, FFI_FN(invoker->function), retval, ffiValues);
+        ffi_call(cif, FFI_FN(invoker->function), retval, ffiValues);
     }
     RB_GC_GUARD(callbackProc);
 
@@ -324,6 +483,238 @@ variadic_invoke(VALUE self, VALUE parameterTypes, VALUE parameterValues)
     return rbffi_NativeValue_ToRuby(invoker->returnType, invoker->rbReturnType, retval);
 }
 
+static VALUE
+variadic_invoke(VALUE self, VALUE parameterTypes, VALUE parameterValues)
+{
+    VariadicInvoker* invoker;
+    VALUE* rbParamTypes;
+    VALUE* argv;
+    int paramCount, i;
+
+    Check_Type(parameterTypes, T_ARRAY);
+    Check_Type(parameterValues, T_ARRAY);
+
+    TypedData_Get_Struct(self, VariadicInvoker, &variadic_data_type, invoker);
+    paramCount = RARRAY_LENINT(parameterTypes);
+    rbParamTypes = ALLOCA_N(VALUE, MAX(paramCount, 1));
+    argv = ALLOCA_N(VALUE, MAX(paramCount, 1));
+
+    for (i = 0; i < paramCount; ++i) {
+        VALUE rbType = rb_ary_entry(parameterTypes, i);
+        Type* type;
+
+        if (!rb_obj_is_kind_of(rbType, rbffi_TypeClass)) {
+            rb_raise(rb_eTypeError, "wrong type.  Expected (FFI::Type)");
+        }
+        TypedData_Get_Struct(rbType, Type, &rbffi_type_data_type, type);
+
+        rbParamTypes[i] = variadic_promote(rbType, type);
+        argv[i] = rb_ary_entry(parameterValues, i);
+    }
+
+    return variadic_do_call(invoker, paramCount, rbParamTypes, argv);
+}
+
+/*
+ * Resolve a vararg type like FFI.find_type(name, type_map) does, with a fast path for
+ * Types and Symbols of plain types
+ */
+static VALUE
+variadic_find_type(VariadicInvoker* invoker, VALUE name)
+{
+    VALUE rbType;
+
+    if (rb_obj_is_kind_of(name, rbffi_TypeClass)) {
+        return name;
+    }
+
+    if (SYMBOL_P(name)) {
+        /* The library's typedefs come first, even if they shadow a global one */
+        rbType = RB_TYPE_P(invoker->rbTypeMap, T_HASH) ? rb_hash_lookup2(invoker->rbTypeMap, name, Qundef) : Qundef;
+        if (rbType == Qundef) {
+            rbType = rbffi_Type_Lookup(name);
+        }
+        if (rb_obj_is_kind_of(rbType, rbffi_TypeClass)) {
+            return rbType;
+        }
+    }
+
+    /* DataConverters, enums and friends */
+    return rb_funcall(rbffi_FFIModule, id_find_type, 2, name, invoker->rbTypeMap);
+}
+
+/*
+ * Whether a vararg names the type of the following value, rather than being a value
+ */
+static bool
+variadic_type_p(VALUE arg)
+{
+    if (SYMBOL_P(arg) || rb_obj_is_kind_of(arg, rbffi_TypeClass)) {
+        return true;
+    }
+    if (SPECIAL_CONST_P(arg) || RB_TYPE_P(arg, T_STRING) || RB_TYPE_P(arg, T_FLOAT) || RB_TYPE_P(arg, T_BIGNUM)) {
+        return false;
+    }
+
+    /* FFI.find_type accepts DataConverters like enums as well, the module is defined in ruby */
+    return rb_const_defined(rbffi_FFIModule, id_data_converter)
+        && RTEST(rb_obj_is_kind_of(arg, rb_const_get(rbffi_FFIModule, id_data_converter)));
+}
+
+/*
+ * Infer the type of a vararg from the class of its value
+ */
+static VALUE
+variadic_infer_type(VALUE value)
+{
+    switch (TYPE(value)) {
+        case T_FIXNUM: {
+            long v = FIX2LONG(value);
+            return v >= INT32_MIN && v <= INT32_MAX ? rbInt32Type : rbInt64Type;
+        }
+
+        case T_BIGNUM:
+            return rbInt64Type;
+
+        case T_FLOAT:
+            return rbDoubleType;
+
+        case T_STRING:
+            return rbStringType;
+
+        case T_NIL:
+            return rbPointerType;
+
+        default:
+            if (rb_obj_is_kind_of(value, rbffi_PointerClass) || rb_respond_to(value, rb_intern("to_ptr"))) {
+                return rbPointerType;
+            }
+            rb_raise(rb_eTypeError, "cannot infer the vararg type of %s, pass it as [type, value]",
+                    rb_obj_classname(value));
+    }
+
+    return Qnil;
+}
+
+/*
+ * call-seq: call(*args)
+ * @param [Array] args fixed arguments, followed by the varargs
+ * @return [Object] the return value of the function
+ * Call the function.
+ *
+ * Each vararg is given as either a +type, value+ pair, a +[type, value]+ Array
+ * or a plain value whose type is inferred from its class: Integer is +:int+
+ * (+:long_long+ beyond 32 bits), Float is +:double+, String is +:string+ and
+ * nil or a Pointer is +:pointer+.
+ *
+ * The cif prepared for each distinct set of vararg types is kept, so a call
+ * site with a stable shape pays libffi's preparation only once.
+ */
+static VALUE
+variadic_call(int argc, VALUE* argv, VALUE self)
+{
+    VariadicInvoker* invoker;
+    VALUE* rbParamTypes;
+    VALUE* values;
+    int i, paramCount;
+
+    TypedData_Get_Struct(self, VariadicInvoker, &variadic_data_type, invoker);
+
+    if (argc < invoker->fixedCount) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for %d+)", argc, invoker->fixedCount);
+    }
+
+    rbParamTypes = ALLOCA_N(VALUE, MAX(argc, 1));
+    values = ALLOCA_N(VALUE, MAX(argc, 1));
+
+    for (i = 0; i < invoker->fixedCount; ++i) {
+        VALUE rbType = RARRAY_AREF(invoker->rbFixedTypes, i);
+        Type* type;
+
+        TypedData_Get_Struct(rbType, Type, &rbffi_type_data_type, type);
+        rbParamTypes[i] = variadic_promote(rbType, type);
+        values[i] = argv[i];
+    }
+
+    for (paramCount = i; i < argc; ++paramCount) {
+        VALUE arg = argv[i];
+        VALUE rbType, value;
+        Type* type;
+
+        if (variadic_type_p(arg)) {
+            rbType = variadic_find_type(invoker, arg);
+            value = i + 1 < argc ? argv[i + 1] : Qnil;
+            i += 2;
+
+        } else if (RB_TYPE_P(arg, T_ARRAY) && RARRAY_LEN(arg) == 2) {
+            rbType = variadic_find_type(invoker, RARRAY_AREF(arg, 0));
+            value = RARRAY_AREF(arg, 1);
+            i++;
+
+        } else {
+            rbType = variadic_infer_type(arg);
+            value = arg;
+            i++;
+        }
+
+        if (!rb_obj_is_kind_of(rbType, rbffi_TypeClass)) {
+            rb_raise(rb_eTypeError, "wrong type.  Expected (FFI::Type)");
+        }
+        TypedData_Get_Struct(rbType, Type, &rbffi_type_data_type, type);
+        rbParamTypes[paramCount] = variadic_promote(rbType, type);
+        values[paramCount] = value;
+    }
+
+    return variadic_do_call(invoker, paramCount, rbParamTypes, values);
+}
+
+/*
+ * The singleton method of attached variadic functions: look up the invoker by method name
+ */
+static VALUE
+variadic_attached_call(int argc, VALUE* argv, VALUE self)
+{
+    VALUE functions = rb_ivar_get(self, id_ffi_functions);
+    VALUE invoker = NIL_P(functions) ? Qnil : rb_hash_aref(functions, ID2SYM(rb_frame_this_func()));
+
+    if (!rb_obj_is_kind_of(invoker, classVariadicInvoker)) {
+        rb_raise(rb_eRuntimeError, "variadic function %s is not attached", rb_id2name(rb_frame_this_func()));
+    }
+
+    return variadic_call(argc, argv, invoker);
+}
+
+/*
+ * call-seq: attach(mod, mname)
+ * @param [Module] mod
+ * @param [String, Symbol] mname
+ * @return [self]
+ * Attach the invoker to module +mod+ as +mname+.
+ */
+static VALUE
+variadic_attach(VALUE self, VALUE module, VALUE name)
+{
+    VALUE functions, rbName = rb_to_symbol(name);
+
+    if (!rb_obj_is_kind_of(module, rb_cModule)) {
+        rb_raise(rb_eRuntimeError, "trying to attach function to non-module");
+    }
+
+    functions = rb_attr_get(module, id_ffi_functions);
+    if (NIL_P(functions)) {
+        functions = rb_hash_new();
+        rb_ivar_set(module, id_ffi_functions, functions);
+    }
+    rb_hash_aset(functions, rbName, self);
+
+    rb_define_singleton_method(module, rb_id2name(SYM2ID(rbName)), variadic_attached_call, -1);
+    /* Instance methods forward to the singleton method */
+    rb_funcall_with_block(module, id_define_method, 1, &rbName,
+            rb_funcall(rb_obj_method(module, rbName), id_to_proc, 0));
+
+    return self;
+}
+
 static VALUE
 variadic_return_type(VALUE self)
 {
@@ -343,6 +734,26 @@ rbffi_Variadic_Init(VALUE moduleFFI)
 
     rb_define_method(classVariadicInvoker, "initialize", variadic_initialize, 4);
     rb_define_method(classVariadicInvoker, "invoke", variadic_invoke, 2);
+    rb_define_method(classVariadicInvoker, "call", variadic_call, -1);
+    rb_define_method(classVariadicInvoker, "attach", variadic_attach, 2);
     rb_define_method(classVariadicInvoker, "return_type", variadic_return_type, 0);
-}
 
+    rbInt32Type = rb_const_get(rbffi_TypeClass, rb_intern("INT32"));
+    rbUInt32Type = rb_const_get(rbffi_TypeClass, rb_intern("UINT32"));
+    rbInt64Type = rb_const_get(rbffi_TypeClass, rb_intern("INT64"));
+    rbDoubleType = rb_const_get(rbffi_TypeClass, rb_intern("DOUBLE"));
+    rbPointerType = rb_const_get(rbffi_TypeClass, rb_intern("POINTER"));
+    rbStringType = rb_const_get(rbffi_TypeClass, rb_intern("STRING"));
+    rb_global_variable(&rbInt32Type);
+    rb_global_variable(&rbUInt32Type);
+    rb_global_variable(&rbInt64Type);
+    rb_global_variable(&rbDoubleType);
+    rb_global_variable(&rbPointerType);
+    rb_global_variable(&rbStringType);
+
+    id_find_type = rb_intern("find_type");
+    id_ffi_functions = rb_intern("@ffi_functions");
+    id_define_method = rb_intern("define_method");
+    id_to_proc = rb_intern("to_proc");
+    id_data_converter = rb_intern("DataConverter");
+}
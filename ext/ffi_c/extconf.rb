@@ -62,6 +62,7 @@ if RUBY_ENGINE == 'ruby' || RUBY_ENGINE == 'rbx'
   end
 
   have_func 'rb_gc_mark_movable' # since ruby-2.7
+  have_header 'sys/eventfd.h' # used by FFI::Notifier
 
   # Some linux archs need explicit linking to pthread, see https://github.com/ffi/ffi/issues/893
   append_ldflags "-pthread"
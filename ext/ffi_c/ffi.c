@@ -38,6 +38,7 @@
 #include "AbstractMemory.h"
 #include "Pointer.h"
 #include "MemoryPointer.h"
+#include "MemoryCache.h"
 #include "Struct.h"
 #include "StructByValue.h"
 #include "DynamicLibrary.h"
@@ -48,6 +49,12 @@
 #include "ClosurePool.h"
 #include "MethodHandle.h"
 #include "Call.h"
+#include "CallChain.h"
+#include "NativeCallback.h"
+#include "CallbackQueue.h"
+#include "Notifier.h"
+#include "Arena.h"
+#include "MappedMemory.h"
 #include "ArrayType.h"
 #include "MappedType.h"
 
@@ -86,12 +93,19 @@ Init_ffi_c(void)
     rbffi_AbstractMemory_Init(moduleFFI);
     rbffi_Pointer_Init(moduleFFI);
     rbffi_Function_Init(moduleFFI);
+    rbffi_MemoryCache_Init(moduleFFI);
     rbffi_MemoryPointer_Init(moduleFFI);
     rbffi_Buffer_Init(moduleFFI);
     rbffi_StructByValue_Init(moduleFFI);
     rbffi_Struct_Init(moduleFFI);
     rbffi_DynamicLibrary_Init(moduleFFI);
     rbffi_Variadic_Init(moduleFFI);
+    rbffi_CallChain_Init(moduleFFI);
+    rbffi_NativeCallback_Init(moduleFFI);
+    rbffi_CallbackQueue_Init(moduleFFI);
+    rbffi_Notifier_Init(moduleFFI);
+    rbffi_Arena_Init(moduleFFI);
+    rbffi_MappedMemory_Init(moduleFFI);
     rbffi_Types_Init(moduleFFI);
     rbffi_MappedType_Init(moduleFFI);
 }
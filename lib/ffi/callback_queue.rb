@@ -0,0 +1,52 @@
+#
+# Copyright (C) 2008-2010 JRuby project
+#
+# This file is part of ruby-ffi.
+#
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# * Redistributions of source code must retain the above copyright notice, this
+#   list of conditions and the following disclaimer.
+# * Redistributions in binary form must reproduce the above copyright notice
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+# * Neither the name of the Ruby FFI project nor the names of its contributors
+#   may be used to endorse or promote products derived from this software
+#   without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+# OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+module FFI
+  # A void callback which records the arguments of its calls instead of running ruby code.
+  #
+  # Native threads calling it never wait for the GVL.  Ruby code processes the queued
+  # calls in batches whenever it chooses, for instance when {#to_io} becomes readable.
+  #
+  # @example Process events of a native library from an event loop
+  #   queue = FFI::CallbackQueue.new(LibEvents.find_type(:event_cb), 4096)
+  #   LibEvents.subscribe(queue)
+  #   loop do
+  #     IO.select([queue])
+  #     queue.drain { |kind, data| handle(kind, data) }
+  #   end
+  class CallbackQueue
+    # @return [IO] an IO for {#fileno}, which is readable while calls are queued
+    #   It is meant for +IO.select+ and fiber schedulers only, reading from it
+    #   or closing it is not allowed.
+    def to_io
+      @io ||= ::IO.for_fd(fileno, "r", autoclose: false)
+    end
+  end
+end
@@ -48,6 +48,9 @@ require 'ffi/variadic'
 require 'ffi/enum'
 require 'ffi/version'
 require 'ffi/function'
+require 'ffi/native_callback'
+require 'ffi/callback_queue'
+require 'ffi/notifier'
 
 module FFI
   module ModernForkTracking
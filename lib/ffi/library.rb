@@ -319,15 +319,24 @@ module FFI
     end
 
 
-    # @overload callback(name, params, ret)
+    # @overload callback(name, params, ret, options = {})
     #   @param name callback name to add to type map
     #   @param [Array] params array of parameters' types
     #   @param [DataConverter, Struct, Symbol, Type] ret callback return type
-    # @overload callback(params, ret)
+    #   @param [Hash] options
+    #   @option options [Symbol] :async +:detached+ lets native threads return from a +:void+
+    #     callback without waiting for the ruby proc, see {FFI::FunctionType#initialize}
+    #   @option options [Boolean] :reuse_pointers pass +:pointer+ arguments as Pointer objects
+    #     which are only valid during the call, see {FFI::FunctionType#initialize}
+    #   @option options [Symbol] :scope +:call+ binds procs and blocks only for the duration of
+    #     the call they are passed to, see {FFI::FunctionType#initialize}
+    # @overload callback(params, ret, options = {})
     #   @param [Array] params array of parameters' types
     #   @param [DataConverter, Struct, Symbol, Type] ret callback return type
+    #   @param [Hash] options
     # @return [FFI::CallbackInfo]
     def callback(*args)
+      cb_options = args.last.is_a?(Hash) ? args.pop : {}
       raise ArgumentError, "wrong number of arguments" if args.length < 2 || args.length > 3
       name, params, ret = if args.length == 3
         args
@@ -340,6 +349,9 @@ module FFI
       options = Hash.new
       options[:convention] = ffi_convention
       options[:enums] = @ffi_enums if defined?(@ffi_enums)
+      options[:async] = cb_options[:async] if cb_options.key?(:async)
+      options[:reuse_pointers] = cb_options[:reuse_pointers] if cb_options.key?(:reuse_pointers)
+      options[:scope] = cb_options[:scope] if cb_options.key?(:scope)
       ret_type = find_type(ret)
       if ret_type == Type::STRING
         raise TypeError, ":string is not allowed as return type of callbacks"
@@ -0,0 +1,114 @@
+#
+# Copyright (C) 2008-2010 JRuby project
+#
+# This file is part of ruby-ffi.
+#
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# * Redistributions of source code must retain the above copyright notice, this
+#   list of conditions and the following disclaimer.
+# * Redistributions in binary form must reproduce the above copyright notice
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+# * Neither the name of the Ruby FFI project nor the names of its contributors
+#   may be used to endorse or promote products derived from this software
+#   without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+# OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+module FFI
+  # A callback implemented in C, which compares, tests or hashes fields at fixed offsets of
+  # the records it is passed.
+  #
+  # It can be passed wherever a callback is expected, but doesn't enter ruby when called.
+  # So it needs no GVL and doesn't allocate, which makes it suitable for sorting or
+  # searching large arrays with +qsort+ or +bsearch+ and for native hash tables.
+  #
+  # @example Sort an array of structs by descending score, then by name
+  #   cmp = FFI::NativeCallback.compare_by(Player, [:score, :desc], :name)
+  #   LibC.qsort(players, count, Player.size, cmp)
+  class NativeCallback
+    class << self
+      # Comparator over a single field, called like +int (*)(const void *, const void *)+.
+      #
+      # @param [Type, Symbol] type type of the field
+      # @param [Integer] offset offset of the field in the record
+      # @param [Symbol] order +:asc+ or +:desc+
+      # @return [NativeCallback]
+      def compare(type, offset: 0, order: :asc)
+        new(:compare, [[type, offset, order]])
+      end
+
+      # Comparator over several fields of a struct, compared in the given order.
+      #
+      # @param [Class] struct_class the {Struct} the records are laid out as
+      # @param [Array<Symbol, Array(Symbol, Symbol)>] fields field names, or pairs of
+      #   field name and order (+:asc+ or +:desc+)
+      # @return [NativeCallback]
+      def compare_by(struct_class, *fields)
+        new(:compare, fields.map { |name, order| struct_key(struct_class, name) << order })
+      end
+
+      # Predicate over a single field, called like +int (*)(const void *)+.
+      #
+      # @param [Type, Symbol] type type of the field
+      # @param [Symbol] op one of +:==+, +:!=+, +:<+, +:<=+, +:>+ and +:>=+
+      # @param value the value the field is compared to
+      # @param [Integer] offset offset of the field in the record
+      # @return [NativeCallback] a callback returning 1 for matching records and 0 otherwise
+      def predicate(type, op, value, offset: 0)
+        new(:predicate, [[type, offset, op, value]])
+      end
+
+      # Predicate over fields of a struct, which matches if all conditions do.
+      #
+      # @example
+      #   FFI::NativeCallback.predicate_by(Player, score: [:>=, 100], active: [:==, true])
+      # @param [Class] struct_class the {Struct} the records are laid out as
+      # @param [Hash{Symbol => Array(Symbol, Object)}] conditions operator and value by field name
+      # @return [NativeCallback]
+      def predicate_by(struct_class, conditions)
+        new(:predicate, conditions.map { |name, (op, value)| struct_key(struct_class, name) << op << value })
+      end
+
+      # Hash function over a single field, called like +size_t (*)(const void *)+.
+      #
+      # Records which are equal as of {.compare} get the same hash.
+      # @param [Type, Symbol] type type of the field
+      # @param [Integer] offset offset of the field in the record
+      # @return [NativeCallback]
+      def hash_of(type, offset: 0)
+        new(:hash, [[type, offset]])
+      end
+
+      # Hash function over several fields of a struct.
+      #
+      # @param [Class] struct_class the {Struct} the records are laid out as
+      # @param [Array<Symbol>] fields field names
+      # @return [NativeCallback]
+      def hash_by(struct_class, *fields)
+        new(:hash, fields.map { |name| struct_key(struct_class, name) })
+      end
+
+      private
+
+      def struct_key(struct_class, name)
+        field = struct_class.layout[name]
+        raise ArgumentError, "unknown field #{name.inspect} of #{struct_class}" unless field
+        [field.type, field.offset]
+      end
+    end
+  end
+end
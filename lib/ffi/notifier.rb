@@ -0,0 +1,71 @@
+#
+# Copyright (C) 2008-2010 JRuby project
+#
+# This file is part of ruby-ffi.
+#
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# * Redistributions of source code must retain the above copyright notice, this
+#   list of conditions and the following disclaimer.
+# * Redistributions in binary form must reproduce the above copyright notice
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+# * Neither the name of the Ruby FFI project nor the names of its contributors
+#   may be used to endorse or promote products derived from this software
+#   without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+# OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+require 'io/wait'
+
+module FFI
+  # A +void (*)(void)+ callback which only tells ruby that something is ready.
+  #
+  # Native code calls it from any thread without waiting for the GVL, and ruby
+  # waits for the signals on its own schedule, like for data on an IO.  Signals
+  # arriving in between are counted.
+  #
+  # @example Wait for completions of a native worker
+  #   notifier = FFI::Notifier.new
+  #   LibWorker.start(job, notifier)
+  #   loop do
+  #     notifier.wait
+  #     LibWorker.collect_results(job)
+  #   end
+  class Notifier
+    # @return [IO] an IO for {#fileno}, which is readable while signals are pending
+    #   It is meant for +IO.select+ and fiber schedulers only, reading from it
+    #   or closing it is not allowed.
+    def to_io
+      @io ||= ::IO.for_fd(fileno, "r", autoclose: false)
+    end
+
+    # Wait for signals.  This blocks the current fiber only, if a fiber scheduler is set.
+    # @param [Numeric, nil] timeout in seconds, or +nil+ to wait forever
+    # @return [Integer, nil] number of signals since the last {#take} or +wait+,
+    #   or +nil+ if the timeout expired
+    def wait(timeout = nil)
+      deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout if timeout
+      loop do
+        count = take
+        return count if count > 0
+
+        remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC) if deadline
+        return nil if remaining && remaining <= 0
+        return nil unless to_io.wait_readable(remaining)
+      end
+    end
+  end
+end
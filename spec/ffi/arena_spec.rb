@@ -0,0 +1,94 @@
+#
+# This file is part of ruby-ffi.
+# For licensing, see LICENSE.SPECS
+#
+
+require File.expand_path(File.join(File.dirname(__FILE__), "spec_helper"))
+
+describe FFI::Arena do
+  it 'allocates zeroed and aligned memory' do
+    arena = FFI::Arena.new
+    a = arena.alloc(1)
+    b = arena.alloc(:int64, 3)
+    c = arena.alloc(:char, 5, 64)
+
+    expect(b.size).to eq(24)
+    expect(b.type_size).to eq(8)
+    expect(b.read_array_of_int64(3)).to eq([0, 0, 0])
+    expect(b.address % 8).to eq(0)
+    expect(c.address % 64).to eq(0)
+    expect([a.address, b.address, c.address].uniq.size).to eq(3)
+    expect(arena.used).to eq(1 + 24 + 5)
+  end
+
+  it 'allocates from a single chunk' do
+    arena = FFI::Arena.new(4096)
+    ptrs = 10.times.map { arena.alloc(:int32, 4) }
+    expect(arena.capacity).to eq(4096)
+    expect(ptrs.last.address - ptrs.first.address).to eq(9 * 16)
+  end
+
+  it 'reuses its chunks after reset' do
+    arena = FFI::Arena.new(1024)
+    first = arena.alloc(:int32).address
+    100.times { arena.alloc(64) }
+    capacity = arena.capacity
+
+    arena.reset
+    expect(arena.used).to eq(0)
+    expect(arena.alloc(:int32).address).to eq(first)
+    100.times { arena.alloc(64) }
+    expect(arena.capacity).to eq(capacity)
+  end
+
+  it 'gives large allocations a chunk of their own' do
+    arena = FFI::Arena.new(1024)
+    big = arena.alloc(:char, 100_000)
+    big.put_bytes(99_990, "0123456789")
+    expect(arena.capacity).to be >= 100_000
+    arena.reset
+    expect(arena.capacity).to eq(0)
+  end
+
+  it 'invalidates its pointers on reset' do
+    arena = FFI::Arena.new
+    ptr = arena.alloc(:int)
+    arena.reset
+    expect(ptr.null?).to be true
+    expect { ptr.read_int }.to raise_error(FFI::NullPointerError)
+  end
+
+  it 'resets after a scope' do
+    arena = FFI::Arena.new
+    ptr = nil
+    expect(arena.scope { ptr = arena.alloc(:int); 5 }).to eq(5)
+    expect(ptr.null?).to be true
+    expect(arena.used).to eq(0)
+  end
+
+  it 'frees its chunks after the block of new' do
+    ptr = nil
+    arena = FFI::Arena.new { |a| ptr = a.alloc(:int) }
+    expect(ptr.null?).to be true
+    expect(arena.capacity).to eq(0)
+  end
+
+  it 'frees its chunks when initialized with another chunk size' do
+    arena = FFI::Arena.new(1024)
+    ptr = arena.alloc(:int)
+    3.times { arena.alloc(512) }
+    arena.send(:initialize, 65536)
+    expect(ptr.null?).to be true
+    expect(arena.capacity).to eq(0)
+    expect(arena.chunk_size).to eq(65536)
+    arena.alloc(:char, 20_000).put_bytes(19_990, "0123456789")
+    expect(arena.capacity).to eq(65536)
+  end
+
+  it 'raises on invalid sizes and alignments' do
+    arena = FFI::Arena.new
+    expect { arena.alloc(:int, -1) }.to raise_error(ArgumentError)
+    expect { arena.alloc(:int, 1, 3) }.to raise_error(ArgumentError)
+    expect { FFI::Arena.new(0) }.to raise_error(ArgumentError)
+  end
+end
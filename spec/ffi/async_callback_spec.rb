@@ -18,6 +18,16 @@ describe "async callback" do
     attach_function :testAsyncCallbackDelayedRegister, [ AsyncIntCallback ], :void
     @blocking = true
     attach_function :testAsyncCallbackDelayedTrigger, [ :int ], :void
+    @blocking = true
+    attach_function :testThreadedClosureVrV, [ callback([], :void), :int ], :void
+    DetachedIntCallback = callback [ :int ], :void, async: :detached
+    DetachedStringCallback = callback [ :string ], :void, async: :detached
+    @blocking = true
+    attach_function :testAsyncDetachedCallback, :testAsyncCallback, [ DetachedIntCallback, :int ], :void
+    @blocking = true
+    attach_function :testAsyncCallbackString, [ DetachedStringCallback, :string ], :void
+    @blocking = true
+    attach_function :testThreadedDetachedClosure, :testThreadedClosureVrV, [ callback([], :void, async: :detached), :int ], :void
     freeze
   end
 
@@ -42,10 +52,122 @@ describe "async callback" do
     expect(th2).to be_kind_of(Thread)
     expect(th1).to_not eq(Thread.current)
     expect(th2).to_not eq(Thread.current)
-    expect(th1).to_not eq(th2)
+    expect(th1).to eq(th2) unless RUBY_ENGINE == "jruby"
     expect(v).to eq(6)
   end
 
+  it "runs callbacks issued concurrently by several native threads" do
+    skip "not yet supported on TruffleRuby" if RUBY_ENGINE == "truffleruby"
+    count = 0
+    mutex = Mutex.new
+    cb = proc { mutex.synchronize { count += 1 } }
+    4.times.map { Thread.new { LibTest.testThreadedClosureVrV(cb, 500) } }.each(&:join)
+    expect(count).to eq(2000)
+  end
+
+  context "detached" do
+    before do
+      skip "not yet supported on TruffleRuby" if RUBY_ENGINE == "truffleruby"
+      skip "not yet supported on JRuby" if RUBY_ENGINE == "jruby"
+    end
+
+    it "returns to the native thread before the proc has run" do
+      gate = Queue.new
+      result = Queue.new
+      cb = proc do |i|
+        begin
+          Timeout.timeout(5) { gate.pop }
+          result << i
+        rescue Timeout::Error
+          result << :blocked
+        end
+      end
+      LibTest.testAsyncDetachedCallback(cb, 42)
+      gate << true
+      expect(result.pop).to eq(42)
+    end
+
+    it "copies string arguments" do
+      result = Queue.new
+      LibTest.testAsyncCallbackString(proc { |s| result << s }, "detached")
+      expect(result.pop).to eq("detached")
+    end
+
+    it "runs the callbacks of a native thread on one runner" do
+      result = Queue.new
+      LibTest.testThreadedDetachedClosure(proc { result << Thread.current }, 10)
+      threads = 10.times.map { result.pop }
+      expect(threads.uniq.size).to eq(1)
+      expect(threads.first).to_not eq(Thread.current)
+    end
+
+    it "keeps the callback alive until it has run" do
+      gate = Queue.new
+      result = Queue.new
+      LibTest.testThreadedDetachedClosure(proc { gate.pop; result << true }, 10)
+      GC.start
+      GC.compact if GC.respond_to?(:compact)
+      10.times { gate << true }
+      expect(10.times.map { result.pop }).to eq([true] * 10)
+    end
+
+    it "requires a void return type" do
+      expect { FFI::CallbackInfo.new(:int, [:int], async: :detached) }.to raise_error(ArgumentError)
+    end
+
+    it "rejects unknown modes" do
+      expect { FFI::CallbackInfo.new(:void, [:int], async: :later) }.to raise_error(ArgumentError)
+    end
+  end
+
+  context "runner pool" do
+    before do
+      skip "not yet supported on TruffleRuby" if RUBY_ENGINE == "truffleruby"
+      skip "not yet supported on JRuby" if RUBY_ENGINE == "jruby"
+      @pool_size = FFI.callback_runner_pool_size
+      @affinity = FFI.callback_runner_affinity?
+    end
+
+    after do
+      FFI.callback_runner_pool_size = @pool_size
+      FFI.callback_runner_affinity = @affinity
+    end
+
+    it "starts a thread per callback with a pool size of 0" do
+      FFI.callback_runner_pool_size = 0
+      th1 = th2 = nil
+      LibTest.testAsyncCallback(1) { th1 = Thread.current }
+      LibTest.testAsyncCallback(2) { th2 = Thread.current }
+      expect(th1).to_not eq(th2)
+    end
+
+    it "uses another runner while the pooled one is busy" do
+      FFI.callback_runner_pool_size = 1
+      threads = []
+      LibTest.testAsyncCallback(1) do
+        threads << Thread.current
+        LibTest.testAsyncCallback(2) { threads << Thread.current }
+      end
+      expect(threads.size).to eq(2)
+      expect(threads[0]).to_not eq(threads[1])
+      expect(threads[1].name).to eq("FFI Callback Runner")
+    end
+
+    it "runs callbacks of one native thread on the same runner with affinity" do
+      FFI.callback_runner_pool_size = 3
+      FFI.callback_runner_affinity = true
+      threads = []
+      cb = proc { threads << Thread.current }
+      LibTest.testThreadedClosureVrV(cb, 10)
+      expect(threads.size).to eq(10)
+      expect(threads.uniq.size).to eq(1)
+    end
+
+    it "rejects a negative pool size" do
+      expect { FFI.callback_runner_pool_size = -1 }.to raise_error(ArgumentError)
+    end
+  end
+
   it "sets the name of the thread that runs the callback" do
     skip "not yet supported on TruffleRuby" if RUBY_ENGINE == "truffleruby"
     skip "not yet supported on JRuby" if RUBY_ENGINE == "jruby"
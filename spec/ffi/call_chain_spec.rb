@@ -0,0 +1,137 @@
+#
+# This file is part of ruby-ffi.
+# For licensing, see LICENSE.SPECS
+#
+
+require File.expand_path(File.join(File.dirname(__FILE__), "spec_helper"))
+
+module CallChainSpec
+describe FFI::CallChain do
+  module LibTest
+    extend FFI::Library
+    ffi_lib TestLibrary::PATH
+    attach_function :testAdd, [:int, :int], :int
+    attach_function :testAddOut, [:int, :int, :pointer], :int
+    attach_function :testAddBlocking, :testAdd, [:int, :int], :int, blocking: true
+    attach_function :ptr_ret_int32_t, [:pointer, :int], :int
+    attach_function :testBlockingOpen, [], :pointer
+    attach_function :testBlockingClose, [:pointer], :void
+    attach_function :ret_s32, [:int], :int
+    attach_function :ret_double, [:double], :double
+  end
+
+  let(:fn) { LibTest.attached_functions }
+
+  it 'returns the result of the last call by default' do
+    chain = FFI::CallChain.new
+    chain.call(fn[:testAdd], 1, 2)
+    chain.call(fn[:testAdd], 3, 4)
+    expect(chain.run).to eq(7)
+  end
+
+  it 'passes inputs and earlier results' do
+    chain = FFI::CallChain.new
+    a = chain.input
+    b = chain.input
+    sum = chain.call(fn[:testAdd], a, b)
+    chain.call(fn[:testAdd], sum, sum)
+    expect(chain.run(10, 5)).to eq(30)
+    expect(chain.run(-1, -2)).to eq(-6)
+  end
+
+  it 'passes out-params and their values' do
+    chain = FFI::CallChain.new
+    sum = chain.out(:int)
+    diff = chain.call(fn[:testAddOut], chain.input, 3, sum)
+    total = chain.call(fn[:testAdd], sum.value, diff)
+    chain.returns(diff, sum, total)
+    expect(chain.run(10)).to eq([7, 13, 20])
+  end
+
+  it 'returns a single value for a single reference' do
+    chain = FFI::CallChain.new
+    sum = chain.out(:int)
+    chain.call(fn[:testAddOut], 1, 2, sum)
+    chain.returns(sum)
+    expect(chain.run).to eq(3)
+  end
+
+  it 'passes pointer results' do
+    chain = FFI::CallChain.new
+    handle = chain.call(fn[:testBlockingOpen])
+    chain.call(fn[:testBlockingClose], handle)
+    chain.returns(handle)
+    expect(chain.run).to be_a(FFI::Pointer)
+  end
+
+  it 'runs blocking functions' do
+    chain = FFI::CallChain.new
+    sum = chain.call(fn[:testAddBlocking], chain.input, 2)
+    chain.call(fn[:testAddBlocking], sum, 3)
+    expect(chain.run(1)).to eq(6)
+  end
+
+  it 'converts constants on every run' do
+    mem = FFI::MemoryPointer.new(:int, 2)
+    mem.put_array_of_int(0, [11, 22])
+    chain = FFI::CallChain.new
+    chain.call(fn[:ptr_ret_int32_t], mem, chain.input)
+    expect(chain.run(0)).to eq(11)
+    expect(chain.run(4)).to eq(22)
+  end
+
+  it 'keeps its functions alive' do
+    chain = FFI::CallChain.new
+    chain.call(FFI::Function.new(:int, [:int, :int]) { |a, b| a * b }, chain.input, 7)
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+    expect(chain.run(6)).to eq(42)
+  end
+
+  it 'raises on a wrong number of arguments' do
+    chain = FFI::CallChain.new
+    expect { chain.call(fn[:testAdd], 1) }.to raise_error(ArgumentError)
+    chain.call(fn[:testAdd], chain.input, 1)
+    expect { chain.run }.to raise_error(ArgumentError)
+  end
+
+  it 'raises on references of another chain' do
+    other = FFI::CallChain.new
+    chain = FFI::CallChain.new
+    expect { chain.call(fn[:testAdd], other.input, 1) }.to raise_error(ArgumentError)
+  end
+
+  it 'raises when an out-param is passed as a non pointer' do
+    chain = FFI::CallChain.new
+    expect { chain.call(fn[:testAdd], chain.out(:int), 1) }.to raise_error(TypeError)
+  end
+
+  it 'raises when a result is passed as another kind of value' do
+    chain = FFI::CallChain.new
+    int = chain.call(fn[:ret_s32], 7)
+    double = chain.call(fn[:ret_double], 7.5)
+    expect { chain.call(fn[:ret_double], int) }.to raise_error(TypeError)
+    expect { chain.call(fn[:ret_s32], double) }.to raise_error(TypeError)
+    expect { chain.call(fn[:testBlockingClose], int) }.to raise_error(TypeError)
+  end
+
+  it 'raises when an out-param value is passed as another kind of value' do
+    chain = FFI::CallChain.new
+    expect { chain.call(fn[:ret_double], chain.out(:int).value) }.to raise_error(TypeError)
+    expect { chain.call(fn[:ret_s32], chain.out(:double).value) }.to raise_error(TypeError)
+  end
+
+  it 'passes results of the same kind of value' do
+    chain = FFI::CallChain.new
+    double = chain.call(fn[:ret_double], chain.input)
+    chain.call(fn[:ret_double], double)
+    expect(chain.run(7.5)).to eq(7.5)
+  end
+
+  it 'raises when a void result is referenced' do
+    chain = FFI::CallChain.new
+    void = chain.call(fn[:testBlockingClose], nil)
+    expect { chain.call(fn[:testAdd], void, 1) }.to raise_error(ArgumentError)
+  end
+end
+end
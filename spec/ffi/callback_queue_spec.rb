@@ -0,0 +1,108 @@
+#
+# This file is part of ruby-ffi.
+# For licensing, see LICENSE.SPECS
+#
+
+require File.expand_path(File.join(File.dirname(__FILE__), "spec_helper"))
+
+module CallbackQueueSpec
+describe FFI::CallbackQueue do
+  module LibTest
+    extend FFI::Library
+    ffi_lib TestLibrary::PATH
+    enum :color, [:red, :green, :blue]
+    callback :cbVrV, [], :void
+    callback :cbIDrV, [:int, :double], :void
+    callback :cbPrV, [:pointer], :void
+    callback :cbColorrV, [:color], :void
+    callback :cbIrI, [:int], :int
+    callback :cbStringrV, [:string], :void
+    attach_function :testThreadedClosureVrV, [:cbVrV, :int], :void
+    attach_function :testClosureIDrV, [:cbIDrV, :int, :double], :void
+    attach_function :testClosurePrV, [:cbPrV, :pointer], :void
+    attach_function :testClosureIrV, :testClosureIrV, [:cbColorrV, :int], :void
+  end
+
+  def queue(name, capacity = 1024)
+    FFI::CallbackQueue.new(LibTest.find_type(name), capacity)
+  end
+
+  it 'queues the arguments of calls until drained' do
+    q = queue(:cbIDrV)
+    LibTest.testClosureIDrV(q, 1, 1.5)
+    LibTest.testClosureIDrV(q, -2, 2.5)
+    expect(q.size).to eq(2)
+    seen = []
+    expect(q.drain { |i, d| seen << [i, d] }).to eq(2)
+    expect(seen).to eq([[1, 1.5], [-2, 2.5]])
+    expect(q.size).to eq(0)
+  end
+
+  it 'returns the arguments without a block' do
+    q = queue(:cbIDrV)
+    3.times { |i| LibTest.testClosureIDrV(q, i, 0.5) }
+    expect(q.drain(2)).to eq([[0, 0.5], [1, 0.5]])
+    expect(q.drain).to eq([[2, 0.5]])
+  end
+
+  it 'converts pointers and data converters when drained' do
+    q = queue(:cbPrV)
+    LibTest.testClosurePrV(q, FFI::Pointer.new(0x1234))
+    expect(q.drain.first.first.address).to eq(0x1234)
+    q = queue(:cbColorrV)
+    LibTest.testClosureIrV(q, 2)
+    expect(q.drain).to eq([[:blue]])
+  end
+
+  it 'records calls from native threads' do
+    q = queue(:cbVrV)
+    LibTest.testThreadedClosureVrV(q, 10)
+    expect(q.size).to eq(10)
+    expect(q.drain { }).to eq(10)
+  end
+
+  it 'yields batches' do
+    q = queue(:cbIDrV)
+    10.times { |i| LibTest.testClosureIDrV(q, i, 0.0) }
+    batches = []
+    expect(q.each_batch(4) { |batch| batches << batch.map(&:first) }).to eq(10)
+    expect(batches).to eq([[0, 1, 2, 3], [4, 5, 6, 7], [8, 9]])
+  end
+
+  it 'drops calls when full' do
+    q = queue(:cbVrV, 4)
+    LibTest.testThreadedClosureVrV(q, 6)
+    expect(q.capacity).to eq(4)
+    expect(q.size).to eq(4)
+    expect(q.dropped).to eq(2)
+  end
+
+  it 'consumes the calls the block has seen when it raises' do
+    q = queue(:cbIDrV)
+    3.times { |i| LibTest.testClosureIDrV(q, i, 0.0) }
+    expect { q.drain { |i, _| raise 'stop' if i == 1 } }.to raise_error(RuntimeError, 'stop')
+    expect(q.drain).to eq([[2, 0.0]])
+  end
+
+  it 'raises when drained from its block' do
+    q = queue(:cbVrV)
+    LibTest.testThreadedClosureVrV(q, 1)
+    expect { q.drain { q.drain } }.to raise_error(RuntimeError, /already being drained/)
+  end
+
+  it 'has an IO which is readable while calls are queued', skip: FFI::Platform.windows? do
+    q = queue(:cbVrV)
+    expect(IO.select([q], nil, nil, 0)).to be_nil
+    LibTest.testThreadedClosureVrV(q, 3)
+    expect(IO.select([q], nil, nil, 1)).to eq([[q], [], []])
+    q.drain
+    expect(IO.select([q], nil, nil, 0)).to be_nil
+  end
+
+  it 'rejects unsupported signatures' do
+    expect { queue(:cbIrI) }.to raise_error(TypeError)
+    expect { queue(:cbStringrV) }.to raise_error(TypeError)
+    expect { queue(:cbVrV, 0) }.to raise_error(ArgumentError)
+  end
+end
+end
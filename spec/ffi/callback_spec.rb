@@ -492,6 +492,118 @@ module CallbackSpecs
         f = LibTest.testReturnsFunctionPointer
         expect(f.call(3)).to eq(6)
       end
+
+      it 'function returning the same pointer reuses the callable object', skip: RUBY_VERSION < "2.7" do
+        module LibTest
+          extend FFI::Library
+          ffi_lib TestLibrary::PATH
+          callback :funcptr, [ :int ], :int
+          attach_function :testReturnsFunctionPointer, [  ], :funcptr
+        end
+        f = LibTest.testReturnsFunctionPointer
+        expect(LibTest.testReturnsFunctionPointer).to equal(f)
+        expect(f.call(3)).to eq(6)
+      end
+
+      it 'function returning the same pointer reuses the callable object in a Ractor', :ractor do
+        res = Ractor.new do
+          f = LibTest.testReturnsFunctionPointer
+          [LibTest.testReturnsFunctionPointer.equal?(f), f.call(3)]
+        end.value
+        expect(res).to eq([true, 6])
+      end
+    end
+
+    describe "with scope: :call" do
+      module LibScoped
+        extend FFI::Library
+        ffi_lib TestLibrary::PATH
+        callback :cbVrS32, [ ], :int, scope: :call
+        attach_function :testCallbackVrS32, :testClosureVrI, [ :cbVrS32 ], :int
+        callback :cbPrV, [ :pointer ], :void, scope: :call, reuse_pointers: true
+        attach_function :testCallbackPrV, :testClosurePrV, [ :cbPrV, :pointer ], :void
+
+        module ScopedConverter
+          extend FFI::DataConverter
+          native_type FFI::FunctionType.new(:int, [], scope: :call)
+          def self.to_native(value, ctx)
+            value
+          end
+        end
+        attach_function :testMappedCallbackVrS32, :testClosureVrI, [ ScopedConverter ], :int
+        freeze
+      end
+
+      it "calls the block" do
+        expect(LibScoped.testCallbackVrS32 { 42 }).to eq(42)
+        expect(LibScoped.testCallbackVrS32 { 43 }).to eq(43)
+      end
+
+      it "calls a proc argument" do
+        expect(LibScoped.testCallbackVrS32(proc { 44 })).to eq(44)
+      end
+
+      it "doesn't wrap the proc into a Function" do
+        pr = proc { 45 }
+        expect(LibScoped.testCallbackVrS32(pr)).to eq(45)
+        expect(pr.instance_variables).to be_empty
+      end
+
+      it "accepts a Function" do
+        fn = FFI::Function.new(:int, []) { 46 }
+        expect(LibScoped.testCallbackVrS32(fn)).to eq(46)
+      end
+
+      it "binds nested calls separately" do
+        inner = nil
+        outer = LibScoped.testCallbackVrS32 do
+          inner = LibScoped.testCallbackVrS32 { 2 }
+          1
+        end
+        expect([outer, inner]).to eq([1, 2])
+        expect(LibScoped.testCallbackVrS32 { 3 }).to eq(3)
+      end
+
+      it "binds deeply nested calls" do
+        nest = proc { |n| n == 0 ? 0 : LibScoped.testCallbackVrS32 { nest.call(n - 1) + 1 } }
+        expect(nest.call(20)).to eq(20)
+        expect(nest.call(20)).to eq(20)
+      end
+
+      it "binds callbacks of mapped types" do
+        pr = proc { 48 }
+        expect(LibScoped.testMappedCallbackVrS32(pr)).to eq(48)
+        expect(pr.instance_variables).to be_empty
+      end
+
+      it "calls the block in a Ractor", :ractor do
+        res = Ractor.new do
+          [LibScoped.testCallbackVrS32 { 49 }, LibScoped.testCallbackVrS32 { 50 }]
+        end.value
+        expect(res).to eq([49, 50])
+      end
+
+      it "releases the binding when the block raises" do
+        expect { LibScoped.testCallbackVrS32 { raise ArgumentError, "scoped" } }.to raise_error(ArgumentError, "scoped")
+        expect(LibScoped.testCallbackVrS32 { 47 }).to eq(47)
+      end
+
+      it "reuses pointer arguments" do
+        mem = FFI::MemoryPointer.new(:int).write_int(42)
+        args = []
+        2.times { LibScoped.testCallbackPrV(mem) { |i| args << i.read_int << i } }
+        expect(args.values_at(0, 2)).to eq([42, 42])
+        expect(args[1]).to equal(args[3])
+        expect(args[1]).to be_null
+      end
+
+      it "rejects an invalid scope" do
+        expect { FFI::FunctionType.new(:void, [], scope: :global) }.to raise_error(ArgumentError)
+      end
+
+      it "rejects detached callbacks" do
+        expect { FFI::FunctionType.new(:void, [], scope: :call, async: :detached) }.to raise_error(ArgumentError)
+      end
     end
   end
 end
@@ -796,6 +908,39 @@ module CallbackWithSpecs
       expect(v).to eq(FFI::Pointer::NULL)
     end
 
+    it ":pointer argument with reuse_pointers" do
+      mem = FFI::MemoryPointer.new(:int)
+      mem.write_int(42)
+      args = []
+      values = []
+      fn = FFI::Function.new(:void, [ :pointer ], reuse_pointers: true) { |i| args << i; values << i.read_int }
+      LibTest.testCallbackPrV(fn, mem)
+      LibTest.testCallbackPrV(fn, mem)
+      expect(values).to eq([42, 42])
+      expect(args[0]).to equal(args[1])
+      expect(args[0]).to be_null
+      expect { args[0].read_int }.to raise_error(FFI::NullPointerError)
+    end
+
+    it ":pointer (nil) argument with reuse_pointers" do
+      v = nil
+      fn = FFI::Function.new(:void, [ :pointer ], reuse_pointers: true) { |i| v = i }
+      LibTest.testCallbackPrV(fn, nil)
+      expect(v).to equal(FFI::Pointer::NULL)
+    end
+
+    it ":pointer argument with reuse_pointers in a nested call" do
+      a = FFI::MemoryPointer.new(:int).write_int(1)
+      b = FFI::MemoryPointer.new(:int).write_int(2)
+      values = []
+      fn = FFI::Function.new(:void, [ :pointer ], reuse_pointers: true) do |i|
+        LibTest.testCallbackPrV(fn, b) if i.read_int == 1
+        values << i.read_int
+      end
+      LibTest.testCallbackPrV(fn, a)
+      expect(values).to eq([2, 1])
+    end
+
     it "struct by reference argument" do
       v = nil
       magic = LibTest::S8F32S32.new
@@ -14,6 +14,7 @@
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #endif
 
 #include "PipeHelper.h"
@@ -23,6 +24,12 @@ int testAdd(int a, int b)
     return a + b;
 };
 
+int testAddOut(int a, int b, int* sum)
+{
+    *sum = a + b;
+    return a - b;
+};
+
 int testFunctionAdd(int a, int b, int (*f)(int, int))
 {
     return f(a, b);
@@ -139,6 +146,48 @@ void testAsyncCallback(void (*fn)(int), int value)
 #endif
 }
 
+struct async_string_data {
+    void (*fn)(const char *);
+    const char* str;
+};
+
+static void* asyncThreadCallString(void *data)
+{
+    struct async_string_data* d = (struct async_string_data *) data;
+    char buf[64];
+
+    strncpy(buf, d->str, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    (*d->fn)(buf);
+    /* The string is gone once the callback returned */
+    memset(buf, 'X', sizeof(buf) - 1);
+
+    return NULL;
+}
+
+#ifdef _WIN32
+static void
+asyncThreadCallString_win32(void *arg)
+{
+    asyncThreadCallString(arg);
+}
+#endif
+
+void testAsyncCallbackString(void (*fn)(const char *), const char* str)
+{
+    struct async_string_data d;
+    d.fn = fn;
+    d.str = str;
+#ifndef _WIN32
+    pthread_t t;
+    pthread_create(&t, NULL, asyncThreadCallString, &d);
+    pthread_join(t, NULL);
+#else
+    HANDLE hThread = (HANDLE) _beginthread(asyncThreadCallString_win32, 0, &d);
+    WaitForSingleObject(hThread, INFINITE);
+#endif
+}
+
 #if defined(_WIN32) && !defined(_WIN64)
 struct StructUCDP {
   unsigned char a1;
@@ -11,6 +11,8 @@ describe FFI::Function do
     extend FFI::Library
     ffi_lib TestLibrary::PATH
     attach_function :testFunctionAdd, [:int, :int, :pointer], :int
+    attach_function :testThreadedClosureVrV, [:pointer, :int], :void, blocking: true
+    attach_function :testFunctionAddBlocking, :testFunctionAdd, [:int, :int, :pointer], :int, blocking: true
     freeze
   end
   before do
@@ -82,6 +84,110 @@ describe FFI::Function do
     expect( res ).to eq(20)
   end
 
+  it "can be created and released in parallel Ractors", :ractor do
+    res = 4.times.map do
+      Ractor.new do
+        200.times.sum do |i|
+          GC.start if i % 50 == 0
+          LibTest.testFunctionAdd(i, 1, FFI::Function.new(:int, [:int, :int]) { |a, b| a + b })
+        end
+      end
+    end.map(&:value)
+
+    expect( res ).to eq([200 * 201 / 2] * 4)
+  end
+
+  it "dispatches callbacks from native threads into the bound Ractor", :ractor do
+    count = Ractor.make_shareable(nil.instance_eval { proc { Ractor.current[:hits] = (Ractor.current[:hits] || 0) + 1 } })
+    fn = Ractor.make_shareable(FFI::Function.new(:void, [], count))
+
+    res = Ractor.new(fn) do |fn2|
+      fn2.bind_ractor
+      LibTest.testThreadedClosureVrV(fn2, 3)
+      [fn2.ractor == Ractor.current, Ractor.current[:hits]]
+    end.value
+
+    expect( res ).to eq([true, 3])
+    # The Ractor's dispatcher thread might still be shutting down
+    Timeout.timeout(10) { sleep 0.01 until fn.ractor.nil? }
+    LibTest.testThreadedClosureVrV(fn, 2)
+    expect( Ractor.current[:hits] ).to be_nil
+
+    fn.bind_ractor
+    LibTest.testThreadedClosureVrV(fn, 2)
+    expect( Ractor.current[:hits] ).to eq(2)
+    expect( fn.ractor ).to eq(Ractor.current)
+  ensure
+    Ractor.current[:hits] = nil
+  end
+
+  it "can be bound to Ractors back and forth", :ractor do
+    fn = Ractor.make_shareable(FFI::Function.new(:void, [], nil.instance_eval { proc { } }))
+
+    res = 3.times.map do
+      bound = Ractor.new(fn) do |fn2|
+        fn2.bind_ractor
+        LibTest.testThreadedClosureVrV(fn2, 2)
+        fn2.ractor == Ractor.current
+      end.value
+      fn.bind_ractor
+      LibTest.testThreadedClosureVrV(fn, 2)
+      bound
+    end
+
+    expect( res ).to eq([true] * 3)
+    expect( fn.ractor ).to eq(Ractor.current)
+  end
+
+  context "with callback metrics" do
+    before { FFI.callback_metrics = true }
+    after { FFI.callback_metrics = false }
+
+    it "records the time running ruby" do
+      fn = FFI::Function.new(:int, [:int, :int]) { |a, b| a + b }
+      expect(fn.metrics).to be_nil
+      LibTest.testFunctionAdd(1, 2, fn)
+      LibTest.testFunctionAdd(3, 4, fn)
+
+      m = fn.metrics
+      expect(m[:ruby][:count]).to eq(2)
+      expect(m[:ruby][:histogram].sum).to eq(2)
+      expect(m[:ruby][:max_ns]).to be <= m[:ruby][:total_ns]
+      expect(m[:queue][:count]).to eq(0)
+      expect(m[:gvl][:count]).to eq(0)
+    end
+
+    it "records the GVL wait of blocking functions" do
+      fn = FFI::Function.new(:int, [:int, :int]) { |a, b| a + b }
+      expect(LibTest.testFunctionAddBlocking(1, 2, fn)).to eq(3)
+      expect(fn.metrics[:gvl][:count]).to eq(1)
+      expect(fn.metrics[:queue][:count]).to eq(0)
+    end
+
+    it "records the queueing of calls from native threads" do
+      fn = FFI::Function.new(:void, []) { }
+      LibTest.testThreadedClosureVrV(fn, 3)
+
+      m = fn.metrics
+      expect([m[:queue][:count], m[:gvl][:count], m[:ruby][:count]]).to eq([3, 3, 3])
+    end
+
+    it "can be reset" do
+      fn = FFI::Function.new(:int, [:int, :int]) { |a, b| a + b }
+      LibTest.testFunctionAdd(1, 2, fn)
+      expect(fn.reset_metrics).to equal(fn)
+      expect(fn.metrics).to be_nil
+    end
+
+    it "records nothing when disabled" do
+      FFI.callback_metrics = false
+      expect(FFI.callback_metrics?).to be false
+      fn = FFI::Function.new(:int, [:int, :int]) { |a, b| a + b }
+      LibTest.testFunctionAdd(1, 2, fn)
+      expect(fn.metrics).to be_nil
+    end
+  end
+
   it 'can be used to wrap an existing function pointer' do
     expect(FFI::Function.new(:int, [:int, :int], @libtest.find_function('testAdd')).call(10, 10)).to eq(20)
   end
@@ -132,6 +238,28 @@ describe FFI::Function do
     end
   end
 
+  it 'shares the FunctionType of identical signatures' do
+    fp1 = FFI::Function.new(:int, [:int, :int], @libtest.find_function('testAdd'))
+    fp2 = FFI::Function.new(:int, [:int, :int], @libtest.find_function('testAdd'))
+    expect(fp1.send(:type)).to equal(fp2.send(:type))
+    expect(FFI::FunctionType.new(:int, [:int, :int])).to equal(fp1.send(:type))
+    expect(FFI::FunctionType.new(:int, [:int, :int], blocking: true)).not_to equal(fp1.send(:type))
+    expect(FFI::FunctionType.new(:int, [:int, :long])).not_to equal(fp1.send(:type))
+  end
+
+  it "doesn't keep the FunctionTypes of unused signatures alive", skip: RUBY_VERSION < "2.7" do
+    types = ObjectSpace::WeakMap.new
+    make_types = proc do
+      100.times do |i|
+        struct = Class.new(FFI::Struct) { layout :a, :int }
+        types[i] = FFI::FunctionType.new(:int, [struct.by_value])
+      end
+    end
+    make_types.call
+    GC.start
+    expect(types.keys.size).to be < 100
+  end
+
   it 'autorelease flag is set to true by default' do
     fp = FFI::Function.new(:int, [:int, :int], @libtest.find_function('testAdd'))
     expect(fp.autorelease?).to be true
@@ -148,6 +276,44 @@ describe FFI::Function do
     expect { fp.free }.to raise_error RuntimeError
   end
 
+  describe 'closure pools' do
+    after do
+      FFI.closure_pool_limit = 0
+    end
+
+    it 'can reserve closures of a FunctionType' do
+      type = FFI::FunctionType.new(:int16, [:pointer, :int8, :uint16])
+      expect(type.reserve_closures(300)).to equal(type)
+      stats = FFI.closure_pool_stats["int16 (pointer, int8, uint16)"]
+      expect(stats[:free]).to be >= 300
+      expect(stats[:pages]).to be > 0
+      expect { type.reserve_closures(-1) }.to raise_error(ArgumentError)
+    end
+
+    it 'counts live closures per signature' do
+      fns = 3.times.map { FFI::Function.new(:uint16, [:int8, :pointer, :int16]) { 0 } }
+      expect(FFI.closure_pool_stats["uint16 (int8, pointer, int16)"][:live]).to be >= 3
+      fns.each(&:free)
+      expect(FFI.closure_pool_stats["uint16 (int8, pointer, int16)"][:live]).to eq(0)
+    end
+
+    it 'gives pages of unused closures back' do
+      fns = 3000.times.map { FFI::Function.new(:int8, [:int16, :int16, :pointer]) { 0 } }
+      pages = FFI.closure_pool_stats["int8 (int16, int16, pointer)"][:pages]
+      fns.each(&:free)
+      expect(FFI.closure_pool_stats["int8 (int16, int16, pointer)"][:pages]).to be < pages
+    end
+
+    it 'raises when the limit is reached' do
+      expect(FFI.closure_pool_limit).to eq(0)
+      FFI.closure_pool_limit = 1
+      expect {
+        3000.times.map { FFI::Function.new(:uint8, [:int16, :pointer, :pointer]) { 0 } }
+      }.to raise_error(RuntimeError, /closure pool limit/)
+      expect { FFI.closure_pool_limit = -1 }.to raise_error(ArgumentError)
+    end
+  end
+
   it 'has a memsize function', skip: RUBY_ENGINE != "ruby" do
     base_size = ObjectSpace.memsize_of(Object.new)
 
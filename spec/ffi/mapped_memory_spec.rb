@@ -0,0 +1,113 @@
+#
+# This file is part of ruby-ffi.
+# For licensing, see LICENSE.SPECS
+#
+
+require File.expand_path(File.join(File.dirname(__FILE__), "spec_helper"))
+require 'tmpdir'
+
+describe FFI::MappedMemory do
+  module MappedMemorySpecLib
+    extend FFI::Library
+    ffi_lib TestLibrary::PATH
+    attach_function :ptr_ret_int32_t, [:pointer, :int], :int
+  end
+
+  class MappedMemorySpecHeader < FFI::Struct
+    layout :magic, :uint32, :count, :uint32
+  end
+
+  around do |example|
+    Dir.mktmpdir do |dir|
+      @path = File.join(dir, "data.bin")
+      File.binwrite(@path, [0xcafe, 3, 10, 20, 30].pack("L*"))
+      example.run
+    end
+  end
+
+  before do
+    skip "memory mapped files are not supported" if FFI::Platform.windows?
+  end
+
+  it 'maps the whole file read-only by default' do
+    FFI::MappedMemory.open(@path) do |mem|
+      expect(mem).to be_a(FFI::Pointer)
+      expect(mem.size).to eq(20)
+      expect(mem.path).to eq(@path)
+      expect(mem.read_array_of_uint32(5)).to eq([0xcafe, 3, 10, 20, 30])
+      expect { mem.put_uint32(0, 1) }.to raise_error(RuntimeError)
+    end
+  end
+
+  it 'returns the result of the block and unmaps the memory' do
+    mem = nil
+    value = FFI::MappedMemory.open(@path) { |m| mem = m; m.get_uint32(8) }
+    expect(value).to eq(10)
+    expect(mem.mapped?).to be false
+    expect { mem.get_uint32(0) }.to raise_error(FFI::NullPointerError)
+  end
+
+  it 'maps a region at an unaligned offset' do
+    mem = FFI::MappedMemory.new(@path, "r", offset: 8, length: 8)
+    expect(mem.offset).to eq(8)
+    expect(mem.size).to eq(8)
+    expect(mem.read_array_of_uint32(2)).to eq([10, 20])
+    expect { mem.get_uint32(8) }.to raise_error(IndexError)
+    mem.unmap
+  end
+
+  it 'is usable for structs and pointer arguments' do
+    FFI::MappedMemory.open(@path) do |mem|
+      header = MappedMemorySpecHeader.new(mem)
+      expect([header[:magic], header[:count]]).to eq([0xcafe, 3])
+      expect(MappedMemorySpecLib.ptr_ret_int32_t(mem, 16)).to eq(30)
+      expect(MappedMemorySpecLib.ptr_ret_int32_t(mem + 8, 4)).to eq(20)
+    end
+  end
+
+  it 'writes through to the file in "r+" mode' do
+    FFI::MappedMemory.open(@path, "r+") do |mem|
+      mem.put_uint32(8, 11)
+      mem.msync
+      mem.msync(8, 4, async: true)
+    end
+    expect(File.binread(@path).unpack("L*")).to eq([0xcafe, 3, 11, 20, 30])
+  end
+
+  it 'keeps writes private in "c" mode' do
+    FFI::MappedMemory.open(@path, "c") do |mem|
+      mem.put_uint32(8, 11)
+      expect(mem.get_uint32(8)).to eq(11)
+    end
+    expect(File.binread(@path).unpack("L*")).to eq([0xcafe, 3, 10, 20, 30])
+  end
+
+  it 'remaps another region of the file' do
+    FFI::MappedMemory.open(@path, length: 8) do |mem|
+      File.open(@path, "ab") { |f| f.write([40].pack("L")) }
+      mem.remap(offset: 12)
+      expect(mem.offset).to eq(12)
+      expect(mem.read_array_of_uint32(3)).to eq([20, 30, 40])
+    end
+  end
+
+  it 'accepts advice' do
+    FFI::MappedMemory.open(@path) do |mem|
+      [:normal, :sequential, :random, :willneed, :hugepage].each do |advice|
+        expect(mem.madvise(advice)).to equal(mem)
+      end
+      expect(mem.madvise(:willneed, 4, 8)).to equal(mem)
+      expect { mem.madvise(:foo) }.to raise_error(ArgumentError)
+      expect { mem.madvise(:normal, 16, 8) }.to raise_error(IndexError)
+    end
+  end
+
+  it 'rejects invalid arguments' do
+    expect { FFI::MappedMemory.new(@path, "w") }.to raise_error(ArgumentError)
+    expect { FFI::MappedMemory.new(@path, offset: 24) }.to raise_error(ArgumentError)
+    expect { FFI::MappedMemory.new(@path, offset: 4, length: 20) }.to raise_error(ArgumentError)
+    expect { FFI::MappedMemory.new(@path, length: 0) }.to raise_error(ArgumentError)
+    expect { FFI::MappedMemory.new(@path + ".missing") }.to raise_error(Errno::ENOENT)
+    expect { FFI::MappedMemory.new(@path).unmap.remap }.to raise_error(RuntimeError)
+  end
+end
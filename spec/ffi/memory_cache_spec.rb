@@ -0,0 +1,58 @@
+#
+# This file is part of ruby-ffi.
+# For licensing, see LICENSE.SPECS
+#
+
+require File.expand_path(File.join(File.dirname(__FILE__), "spec_helper"))
+
+describe "FFI.memory_cache_stats" do
+  it 'reports the freelists of each block size' do
+    stats = FFI.memory_cache_stats
+    expect(stats.keys).to eq([16, 32, 64, 128, 256, 512, 1024, 2048, 4096])
+    expect(stats[16].keys).to eq([:free, :hits, :misses])
+  end
+
+  it 'reuses the storage of a freed MemoryPointer' do
+    address = FFI::MemoryPointer.new(:char, 100).free.address
+    hits = FFI.memory_cache_stats[128][:hits]
+
+    ptr = FFI::MemoryPointer.new(:char, 120)
+    expect(ptr.address).to eq(address)
+    expect(ptr.get_bytes(0, 120)).to eq("\0" * 120)
+    expect(FFI.memory_cache_stats[128][:hits]).to eq(hits + 1)
+  end
+
+  it 'reuses the storage of a Buffer' do
+    FFI::Buffer.new(:char, 200) { }
+    hits = FFI.memory_cache_stats[256][:hits]
+    FFI::Buffer.new(:char, 256)
+    expect(FFI.memory_cache_stats[256][:hits]).to eq(hits + 1)
+  end
+
+  it 'keeps duplicates independent' do
+    ptr = FFI::MemoryPointer.new(:int, 2).write_array_of_int([1, 2])
+    dup = ptr.dup
+    ptr.free
+    FFI::MemoryPointer.new(:int, 2).write_array_of_int([3, 4])
+    expect(dup.read_array_of_int(2)).to eq([1, 2])
+  end
+
+  it 'aligns the storage like malloc' do
+    align = FFI::Platform::ADDRESS_SIZE == 64 ? 16 : 8
+    ptrs = (65..300).map { |i| FFI::MemoryPointer.new(:char, i) }
+    expect(ptrs.map { |ptr| ptr.address % align }.uniq).to eq([0])
+  end
+
+  it 'caches nothing with a limit of zero' do
+    limit = FFI.memory_cache_limit
+    begin
+      FFI.memory_cache_limit = 0
+      free = FFI.memory_cache_stats[2048][:free]
+      FFI::MemoryPointer.new(:char, 2000).free
+      expect(FFI.memory_cache_stats[2048][:free]).to eq(free)
+    ensure
+      FFI.memory_cache_limit = limit
+    end
+    expect { FFI.memory_cache_limit = -1 }.to raise_error(ArgumentError)
+  end
+end
@@ -110,3 +110,54 @@ describe "#autorelease" do
     expect{ ptr.autorelease = false }.to raise_error(FrozenError)
   end
 end
+
+describe "MemoryPointer with small sizes" do
+  it "doesn't allocate from the memory cache" do
+    misses = FFI.memory_cache_stats[64][:misses]
+    hits = FFI.memory_cache_stats[64][:hits]
+    ptrs = 10.times.map { MemoryPointer.new(:char, 64) }
+    expect(FFI.memory_cache_stats[64][:misses]).to eq(misses)
+    expect(FFI.memory_cache_stats[64][:hits]).to eq(hits)
+    expect(ptrs.map(&:total).uniq).to eq([64])
+  end
+
+  it "is zeroed and aligned" do
+    ptrs = (1..64).map { |i| MemoryPointer.new(:char, i) }
+    expect(ptrs.map { |ptr| ptr.address % 8 }.uniq).to eq([0])
+    expect(ptrs.map { |ptr| ptr.get_bytes(0, ptr.total) }).to eq((1..64).map { |i| "\0" * i })
+  end
+
+  it "keeps its address across GC compaction" do
+    skip "GC.compact is not supported" unless GC.respond_to?(:compact)
+    ptr = MemoryPointer.new(:long_long, 2).write_array_of_long_long([1, 2])
+    address = ptr.address
+    GC.compact rescue skip("GC.compact is not supported")
+    expect(ptr.address).to eq(address)
+    expect(FFI::Pointer.new(address).read_array_of_long_long(2)).to eq([1, 2])
+  end
+
+  it "keeps duplicates independent" do
+    ptr = MemoryPointer.new(:int, 2).write_array_of_int([1, 2])
+    dup = ptr.dup
+    ptr.write_array_of_int([3, 4])
+    expect(dup.read_array_of_int(2)).to eq([1, 2])
+    expect(dup.address).not_to eq(ptr.address)
+  end
+
+  it "stays valid without autorelease" do
+    ptr = MemoryPointer.new(:int).write_int(42)
+    ptr.autorelease = false
+    address = ptr.address
+    ptr = nil
+    GC.start
+    expect(FFI::Pointer.new(address).read_int).to eq(42)
+  end
+
+  it "backs small structs" do
+    s = Class.new(FFI::Struct) { layout :a, :int, :b, :double }.new
+    s[:a] = 7
+    s[:b] = 1.5
+    expect(s.pointer).to be_a(MemoryPointer)
+    expect([s[:a], s[:b]]).to eq([7, 1.5])
+  end
+end
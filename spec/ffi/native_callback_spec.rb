@@ -0,0 +1,115 @@
+#
+# This file is part of ruby-ffi.
+# For licensing, see LICENSE.SPECS
+#
+
+require File.expand_path(File.join(File.dirname(__FILE__), "spec_helper"))
+
+module NativeCallbackSpec
+describe FFI::NativeCallback do
+  module LibC
+    extend FFI::Library
+    ffi_lib FFI::Library::LIBC
+    callback :qsort_cmp, [ :pointer, :pointer ], :int
+    attach_function :qsort, [ :pointer, :size_t, :size_t, :qsort_cmp ], :void
+    attach_function :bsearch, [ :pointer, :pointer, :size_t, :size_t, :qsort_cmp ], :pointer
+  end
+
+  class Record < FFI::Struct
+    layout :id, :int32, :score, :double, :name, [ :char, 8 ], :label, :string
+  end
+
+  def records(*rows)
+    mem = FFI::MemoryPointer.new(Record, rows.size)
+    @labels = []
+    rows.each_with_index do |(id, score, name), i|
+      r = Record.new(mem + i * Record.size)
+      r[:id] = id
+      r[:score] = score
+      r[:name] = name
+      r.pointer.put_pointer(Record.offset_of(:label), (@labels << FFI::MemoryPointer.from_string(name)).last)
+    end
+    mem
+  end
+
+  def ids(mem, count)
+    count.times.map { |i| Record.new(mem + i * Record.size)[:id] }
+  end
+
+  def call(fn, ret, *args)
+    FFI::Function.new(ret, args.map { :pointer }, fn).call(*args)
+  end
+
+  it "is a pointer to native code" do
+    cmp = FFI::NativeCallback.compare(:int32)
+    expect(cmp).to be_a(FFI::Pointer)
+    expect(cmp).not_to be_null
+    expect(cmp.kind).to eq(:compare)
+  end
+
+  it "sorts integers" do
+    mem = FFI::MemoryPointer.new(:int32, 5).put_array_of_int32(0, [ 3, -1, 4, 1, -5 ])
+    LibC.qsort(mem, 5, 4, FFI::NativeCallback.compare(:int32))
+    expect(mem.get_array_of_int32(0, 5)).to eq([ -5, -1, 1, 3, 4 ])
+    LibC.qsort(mem, 5, 4, FFI::NativeCallback.compare(:int32, order: :desc))
+    expect(mem.get_array_of_int32(0, 5)).to eq([ 4, 3, 1, -1, -5 ])
+  end
+
+  it "sorts by a field at an offset" do
+    mem = records([ 1, 2.5, "b" ], [ 2, -1.0, "c" ], [ 3, 7.0, "a" ])
+    LibC.qsort(mem, 3, Record.size, FFI::NativeCallback.compare(:double, offset: Record.offset_of(:score)))
+    expect(ids(mem, 3)).to eq([ 2, 1, 3 ])
+  end
+
+  it "sorts by char array and string fields" do
+    mem = records([ 1, 0, "b" ], [ 2, 0, "c" ], [ 3, 0, "a" ])
+    LibC.qsort(mem, 3, Record.size, FFI::NativeCallback.compare_by(Record, :name))
+    expect(ids(mem, 3)).to eq([ 3, 1, 2 ])
+    LibC.qsort(mem, 3, Record.size, FFI::NativeCallback.compare_by(Record, [ :label, :desc ]))
+    expect(ids(mem, 3)).to eq([ 2, 1, 3 ])
+  end
+
+  it "sorts by composite keys" do
+    mem = records([ 1, 2.0, "x" ], [ 2, 1.0, "y" ], [ 3, 2.0, "a" ], [ 4, 1.0, "z" ])
+    LibC.qsort(mem, 4, Record.size, FFI::NativeCallback.compare_by(Record, [ :score, :desc ], :name))
+    expect(ids(mem, 4)).to eq([ 3, 1, 2, 4 ])
+  end
+
+  it "searches with bsearch" do
+    mem = FFI::MemoryPointer.new(:int32, 4).put_array_of_int32(0, [ 1, 3, 5, 7 ])
+    key = FFI::MemoryPointer.new(:int32).write_int32(5)
+    cmp = FFI::NativeCallback.compare(:int32)
+    expect(LibC.bsearch(key, mem, 4, 4, cmp)).to eq(mem + 8)
+    key.write_int32(4)
+    expect(LibC.bsearch(key, mem, 4, 4, cmp)).to be_null
+  end
+
+  it "tests fields with predicates" do
+    mem = records([ 1, 2.5, "abc" ])
+    expect(call(FFI::NativeCallback.predicate(:int32, :==, 1), :int, mem)).to eq(1)
+    expect(call(FFI::NativeCallback.predicate(:int32, :>, 1), :int, mem)).to eq(0)
+    expect(call(FFI::NativeCallback.predicate_by(Record, score: [ :>=, 2.5 ], name: [ :==, "abc" ]), :int, mem)).to eq(1)
+    expect(call(FFI::NativeCallback.predicate_by(Record, score: [ :>=, 2.5 ], label: [ :!=, "abc" ]), :int, mem)).to eq(0)
+    expect(call(FFI::NativeCallback.predicate(:int32, :==, 1), :int, nil)).to eq(0)
+  end
+
+  it "hashes equal fields the same" do
+    a = records([ 1, 0.0, "abc" ])
+    b = records([ 2, -0.0, "abc" ])
+    c = records([ 1, 0.0, "abd" ])
+    hash = FFI::NativeCallback.hash_by(Record, :score, :name, :label)
+    expect(call(hash, :size_t, a)).to eq(call(hash, :size_t, b))
+    expect(call(hash, :size_t, a)).not_to eq(call(hash, :size_t, c))
+    expect(call(FFI::NativeCallback.hash_of(:int32), :size_t, a)).not_to eq(call(FFI::NativeCallback.hash_of(:int32), :size_t, b))
+  end
+
+  it "raises on invalid keys" do
+    expect { FFI::NativeCallback.compare(:void) }.to raise_error(TypeError)
+    expect { FFI::NativeCallback.compare(:int32, order: :up) }.to raise_error(ArgumentError)
+    expect { FFI::NativeCallback.compare(:int32, offset: -1) }.to raise_error(ArgumentError)
+    expect { FFI::NativeCallback.predicate(:int32, :=~, 1) }.to raise_error(ArgumentError)
+    expect { FFI::NativeCallback.compare_by(Record, :unknown) }.to raise_error(ArgumentError)
+    expect { FFI::NativeCallback.new(:compare, []) }.to raise_error(ArgumentError)
+  end
+end
+end
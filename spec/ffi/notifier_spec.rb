@@ -0,0 +1,55 @@
+#
+# This file is part of ruby-ffi.
+# For licensing, see LICENSE.SPECS
+#
+
+require File.expand_path(File.join(File.dirname(__FILE__), "spec_helper"))
+
+module NotifierSpec
+describe FFI::Notifier, skip: FFI::Platform.windows? do
+  module LibTest
+    extend FFI::Library
+    ffi_lib TestLibrary::PATH
+    callback :cbVrV, [], :void
+    callback :cbPrV, [:pointer], :void
+    attach_function :testClosureVrV, [:cbVrV], :void
+    attach_function :testThreadedClosureVrV, [:cbVrV, :int], :void
+    attach_function :testClosurePrV, [:cbPrV, :pointer], :void
+  end
+
+  it 'counts the signals since the last take' do
+    notifier = FFI::Notifier.new
+    expect(notifier.take).to eq(0)
+    LibTest.testClosureVrV(notifier)
+    LibTest.testThreadedClosureVrV(notifier, 5)
+    expect(notifier.take).to eq(6)
+    expect(notifier.take).to eq(0)
+  end
+
+  it 'can be signalled through the signal function and its data' do
+    notifier = FFI::Notifier.new
+    signal = FFI::Function.new(:void, [:pointer], FFI::Notifier::SIGNAL_FUNCTION)
+    signal.call(notifier.data)
+    LibTest.testClosurePrV(FFI::Notifier::SIGNAL_FUNCTION, notifier.data)
+    notifier.signal
+    expect(notifier.take).to eq(3)
+  end
+
+  it 'has an IO which is readable while signals are pending' do
+    notifier = FFI::Notifier.new
+    expect(IO.select([notifier], nil, nil, 0)).to be_nil
+    LibTest.testThreadedClosureVrV(notifier, 2)
+    expect(IO.select([notifier], nil, nil, 1)).to eq([[notifier], [], []])
+    notifier.take
+    expect(IO.select([notifier], nil, nil, 0)).to be_nil
+  end
+
+  it 'waits for signals' do
+    notifier = FFI::Notifier.new
+    expect(notifier.wait(0.01)).to be_nil
+    thread = Thread.new { sleep 0.05; LibTest.testThreadedClosureVrV(notifier, 1) }
+    expect(notifier.wait(5)).to eq(1)
+    thread.join
+  end
+end
+end
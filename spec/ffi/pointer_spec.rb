@@ -257,6 +257,15 @@ describe "Pointer" do
       pointer = FFI::MemoryPointer.from_string("\x1\x2\x3\x4").order(:network)
       expect(pointer.read_int32).to eq(16909060)
     end
+
+    it "swaps arrays spanning several chunks" do
+      values = (1..1000).map { |i| i * 65537 }
+      pointer = FFI::MemoryPointer.new(:int32, 1000).order(:big)
+      pointer.put_array_of_int32(0, values)
+      expect(pointer.get_array_of_int32(0, 1000)).to eq(values)
+      expect(pointer.get_bytes(4 * 999, 4)).to eq([1000 * 65537].pack("N"))
+      expect(pointer.get_array_of_uint16(4 * 999, 2)).to eq([1000, 1000])
+    end
   end if RUBY_ENGINE != "truffleruby"
 
   describe "#size_limit?" do
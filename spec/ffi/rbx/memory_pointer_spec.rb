@@ -39,6 +39,56 @@ describe "MemoryPointer" do
     expect(m.read_array_of_int(2)).to eq([1,2])
   end
 
+  it "reads and writes arrays larger than a conversion chunk" do
+    ints = (0...1000).map { |i| (i - 500) * 2**40 }
+    m = FFI::MemoryPointer.new(:int64, 1000)
+    m.write_array_of_int64(ints)
+    expect(m.read_array_of_int64(1000)).to eq(ints)
+
+    doubles = (0...1000).map { |i| i * 0.5 + (i.even? ? 1e300 : 0) }
+    m.write_array_of_double(doubles)
+    expect(m.read_array_of_double(1000)).to eq(doubles)
+  end
+
+  it "checks the range of each array element" do
+    m = FFI::MemoryPointer.new(:uint32, 2)
+    m.write_array_of_uint32([-2**31, 2**32 - 1])
+    expect(m.read_array_of_uint32(2)).to eq([2**31, 2**32 - 1])
+    expect { m.write_array_of_uint32([0, 2**32]) }.to raise_error(RangeError)
+    expect { m.write_array_of_int32([0, -2**31 - 1]) }.to raise_error(RangeError)
+    expect { FFI::MemoryPointer.new(:double, 2).write_array_of_double([1.0, nil]) }.to raise_error(TypeError)
+  end
+
+  it "reads and writes packed values" do
+    m = FFI::MemoryPointer.new(:int32, 3)
+    m.write_array_of_int32([1, -2, 3])
+    expect(m.read_packed(:int32, 3)).to eq([1, -2, 3].pack("l*"))
+    expect(m.get_packed(4, :int32, 2).unpack("l*")).to eq([-2, 3])
+    expect(m.read_packed(:int32, 3).encoding).to eq(Encoding::BINARY)
+
+    m.put_packed(4, :uint16, [7, 8].pack("S*"))
+    expect(m.get_array_of_uint16(4, 2)).to eq([7, 8])
+    m.write_packed(FFI::Type::DOUBLE, [1.5].pack("d"))
+    expect(m.read_double).to eq(1.5)
+  end
+
+  it "swaps packed integers according to the byte order" do
+    m = FFI::MemoryPointer.new(:uint32, 2)
+    other = FFI::Platform::BYTE_ORDER == FFI::Platform::LITTLE_ENDIAN ? :big : :little
+    m.order(other).write_packed(:uint32, [0x01020304, 0x05060708].pack("L*"))
+    expect(m.read_array_of_uint32(2)).to eq([0x04030201, 0x08070605])
+    expect(m.order(other).read_packed(:uint32, 2).unpack("L*")).to eq([0x01020304, 0x05060708])
+  end
+
+  it "checks the type, count and size of packed values" do
+    m = FFI::MemoryPointer.new(:int32, 2)
+    expect { m.read_packed(:string, 1) }.to raise_error(ArgumentError)
+    expect { m.read_packed(:int32, -1) }.to raise_error(ArgumentError)
+    expect { m.read_packed(:int32, 3) }.to raise_error(IndexError)
+    expect { m.write_packed(:int32, "abc") }.to raise_error(ArgumentError)
+    expect { m.put_packed(4, :int32, "\0" * 8) }.to raise_error(IndexError)
+  end
+
   it "allows access to an element of the pointer (as an array)" do
     m = FFI::MemoryPointer.new(:int, 2)
     m.write_array_of_int([1,2])
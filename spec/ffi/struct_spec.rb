@@ -849,6 +849,35 @@ describe FFI::Struct, ' by value' do
     expect(ret[:s32]).to eq(s[:s32])
   end
 
+  it 'parameter from a Hash' do
+    expect(LibTest.struct_s8s32_get_s8({ s8: 0x12, s32: 0x34567890 })).to eq(0x12)
+    expect(LibTest.struct_s8s32_get_s32({ s8: 0x12, s32: 0x34567890 })).to eq(0x34567890)
+    expect(LibTest.struct_s8s32_get_s32({ "s32" => 0x34567890 })).to eq(0x34567890)
+  end
+
+  it 'parameter from a Hash leaves missing fields zeroed' do
+    expect(LibTest.struct_s8s32_get_s8({ s32: 0x34567890 })).to eq(0)
+  end
+
+  it 'parameter from an Array' do
+    expect(LibTest.struct_s8s32_s32_ret_s32([0x12, 0x34567890], 0x1eefdead)).to eq(0x1eefdead)
+    ret = LibTest.struct_s8s32_ret_s8s32([0x12, 0x34567890])
+    expect(ret[:s8]).to eq(0x12)
+    expect(ret[:s32]).to eq(0x34567890)
+  end
+
+  it 'parameter from a Hash with an unknown field raises' do
+    expect { LibTest.struct_s8s32_get_s8({ s16: 1 }) }.to raise_error(ArgumentError, /No such field/)
+  end
+
+  it 'parameter from an Array with too many values raises' do
+    expect { LibTest.struct_s8s32_get_s8([1, 2, 3]) }.to raise_error(ArgumentError)
+  end
+
+  it 'parameter from a Hash with preceding s32,ptr,s32' do
+    expect(LibTest.struct_s32_ptr_s32_s8s32_ret_s32(0x1000000, nil, 0x1eafbeef, { s8: 0x12, s32: 0x34567890 })).to eq(0x34567890)
+  end
+
   it 'varargs returning a struct' do
     string = "test"
     s = LibTest.struct_varargs_ret_struct_string(4, :string, string)
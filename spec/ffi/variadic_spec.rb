@@ -35,6 +35,70 @@ describe "Function with variadic arguments" do
     expect(buf.get_int64(8)).to eq(43)
   end
 
+  it "infers vararg types from the values" do
+    buf = FFI::Buffer.new :long_long, 3
+    LibTest.pack_varargs(buf, "ijd", 0x7654321f, 0x1eafdeadbeefa1b2, 1.5)
+    expect(buf.get_int64(0)).to eq(0x7654321f)
+    expect(buf.get_int64(8)).to eq(0x1eafdeadbeefa1b2)
+    expect(buf.get_float64(16)).to eq(1.5)
+  end
+
+  it "takes [type, value] pairs" do
+    buf = FFI::Buffer.new :long_long, 3
+    LibTest.pack_varargs(buf, "iil", [:int, :c3], 5, [:long, 0x1f2e3d4c])
+    expect(buf.get_int64(0)).to eq(42)
+    expect(buf.get_int64(8)).to eq(5)
+    expect(buf.get_int64(16)).to eq(0x1f2e3d4c)
+  end
+
+  it "takes DataConverters and Enums as vararg types" do
+    doubler = Module.new do
+      extend FFI::DataConverter
+      native_type FFI::Type::INT
+      def self.to_native(value, ctx)
+        value * 2
+      end
+    end
+    lib = Module.new do
+      extend FFI::Library
+      ffi_lib TestLibrary::PATH
+      attach_function :pack_varargs, [ :buffer_out, :string, :varargs ], :void
+    end
+    buf = FFI::Buffer.new :long_long, 2
+    lib.pack_varargs(buf, "ii", doubler, 21, LibTest.enum_type(:enum_type2), :c4)
+    expect(buf.get_int64(0)).to eq(42)
+    expect(buf.get_int64(8)).to eq(43)
+  end
+
+  it "resolves vararg types in the library's typedefs first" do
+    lib = Module.new do
+      extend FFI::Library
+      ffi_lib TestLibrary::PATH
+      typedef :long_long, :int
+      attach_function :pack_varargs, [ :buffer_out, :string, :varargs ], :void
+    end
+    buf = FFI::Buffer.new :long_long, 1
+    lib.pack_varargs(buf, "j", :int, 0x1eafdeadbeefa1b2)
+    expect(buf.get_int64(0)).to eq(0x1eafdeadbeefa1b2)
+  end
+
+  it "raises when a vararg type can't be inferred" do
+    buf = FFI::Buffer.new :long_long, 1
+    expect { LibTest.pack_varargs(buf, "i", Object.new) }.to raise_error(TypeError)
+  end
+
+  it "reuses prepared call shapes" do
+    buf = FFI::Buffer.new :long_long, 2
+    20.times do |i|
+      LibTest.pack_varargs(buf, "id", i, i.to_f)
+      expect(buf.get_int64(0)).to eq(i)
+      expect(buf.get_float64(8)).to eq(i.to_f)
+      LibTest.pack_varargs(buf, "di", :double, i.to_f, :int, i)
+      expect(buf.get_float64(0)).to eq(i.to_f)
+      expect(buf.get_int64(8)).to eq(i)
+    end
+  end
+
   it "returns symbols for enums" do
     buf = FFI::Buffer.new :long_long, 2
     expect(LibTest.pack_varargs2(buf, :c1, "ii", :int, :c3, :int, :c4)).to eq(:c2)